@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include <ki/dml/types.h>
+#include <ki/dml/Record.h>
+#include <ki/protocol/dml/MessageManager.h>
+
+namespace kipy
+{
+    namespace fuzz
+    {
+        /**
+         * Adds the fields of the record that tests/samples/dml.bin was
+         * serialized from.
+         */
+        inline void add_sample_fields(ki::dml::Record &record)
+        {
+            using namespace ki::dml;
+
+            record.add_field<BYT>("TestByt");
+            record.add_field<UBYT>("TestUByt");
+            record.add_field<SHRT>("TestShrt");
+            record.add_field<USHRT>("TestUShrt");
+            record.add_field<INT>("TestInt");
+            record.add_field<UINT>("TestUInt");
+            record.add_field<STR>("TestStr");
+            record.add_field<WSTR>("TestWStr");
+            record.add_field<FLT>("TestFlt");
+            record.add_field<DBL>("TestDbl");
+            record.add_field<GID>("TestGid");
+            record.add_field<BYT>("TestNOXFER", false);
+        }
+
+        /**
+         * Returns a message manager with FuzzMessages.xml loaded, whose
+         * MSG_SAMPLE message has the same fields as the sample record.
+         * Aborts if the module fails to load, rather than fuzzing
+         * against an empty manager.
+         */
+        inline const ki::protocol::dml::MessageManager &get_message_manager()
+        {
+            static std::unique_ptr<ki::protocol::dml::MessageManager> manager;
+            if (!manager)
+            {
+                manager.reset(new ki::protocol::dml::MessageManager());
+                if (!manager->load_module(KIPY_FUZZ_MESSAGES))
+                {
+                    std::fprintf(stderr, "Failed to load message module: %s\n", KIPY_FUZZ_MESSAGES);
+                    std::abort();
+                }
+            }
+            return *manager;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+/**
+ * Fuzzes RecordDeltaDecoder. Each input holds a sequence of deltas,
+ * each prefixed with its size (USHRT), so that later deltas patch the
+ * messages left behind by earlier ones.
+ */
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <ki/dml/exception.h>
+
+#include "record_delta.h"
+#include "fuzz_common.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    kipy::RecordDeltaDecoder decoder(kipy::fuzz::get_message_manager());
+
+    size_t offset = 0;
+    while (size - offset >= 2)
+    {
+        const size_t delta_size = std::min<size_t>(
+            data[offset] | (data[offset + 1] << 8), size - offset - 2);
+        offset += 2;
+        try
+        {
+            decoder.apply(reinterpret_cast<const char *>(data + offset), delta_size);
+        }
+        catch (ki::dml::runtime_error &) {}
+        offset += delta_size;
+    }
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * Fuzzes DML message decoding against FuzzMessages.xml, both one
+ * message at a time and through the batch decoder.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+
+#include <ki/dml/exception.h>
+#include <ki/protocol/exception.h>
+#include <ki/protocol/dml/Message.h>
+
+#include "message_codec.h"
+#include "parallel_decode.h"
+#include "fuzz_common.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const auto *bytes = reinterpret_cast<const char *>(data);
+    const auto &manager = kipy::fuzz::get_message_manager();
+
+    try
+    {
+        kipy::InputMemoryBuffer buffer(bytes, size);
+        std::istream istream(&buffer);
+        std::unique_ptr<ki::protocol::dml::Message> message(
+            manager.message_from_binary(istream));
+    }
+    catch (ki::dml::runtime_error &) {}
+    catch (ki::protocol::runtime_error &) {}
+
+    try
+    {
+        for (auto *message : kipy::decode_messages(manager, bytes, size, 1))
+            delete message;
+    }
+    catch (ki::dml::runtime_error &) {}
+    catch (ki::protocol::runtime_error &) {}
+    return 0;
+}
@@ -0,0 +1,38 @@
+/**
+ * Fuzzes Record deserialization, through both libki's stream reader
+ * and kipy's columnar batch reader.
+ */
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+
+#include <ki/dml/Record.h>
+#include <ki/dml/exception.h>
+
+#include "message_codec.h"
+#include "record_columns.h"
+#include "fuzz_common.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const auto *bytes = reinterpret_cast<const char *>(data);
+
+    ki::dml::Record record;
+    kipy::fuzz::add_sample_fields(record);
+    try
+    {
+        kipy::InputMemoryBuffer buffer(bytes, size);
+        std::istream istream(&buffer);
+        record.read_from(istream);
+    }
+    catch (ki::dml::runtime_error &) {}
+
+    try
+    {
+        kipy::ColumnBatch batch(record);
+        kipy::ByteReader reader(bytes, size);
+        batch.read_from(reader);
+    }
+    catch (ki::dml::runtime_error &) {}
+    return 0;
+}
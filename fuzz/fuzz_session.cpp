@@ -0,0 +1,80 @@
+/**
+ * Fuzzes packet framing and control/DML message handling.
+ *
+ * The first byte of each input picks the session (server or client),
+ * and how many bytes arrive per read. Reads are small and go through a
+ * ReceiveBuffer, so that frames regularly wrap around its ring.
+ *
+ * Exceptions thrown out of process_data() are left to crash the fuzzer,
+ * as in production they would end the connection's handler.
+ */
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <ki/protocol/net/ServerDMLSession.h>
+#include <ki/protocol/net/ClientDMLSession.h>
+
+#include "receive_buffer.h"
+#include "fuzz_common.h"
+
+namespace
+{
+    template <typename SessionT>
+    class FuzzSession : public SessionT
+    {
+    public:
+        explicit FuzzSession(const ki::protocol::dml::MessageManager &manager)
+            : ki::protocol::net::Session(1), SessionT(1, manager), m_closed(false) {}
+
+        bool is_closed() const { return m_closed; }
+
+        void feed(kipy::ReceiveBuffer &buffer)
+        {
+            buffer.process([this](const char *data, const size_t size)
+            {
+                if (!m_closed)
+                    this->process_data(data, size);
+            });
+        }
+
+    protected:
+        void send_packet_data(const char *, const size_t) override {}
+        void close(ki::protocol::net::SessionCloseErrorCode) override { m_closed = true; }
+
+    private:
+        bool m_closed;
+    };
+
+    template <typename SessionT>
+    void fuzz_session(const uint8_t *data, const size_t size, const size_t read_size)
+    {
+        FuzzSession<SessionT> session(kipy::fuzz::get_message_manager());
+        kipy::ReceiveBuffer buffer;
+
+        const auto *bytes = reinterpret_cast<const char *>(data);
+        for (size_t offset = 0; offset < size && !session.is_closed(); )
+        {
+            const auto written = buffer.write(bytes + offset, std::min(read_size, size - offset));
+            if (written == 0)
+                break;
+
+            session.feed(buffer);
+            offset += written;
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 1)
+        return 0;
+
+    const auto options = data[0];
+    const size_t read_size = (options & 0x7F) + 1;
+    if (options & 0x80)
+        fuzz_session<ki::protocol::net::ClientDMLSession>(data + 1, size - 1, read_size);
+    else
+        fuzz_session<ki::protocol::net::ServerDMLSession>(data + 1, size - 1, read_size);
+    return 0;
+}
@@ -0,0 +1,137 @@
+"""Builds the seed corpus of every fuzz target from tests/samples/dml.bin.
+
+    python fuzz/make_corpus.py --output corpus tests/samples/dml.bin
+
+Writes one directory per fuzz target into the output directory.
+"""
+import argparse
+import os
+import struct
+import sys
+
+# The fields of the sample record, in order (see fuzz_common.h).
+SAMPLE_FIELD_TYPES = ['BYT', 'UBYT', 'SHRT', 'USHRT', 'INT', 'UINT',
+                      'STR', 'WSTR', 'FLT', 'DBL', 'GID']
+FIXED_SIZES = {'BYT': 1, 'UBYT': 1, 'SHRT': 2, 'USHRT': 2, 'INT': 4,
+               'UINT': 4, 'FLT': 4, 'DBL': 8, 'GID': 8}
+
+# See FuzzMessages.xml.
+SERVICE_ID = 1
+MSG_SAMPLE = 1
+MSG_EMPTY = 2
+
+# Control opcodes
+SESSION_OFFER = 0x00
+KEEP_ALIVE = 0x03
+KEEP_ALIVE_RSP = 0x04
+SESSION_ACCEPT = 0x05
+
+CLIENT_SESSION = 0x80
+
+
+def split_fields(sample):
+    """Returns the serialized value of each field of the sample record."""
+    values = []
+    offset = 0
+    for field_type in SAMPLE_FIELD_TYPES:
+        if field_type in FIXED_SIZES:
+            size = FIXED_SIZES[field_type]
+        else:
+            length, = struct.unpack_from('<H', sample, offset)
+            size = 2 + length * (2 if field_type == 'WSTR' else 1)
+        values.append(sample[offset:offset + size])
+        offset += size
+    return values
+
+
+def build_message(message_type, record):
+    return struct.pack('<BBH', SERVICE_ID, message_type, 4 + len(record)) + record
+
+
+def build_delta(message_type, values, changed):
+    mask = 0
+    data = b''
+    for i in changed:
+        mask |= 1 << i
+        data += values[i]
+    mask_size = (len(values) + 7) // 8
+    return struct.pack('<BBH', SERVICE_ID, message_type, len(values)) + \
+        mask.to_bytes(mask_size, 'little') + data
+
+
+def build_deltas(deltas):
+    return b''.join(struct.pack('<H', len(delta)) + delta for delta in deltas)
+
+
+def build_frame(control, opcode, payload):
+    return struct.pack('<HHBBH', 0xF00D, 4 + len(payload), int(control), opcode, 0) + payload
+
+
+def build_corpus(sample):
+    values = split_fields(sample)
+    everything = range(len(values))
+    message = build_message(MSG_SAMPLE, sample)
+    empty_message = build_message(MSG_EMPTY, b'')
+
+    app_frame = build_frame(False, 0, message)
+    offer = build_frame(True, SESSION_OFFER, struct.pack('<HiIIB', 1, 0, 0, 0, 0))
+    accept = build_frame(True, SESSION_ACCEPT, struct.pack('<HiIIHB', 0, 0, 0, 0, 1, 0))
+    client_keep_alive = build_frame(True, KEEP_ALIVE, struct.pack('<HHH', 1, 0, 0))
+    server_keep_alive = build_frame(True, KEEP_ALIVE_RSP, struct.pack('<HI', 0, 0))
+
+    return {
+        'fuzz_record': {
+            'sample': sample,
+            'sample_twice': sample * 2,
+            'truncated': sample[:-1],
+        },
+        'fuzz_message': {
+            'sample': message,
+            'empty': empty_message,
+            'batch': message + empty_message + message,
+            # Declares far more data than it has.
+            'huge_size': struct.pack('<BBH', SERVICE_ID, MSG_SAMPLE, 0xFFFF) + sample,
+        },
+        'fuzz_delta': {
+            'full': build_deltas([build_delta(MSG_SAMPLE, values, everything)]),
+            'updates': build_deltas([
+                build_delta(MSG_SAMPLE, values, everything),
+                build_delta(MSG_SAMPLE, values, [5]),
+                build_delta(MSG_SAMPLE, values, [6, 7]),
+                build_delta(MSG_EMPTY, [], []),
+            ]),
+        },
+        'fuzz_session': {
+            'server': bytes([0x7F]) + accept + client_keep_alive + app_frame,
+            'server_small_reads': bytes([0x02]) + accept + app_frame * 3,
+            'client': bytes([CLIENT_SESSION | 0x7F]) + offer + server_keep_alive + app_frame,
+            'client_small_reads': bytes([CLIENT_SESSION | 0x05]) + offer + app_frame * 3,
+            # Declares the largest frame possible, but never finishes it.
+            'huge_frame': bytes([0x7F]) + struct.pack('<HH', 0xF00D, 0x7FFF) + app_frame,
+            'unframed': bytes([0x7F]) + message,
+        },
+    }
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        prog='python fuzz/make_corpus.py',
+        description='Builds the seed corpus of every fuzz target.')
+    parser.add_argument('--output', required=True,
+                        help='the directory to write the corpus to')
+    parser.add_argument('sample', help='the sample record (tests/samples/dml.bin)')
+    args = parser.parse_args(argv)
+
+    with open(args.sample, 'rb') as f:
+        sample = f.read()
+
+    for target, seeds in build_corpus(sample).items():
+        directory = os.path.join(args.output, target)
+        os.makedirs(directory, exist_ok=True)
+        for name, data in seeds.items():
+            with open(os.path.join(directory, name), 'wb') as f:
+                f.write(data)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,356 @@
+"""Generates typed message bindings from DML message definitions.
+
+Every message template in the given definition files becomes a C++
+struct with one member per transferable field. These structs are bound
+to Python with plain attributes, so reading or writing a field does not
+involve a name lookup, or an intermediate `Field` object.
+
+The generated source is meant to be built with the
+`KIPY_MESSAGE_DEFINITIONS` CMake option, but it can also be invoked
+directly:
+
+    python -m ki.codegen --name messages --output messages.cpp \\
+        --stub messages.pyi LoginMessages.xml GameMessages.xml
+"""
+import argparse
+import keyword
+import re
+import sys
+
+from . import dml
+from .protocol.dml import MessageManager
+
+
+class FieldType(object):
+    def __init__(self, dml_type, py_type, default):
+        self.dml_type = dml_type
+        self.cpp_type = 'ki::dml::%s' % dml_type
+        self.py_type = py_type
+        self.default = default
+
+
+FIELD_TYPES = {
+    dml.BytField: FieldType('BYT', 'int', '0'),
+    dml.UBytField: FieldType('UBYT', 'int', '0'),
+    dml.ShrtField: FieldType('SHRT', 'int', '0'),
+    dml.UShrtField: FieldType('USHRT', 'int', '0'),
+    dml.IntField: FieldType('INT', 'int', '0'),
+    dml.UIntField: FieldType('UINT', 'int', '0'),
+    dml.StrField: FieldType('STR', 'str', None),
+    dml.WStrField: FieldType('WSTR', 'str', None),
+    dml.FltField: FieldType('FLT', 'float', '0.0f'),
+    dml.DblField: FieldType('DBL', 'float', '0.0'),
+    dml.GidField: FieldType('GID', 'int', '0'),
+}
+
+
+# Attributes that every generated message class already has.
+MESSAGE_ATTRIBUTES = frozenset([
+    'SERVICE_ID', 'TYPE', 'NAME', 'size',
+    'to_bytes', 'from_bytes', 'to_message', 'from_message',
+])
+
+# Attributes that the generated module already has.
+MODULE_ATTRIBUTES = frozenset(['message_from_bytes'])
+
+
+def to_identifier(name, reserved=frozenset()):
+    """Returns a valid Python identifier based on the given name, that
+    is neither in `reserved`, nor a special (dunder) name.
+    """
+    identifier = re.sub(r'\W', '_', name, flags=re.ASCII)
+    if not identifier or identifier[0].isdigit() or keyword.iskeyword(identifier):
+        identifier = '_' + identifier
+    if identifier in reserved or (identifier.startswith('__') and identifier.endswith('__')):
+        identifier += '_'
+    return identifier
+
+
+def to_cpp_identifier(identifier):
+    """Returns the given identifier without runs of underscores, which
+    are reserved in C++.
+    """
+    return re.sub(r'__+', '_', identifier)
+
+
+def to_cpp_string(value):
+    """Returns a C++ string literal holding the given value."""
+    literal = []
+    for byte in value.encode('utf-8'):
+        char = chr(byte)
+        if char in '"\\?':
+            literal.append('\\' + char)
+        elif 0x20 <= byte < 0x7F:
+            literal.append(char)
+        else:
+            literal.append('\\%03o' % byte)
+    return '"%s"' % ''.join(literal)
+
+
+def check_unique(items, key, describe):
+    """Raises a ValueError if any two of the given items share a key."""
+    seen = {}
+    for item in items:
+        other = seen.setdefault(key(item), item)
+        if other is not item:
+            raise ValueError('%s and %s would have the same name: %r' % (
+                describe(other), describe(item), key(item)))
+
+
+class FieldDefinition(object):
+    def __init__(self, field):
+        self.name = field.name
+        self.attribute = to_identifier(field.name, MESSAGE_ATTRIBUTES)
+        self.member = to_cpp_identifier('m_' + self.attribute)
+        self.type = FIELD_TYPES[type(field)]
+
+
+class MessageDefinition(object):
+    def __init__(self, module, message_template):
+        self.service_id = module.service_id
+        self.protocol_type = module.protocol_type
+        self.name = message_template.name
+        self.type = message_template.type
+        self.class_name = to_identifier(message_template.name)
+        self.struct_name = to_cpp_identifier('%s_%s' % (
+            to_identifier(module.protocol_type), self.class_name))
+
+        # Only transferable fields exist on the wire.
+        self.fields = [FieldDefinition(field) for field in message_template.record
+                       if field.transferable]
+
+        describe = lambda field: 'Field %r of %s' % (field.name, self.name)
+        check_unique(self.fields, lambda field: field.attribute, describe)
+        check_unique(self.fields, lambda field: field.member, describe)
+
+
+class ModuleDefinition(object):
+    def __init__(self, module):
+        self.service_id = module.service_id
+        self.protocol_type = module.protocol_type
+        self.submodule = to_identifier(module.protocol_type, MODULE_ATTRIBUTES)
+        self.messages = [MessageDefinition(module, message_template)
+                         for message_template in module.message_templates()]
+
+        check_unique(self.messages, lambda message: message.class_name,
+                     lambda message: 'Message %r' % message.name)
+
+
+def load_definitions(filepaths):
+    """Loads the given message definition files, and returns a list of
+    `ModuleDefinition` instances describing them.
+    """
+    manager = MessageManager()
+    definitions = []
+    for filepath in filepaths:
+        module = manager.load_module(filepath)
+        if module is None:
+            raise ValueError('Failed to load message module: %r' % filepath)
+        definitions.append(ModuleDefinition(module))
+    check_definitions(definitions)
+    return definitions
+
+
+def check_definitions(definitions):
+    """Raises a ValueError if any two modules or messages in the given
+    definitions would clash in the generated source.
+    """
+    check_unique(definitions, lambda module: module.submodule,
+                 lambda module: 'Module %r' % module.protocol_type)
+
+    messages = [message for module in definitions for message in module.messages]
+    describe = lambda message: 'Message %r (%s)' % (message.name, message.protocol_type)
+    check_unique(messages, lambda message: message.struct_name, describe)
+    check_unique(messages, lambda message: (message.service_id, message.type), describe)
+
+
+def _generate_struct(message):
+    lines = [
+        '    struct %s' % message.struct_name,
+        '    {',
+        '        static constexpr uint8_t SERVICE_ID = %d;' % message.service_id,
+        '        static constexpr uint8_t TYPE = %d;' % message.type,
+        '        static constexpr const char *NAME = %s;' % to_cpp_string(message.name),
+        '',
+    ]
+    for field in message.fields:
+        if field.type.default is not None:
+            lines.append('        %s %s = %s;' % (field.type.cpp_type, field.member,
+                                                field.type.default))
+        else:
+            lines.append('        %s %s;' % (field.type.cpp_type, field.member))
+    if message.fields:
+        lines.append('')
+
+    lines += [
+        '        size_t get_record_size() const',
+        '        {',
+        '            return 0',
+    ]
+    lines += ['                + kipy::get_value_size(%s)' % field.member
+              for field in message.fields]
+    lines[-1] += ';'
+    # Unused parameters are left unnamed for messages without fields.
+    writer = 'writer' if message.fields else ''
+    reader = 'reader' if message.fields else ''
+    lines += [
+        '        }',
+        '',
+        '        void write_record(kipy::ByteWriter &%s) const' % writer,
+        '        {',
+    ]
+    lines += ['            kipy::write_value(writer, %s);' % field.member
+              for field in message.fields]
+    lines += [
+        '        }',
+        '',
+        '        void read_record(kipy::ByteReader &%s)' % reader,
+        '        {',
+    ]
+    lines += ['            kipy::read_value(reader, %s);' % field.member
+              for field in message.fields]
+    lines += [
+        '        }',
+        '    };',
+    ]
+    return lines
+
+
+def _generate_binding(module, message):
+    lines = [
+        '    // Class: %s.%s' % (module.submodule, message.class_name),
+        '    kipy::bind_message<%s>(m_%s, "%s")' % (
+            message.struct_name, module.submodule, message.class_name),
+    ]
+    for field in message.fields:
+        lines.append('        .def_readwrite("%s", &%s::%s)' % (
+            field.attribute, message.struct_name, field.member))
+    lines[-1] += ';'
+    lines.append('    registry.add_message<%s>();' % message.struct_name)
+    return lines
+
+
+def generate_source(definitions, module_name):
+    """Returns the C++ source of an extension module, named
+    `module_name`, that binds every message in the given definitions.
+    """
+    lines = [
+        '// Generated by ki.codegen -- do not edit.',
+        '#include <string>',
+        '',
+        '#include <pybind11/pybind11.h>',
+        '',
+        '#include "generated_message.h"',
+        '',
+        'namespace py = pybind11;',
+        '',
+        'namespace',
+        '{',
+        '    kipy::MessageRegistry registry;',
+    ]
+    for module in definitions:
+        for message in module.messages:
+            lines.append('')
+            lines += _generate_struct(message)
+    lines += [
+        '}',
+        '',
+        'PYBIND11_MODULE(%s, m)' % module_name,
+        '{',
+    ]
+    for module in definitions:
+        lines += [
+            '    // Submodule: %s' % module.submodule,
+            '    py::module m_%s = m.def_submodule("%s");' % (
+                module.submodule, module.submodule),
+            '',
+        ]
+        for message in module.messages:
+            lines += _generate_binding(module, message)
+            lines.append('')
+        lines += [
+            '    // Submodule: %s (end)' % module.submodule,
+            '',
+        ]
+    lines += [
+        '    // Function: message_from_bytes()',
+        '    m.def("message_from_bytes",',
+        '        [](std::string data)',
+        '        {',
+        '            return registry.message_from_bytes(data);',
+        '        },',
+        '        py::arg("data"));',
+        '}',
+    ]
+    return '\n'.join(lines) + '\n'
+
+
+def generate_stub(definitions):
+    """Returns a type stub (.pyi) describing the module generated by
+    `generate_source()`, for use with static type checkers.
+    """
+    lines = [
+        '# Generated by ki.codegen -- do not edit.',
+        'from typing import Optional, Union',
+        '',
+        'from .protocol.dml import Message, MessageManager',
+    ]
+    classes = []
+    for module in definitions:
+        lines += [
+            '',
+            '',
+            'class %s:' % module.submodule,
+        ]
+        for message in module.messages:
+            classes.append('%s.%s' % (module.submodule, message.class_name))
+            lines += [
+                '    class %s:' % message.class_name,
+                '        SERVICE_ID: int',
+                '        TYPE: int',
+                '        NAME: str',
+                '        size: int',
+            ]
+            for field in message.fields:
+                lines.append('        %s: %s' % (field.attribute, field.type.py_type))
+            lines += [
+                '        def to_bytes(self) -> bytes: ...',
+                '        def from_bytes(self, data: bytes) -> None: ...',
+                '        def to_message(self, manager: MessageManager) -> Message: ...',
+                '        def from_message(self, message: Message) -> None: ...',
+                '',
+            ]
+        if not module.messages:
+            lines.append('    pass')
+    lines += [
+        '',
+        'def message_from_bytes(data: bytes) -> Optional[Union[%s]]: ...' % (
+            ', '.join(classes) or 'None'),
+    ]
+    return '\n'.join(lines) + '\n'
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        prog='python -m ki.codegen',
+        description='Generates typed message bindings from DML message definitions.')
+    parser.add_argument('--name', default='messages',
+                        help='the name of the generated extension module')
+    parser.add_argument('--output', required=True,
+                        help='where to write the generated C++ source')
+    parser.add_argument('--stub', help='where to write the generated type stub')
+    parser.add_argument('definitions', nargs='+',
+                        help='the message definition files to generate bindings for')
+    args = parser.parse_args(argv)
+
+    definitions = load_definitions(args.definitions)
+
+    with open(args.output, 'w', encoding='utf-8') as f:
+        f.write(generate_source(definitions, args.name))
+    if args.stub is not None:
+        with open(args.stub, 'w', encoding='utf-8') as f:
+            f.write(generate_stub(definitions))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,323 @@
+import logging
+import struct
+import weakref
+import zlib
+from enum import IntEnum
+
+from .extensions import COMPRESSION_OPCODE, COMPRESSED_OPCODE, \
+    FRAME_HEADER_SIZE, PACKET_HEADER_SIZE, build_frame, parse_frame
+from .protocol.compression import ZSTD_AVAILABLE
+
+if ZSTD_AVAILABLE:
+    from .protocol.compression import ZstdCodec as _ZstdCodec, ZstdDictionary
+
+
+# A compressed packet's payload is prefixed with the codec, and the
+# original packet's control flag, opcode, and payload size.
+COMPRESSED_HEADER = struct.Struct('<BBBH')
+
+# Packets larger than this are left alone, so that the compressed
+# packet can never outgrow the 16-bit frame length.
+MAX_COMPRESSIBLE_SIZE = 0x7F00
+
+
+class Codec(IntEnum):
+    NONE = 0
+    ZLIB = 1
+    ZSTD = 2
+
+
+class NegotiationType(IntEnum):
+    OFFER = 0
+    ACCEPT = 1
+
+
+def get_dictionary_id(dictionary):
+    """Returns the ID that peers use to confirm they share a dictionary."""
+    return zlib.crc32(dictionary) & 0xFFFFFFFF if dictionary else 0
+
+
+def build_zlib_dictionary(samples, size=0x8000):
+    """Builds a zlib dictionary from samples of captured traffic.
+
+    zlib favors matches closer to the end of its dictionary, so the
+    most recent samples are kept and placed last.
+    """
+    dictionary = b''
+    for sample in reversed(samples):
+        if len(dictionary) + len(sample) > size:
+            break
+        dictionary = sample + dictionary
+    return dictionary
+
+
+def train_dictionary(samples, size=0x4000):
+    """Builds a dictionary from samples of captured traffic (for
+    example, the DML messages of a recorded session), using zstd's
+    trainer when it is available.
+    """
+    if ZSTD_AVAILABLE:
+        return _ZstdCodec.train_dictionary(samples, size)
+    return build_zlib_dictionary(samples, size)
+
+
+class ZlibCodec(object):
+    """Compresses every packet of a session through one zlib stream.
+
+    Keeping the stream (and its window) alive across packets is what
+    makes small packets compress well, but it also means every packet
+    that goes through `compress()` must reach the peer, in order.
+    """
+    id = Codec.ZLIB
+    stateful = True
+
+    def __init__(self, level=1, dictionary=b''):
+        self.level = level
+        self.dictionary = dictionary
+        self.dictionary_id = get_dictionary_id(dictionary)
+
+        # Each direction only needs one of these, so they are created
+        # when first used.
+        self._compressor = None
+        self._decompressor = None
+
+    def compress(self, data):
+        if self._compressor is None:
+            kwargs = {'zdict': self.dictionary} if self.dictionary else {}
+            self._compressor = zlib.compressobj(
+                self.level, zlib.DEFLATED, -zlib.MAX_WBITS, **kwargs)
+
+        # Every sync flush ends with the same 4 bytes; leave them off.
+        data = self._compressor.compress(data) + self._compressor.flush(zlib.Z_SYNC_FLUSH)
+        return data[:-4]
+
+    def decompress(self, data, size):
+        if self._decompressor is None:
+            kwargs = {'zdict': self.dictionary} if self.dictionary else {}
+            self._decompressor = zlib.decompressobj(-zlib.MAX_WBITS, **kwargs)
+        return self._decompressor.decompress(data + b'\x00\x00\xff\xff', size)
+
+
+class ZstdCodec(object):
+    """Compresses each packet of a session independently with zstd,
+    reusing the same contexts for every packet.
+
+    `digested` may be a `ZstdDictionary` already made from `dictionary`,
+    so that codecs using the same dictionary share it.
+    """
+    id = Codec.ZSTD
+    stateful = False
+
+    def __init__(self, level=3, dictionary=b'', digested=None):
+        self.dictionary_id = get_dictionary_id(dictionary)
+        if digested is None and dictionary:
+            digested = ZstdDictionary(dictionary, level)
+        self._codec = _ZstdCodec(level, digested)
+
+    def compress(self, data):
+        return self._codec.compress(data)
+
+    def decompress(self, data, size):
+        return self._codec.decompress(data, size)
+
+
+def create_codec(codec, level=None, dictionary=b'', digested=None):
+    """Returns a new instance of the given codec."""
+    if codec == Codec.ZLIB:
+        return ZlibCodec(1 if level is None else level, dictionary)
+    if codec == Codec.ZSTD and ZSTD_AVAILABLE:
+        return ZstdCodec(3 if level is None else level, dictionary, digested)
+    raise ValueError('Codec is not available: %r' % codec)
+
+
+class CompressionPolicy(object):
+    """Decides which codecs a session may use, and which of its
+    application packets are worth compressing.
+
+    `thresholds` maps (service ID, message type) to the minimum
+    message size to compress, or `None` to never compress that message
+    type; every other message type uses `threshold`.
+    """
+
+    def __init__(self, codecs=None, threshold=512, thresholds=None,
+                 level=None, dictionary=b''):
+        if codecs is None:
+            codecs = [Codec.ZSTD, Codec.ZLIB]
+        self.codecs = [Codec(codec) for codec in codecs
+                       if codec != Codec.ZSTD or ZSTD_AVAILABLE]
+        self.threshold = threshold
+        self.thresholds = dict(thresholds or {})
+        self.level = level
+        self.dictionary = dictionary
+        self.dictionary_id = get_dictionary_id(dictionary)
+        # Digested once, when a session first needs it, and shared by
+        # every session after that.
+        self._zstd_dictionary = None
+
+    def should_compress(self, service_id, message_type, size):
+        """Returns whether or not a DML message of the given type and
+        size should be compressed.
+        """
+        threshold = self.thresholds.get((service_id, message_type), self.threshold)
+        return threshold is not None and size >= threshold
+
+    def create_codec(self, codec):
+        digested = None
+        if codec == Codec.ZSTD and self.dictionary and ZSTD_AVAILABLE:
+            if self._zstd_dictionary is None:
+                self._zstd_dictionary = ZstdDictionary(
+                    self.dictionary, 3 if self.level is None else self.level)
+            digested = self._zstd_dictionary
+        return create_codec(codec, level=self.level, dictionary=self.dictionary,
+                            digested=digested)
+
+
+class SessionCompression(object):
+    """The compression state of a single session.
+
+    One side offers its codecs once the session is established, and
+    the other side answers with its own. Each side then compresses its
+    application packets (according to its own policy) with the first of
+    its codecs that the peer also supports, as long as both use the same
+    dictionary. Incoming packets say which codec they were compressed
+    with.
+    """
+    logger = logging.getLogger('COMPRESSION')
+
+    def __init__(self, session, policy):
+        self._session = weakref.ref(session)
+        self.policy = policy
+        self.codec = None
+        self._decoders = {}
+        # Whether or not we have told the peer which codecs we support.
+        self._announced = False
+
+        self.bytes_in = 0
+        self.bytes_out = 0
+
+    @property
+    def active(self):
+        """Returns whether or not we are compressing outgoing packets."""
+        return self.codec is not None
+
+    @property
+    def stateful(self):
+        """Returns whether or not packets in either direction depend on
+        the history of a zlib stream, which only this process has.
+        """
+        if self.codec is not None and self.codec.stateful:
+            return True
+        return any(decoder.stateful for decoder in self._decoders.values())
+
+    def offer(self):
+        """Offers our codecs to the peer."""
+        self._send_negotiation(NegotiationType.OFFER)
+
+    def restore(self, codec):
+        """Carries on compressing with the given codec, as negotiated
+        with the peer by another process (see `ki.handoff`).
+
+        Raises `ValueError` for codecs that keep stream state, as that
+        state can not be restored.
+        """
+        restored = self.policy.create_codec(Codec(codec))
+        if restored.stateful:
+            raise ValueError('Codec can not be restored: %r' % codec)
+        self.codec = restored
+        self._announced = True
+
+    def compress_frame(self, frame):
+        """Returns the given outgoing frame, compressed if our policy
+        says it should be, and if that makes it smaller.
+
+        A zlib stream has to carry every packet it compresses, so with
+        zlib the compressed frame is sent either way.
+        """
+        if self.codec is None or len(frame) < FRAME_HEADER_SIZE + PACKET_HEADER_SIZE + 4:
+            return frame
+
+        # Only DML application packets are compressed.
+        control, opcode = frame[4], frame[5]
+        payload_offset = FRAME_HEADER_SIZE + PACKET_HEADER_SIZE
+        size = len(frame) - payload_offset
+        if control or opcode or size > MAX_COMPRESSIBLE_SIZE:
+            return frame
+        service_id, message_type = frame[payload_offset], frame[payload_offset + 1]
+        if not self.policy.should_compress(service_id, message_type, size):
+            return frame
+
+        compressed = self.codec.compress(bytes(frame[payload_offset:]))
+        self.bytes_in += size
+        if not self.codec.stateful and COMPRESSED_HEADER.size + len(compressed) >= size:
+            self.bytes_out += size
+            return frame
+        self.bytes_out += COMPRESSED_HEADER.size + len(compressed)
+        return build_frame(False, COMPRESSED_OPCODE,
+                           COMPRESSED_HEADER.pack(self.codec.id, control, opcode, size) +
+                           compressed)
+
+    def handle_frame(self, frame):
+        """Handles an incoming extension frame.
+
+        Returns the frame that should be processed by the session in
+        its place, if any. Raises `ValueError` if the frame is invalid.
+        """
+        control, opcode, payload = parse_frame(frame)
+        if control and opcode == COMPRESSION_OPCODE:
+            self._handle_negotiation(payload)
+            return None
+        if not control and opcode == COMPRESSED_OPCODE:
+            return self._decompress_frame(payload)
+
+        # Not ours; let the session deal with it.
+        return frame
+
+    def _decompress_frame(self, payload):
+        if len(payload) < COMPRESSED_HEADER.size:
+            raise ValueError('Compressed packet is truncated.')
+        codec, original_control, original_opcode, size = \
+            COMPRESSED_HEADER.unpack_from(payload)
+
+        # The peer may only use the codecs we told it we support.
+        if not self._announced or codec not in self.policy.codecs:
+            raise ValueError('Compressed packet uses an unsupported codec: %d' % codec)
+
+        decoder = self._decoders.get(codec)
+        if decoder is None:
+            decoder = self._decoders[codec] = self.policy.create_codec(Codec(codec))
+        try:
+            data = decoder.decompress(payload[COMPRESSED_HEADER.size:], size)
+        except Exception as e:
+            raise ValueError('Failed to decompress packet: %s' % e)
+        if len(data) != size:
+            raise ValueError('Decompressed packet size does not match.')
+        return build_frame(original_control, original_opcode, data)
+
+    def _handle_negotiation(self, payload):
+        if len(payload) < 6:
+            raise ValueError('Compression negotiation is truncated.')
+        negotiation_type, dictionary_id, count = struct.unpack_from('<BIB', payload)
+        supported = set(payload[6:6 + count])
+        if negotiation_type == NegotiationType.OFFER:
+            self._send_negotiation(NegotiationType.ACCEPT)
+
+        # Once chosen, our codec never changes, as the peer's decoder
+        # state depends on it.
+        if self.codec is not None or dictionary_id != self.policy.dictionary_id:
+            return
+        for codec in self.policy.codecs:
+            if codec in supported:
+                self.codec = self.policy.create_codec(codec)
+                self.logger.debug('Using compression codec: %r', codec)
+                break
+
+    def _send_negotiation(self, negotiation_type):
+        session = self._session()
+        if session is None:
+            return
+
+        payload = struct.pack('<BIB', negotiation_type,
+                              self.policy.dictionary_id, len(self.policy.codecs))
+        payload += bytes(bytearray(self.policy.codecs))
+        self._announced = True
+        session.send_frame(build_frame(True, COMPRESSION_OPCODE, payload))
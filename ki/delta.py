@@ -0,0 +1,82 @@
+import logging
+import weakref
+
+from .dml import DMLParseError, DMLValueError
+from .extensions import DELTA_OPCODE, DELTA_MESSAGE_OPCODE, build_frame, parse_frame
+from .protocol.dml import RecordDeltaEncoder, RecordDeltaDecoder
+
+
+class SessionDelta(object):
+    """The delta encoding state of a single session.
+
+    Once the peer has agreed to delta encoding, `send_message()` only
+    sends the fields that changed since the last message of the same
+    type. The peer patches those into its own copy of that message, and
+    processes the result as if the whole message had been sent.
+
+    This suits messages that are sent over and over with few changes,
+    such as position and status updates.
+    """
+    logger = logging.getLogger('DELTA')
+
+    def __init__(self, session):
+        self._session = weakref.ref(session)
+        self.peer_supported = False
+        self._announced = False
+
+        self._encoder = RecordDeltaEncoder()
+        self._decoder = None
+
+    def offer(self):
+        """Lets the peer know that we support delta encoding."""
+        self._send_negotiation()
+
+    def send_message(self, message):
+        """Sends the given message as a delta if the peer supports it,
+        and in full otherwise.
+        """
+        session = self._session()
+        if session is None:
+            return
+
+        if not self.peer_supported:
+            session.send_message(message)
+            return
+
+        session.send_frame(build_frame(False, DELTA_MESSAGE_OPCODE, self._encoder.encode(message)))
+
+    def handle_frame(self, frame):
+        """Handles an incoming extension frame.
+
+        Returns the frame that should be processed by the session in
+        its place, if any. Raises `ValueError` if the frame is invalid.
+        """
+        control, opcode, payload = parse_frame(frame)
+        if control and opcode == DELTA_OPCODE:
+            self.peer_supported = True
+            if not self._announced:
+                self._send_negotiation()
+            return None
+
+        if not control and opcode == DELTA_MESSAGE_OPCODE:
+            # The peer may only send deltas once we have agreed to them.
+            if not self._announced:
+                raise ValueError('Got a delta before agreeing to delta encoding.')
+
+            session = self._session()
+            if self._decoder is None:
+                self._decoder = RecordDeltaDecoder(session.manager)
+            try:
+                message = self._decoder.apply(payload)
+            except (DMLParseError, DMLValueError) as e:
+                raise ValueError('Failed to apply delta: %s' % e)
+            return build_frame(False, 0, message.to_bytes())
+
+        # Not ours; let the session deal with it.
+        return frame
+
+    def _send_negotiation(self):
+        session = self._session()
+        if session is not None:
+            self._announced = True
+            session.send_frame(build_frame(True, DELTA_OPCODE, b''))
@@ -0,0 +1,34 @@
+"""Framing shared by kipy's protocol extensions.
+
+Extensions use opcodes that the KI protocol itself never does (see
+`ki.protocol.net.ReceiveBuffer`), and are only ever sent to peers that
+have agreed to them.
+"""
+import struct
+
+from .protocol.net import PacketHeader
+
+
+START_SIGNAL = 0xF00D
+FRAME_HEADER_SIZE = 4
+PACKET_HEADER_SIZE = PacketHeader().size
+
+# Control opcodes
+COMPRESSION_OPCODE = 0xC0  # compression negotiation
+DELTA_OPCODE = 0xC2  # delta encoding negotiation
+
+# Application opcodes
+COMPRESSED_OPCODE = 0xC1  # a compressed packet
+DELTA_MESSAGE_OPCODE = 0xC3  # a delta encoded DML message
+
+
+def build_frame(control, opcode, payload):
+    """Returns a complete frame for the given packet."""
+    header = PacketHeader(control, opcode).to_bytes()
+    return struct.pack('<HH', START_SIGNAL, len(header) + len(payload)) + header + payload
+
+
+def parse_frame(frame):
+    """Returns the (control, opcode, payload) of the given frame."""
+    payload_offset = FRAME_HEADER_SIZE + PACKET_HEADER_SIZE
+    return bool(frame[4]), frame[5], frame[payload_offset:]
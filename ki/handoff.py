@@ -0,0 +1,359 @@
+"""Hands a running server's listening socket and sessions over to a new
+server process, so that restarts neither drop connections nor make
+clients go through the handshake again.
+
+The running (old) process waits for its replacement on a Unix socket:
+
+    server.listen_for_handoff('/run/kipy/handoff.sock')
+
+The new process then starts with `resume()` in place of `run()`:
+
+    server.resume(event_loop, '/run/kipy/handoff.sock')
+
+The old process stops accepting connections and reading from its
+sessions, waits for their outgoing data to be written, and then passes
+the socket descriptors (with `SCM_RIGHTS`) along with a snapshot of
+each session: its ID, whether it is established, its access level,
+its negotiated compression codec, and any partially received packet.
+The new process picks each session up where the old one left off, and
+the old one calls `Server.on_handed_off()`.
+
+Sessions that negotiated delta encoding, or that compress with zlib in
+either direction, are not handed off, as their peers expect us to
+remember the last message of every type or the history of the zlib
+stream; they are closed with the old process.
+"""
+import array
+import asyncio
+import logging
+import os
+import socket
+import struct
+from collections import namedtuple
+
+from .compression import Codec
+from .extensions import build_frame
+from .protocol.control import Opcode, SessionAccept
+
+HANDOFF_MAGIC = b'KIHO'
+HANDOFF_VERSION = 1
+
+#: How long (in seconds) either side waits on the other.
+HANDOFF_TIMEOUT = 10.0
+
+#: How long (in seconds) outgoing data may take to be written before
+#: the sessions that still have some are left behind.
+DRAIN_TIMEOUT = 2.0
+DRAIN_INTERVAL = 0.01
+
+# Linux accepts at most 253 descriptors per message.
+FDS_PER_MESSAGE = 250
+
+ACK = b'\x01'
+
+SNAPSHOT_SIZE = struct.Struct('<I')
+SNAPSHOT_HEADER = struct.Struct('<4sHHdI')
+SESSION_STATE = struct.Struct('<HBBBI')
+
+SESSION_ESTABLISHED = 0x01
+
+logger = logging.getLogger('HANDOFF')
+
+
+class HandoffError(Exception):
+    pass
+
+
+class SessionState(namedtuple('SessionState', [
+        'id', 'established', 'access_level', 'codec', 'pending_data'])):
+    """The state of a single session, as handed off."""
+
+    @classmethod
+    def capture(cls, session):
+        """Returns the state of the given session. Reading must be
+        paused, so that nothing more arrives.
+        """
+        codec = Codec.NONE
+        if session.compression is not None and session.compression.codec is not None:
+            codec = session.compression.codec.id
+        pending_data = session.transport.get_protocol().receive_buffer.get_pending_data()
+        return cls(session.id, session.established, int(session.access_level),
+                   int(codec), pending_data)
+
+    def restore(self, protocol):
+        """Restores this state into the new session of the given protocol."""
+        session = protocol.session
+        if self.established:
+            # Replaying the peer's half of the handshake establishes the
+            # session natively, without anything being sent to the peer.
+            accept = SessionAccept(session.id)
+            frame = build_frame(True, int(Opcode.SESSION_ACCEPT), accept.to_bytes())
+            session.process_data(frame, len(frame))
+        session.access_level = self.access_level
+
+        if self.codec != Codec.NONE and session.compression is not None:
+            # Only codecs without stream state get this far (see
+            # `can_hand_off()`).
+            session.compression.restore(self.codec)
+
+        # The rest of a partially received packet is still on its way.
+        protocol.receive_buffer.write(self.pending_data)
+
+
+def can_hand_off(session):
+    """Returns whether or not the given session can be handed off."""
+    if session.transport is None:
+        return False
+    if session.compression is not None and session.compression.stateful:
+        return False
+    return session.delta is None or not session.delta.peer_supported
+
+
+def is_drained(session):
+    """Returns whether or not everything the given session has sent has
+    left the process.
+    """
+    if session.transport.get_write_buffer_size():
+        return False
+    if session.zerocopy is not None:
+        session.zerocopy.poll_completions()
+        return not session.zerocopy.pending
+    return True
+
+
+def encode_snapshot(startup_timestamp, listener_count, states):
+    data = [SNAPSHOT_HEADER.pack(HANDOFF_MAGIC, HANDOFF_VERSION, listener_count,
+                                 startup_timestamp, len(states))]
+    for state in states:
+        flags = SESSION_ESTABLISHED if state.established else 0
+        data.append(SESSION_STATE.pack(state.id, flags, state.access_level,
+                                       state.codec, len(state.pending_data)))
+        data.append(state.pending_data)
+    return b''.join(data)
+
+
+def decode_snapshot(data):
+    """Returns the (startup_timestamp, listener_count, states) of the
+    given snapshot.
+    """
+    try:
+        return _decode_snapshot(data)
+    except struct.error:
+        raise HandoffError('Snapshot is truncated.')
+
+
+def _decode_snapshot(data):
+    magic, version, listener_count, startup_timestamp, session_count = \
+        SNAPSHOT_HEADER.unpack_from(data)
+    if magic != HANDOFF_MAGIC:
+        raise HandoffError('Not a handoff snapshot.')
+    if version != HANDOFF_VERSION:
+        raise HandoffError('Unsupported handoff version: %d' % version)
+
+    states = []
+    offset = SNAPSHOT_HEADER.size
+    for i in range(session_count):
+        session_id, flags, access_level, codec, pending_size = \
+            SESSION_STATE.unpack_from(data, offset)
+        offset += SESSION_STATE.size
+        pending_data = bytes(data[offset:offset + pending_size])
+        if len(pending_data) != pending_size:
+            raise HandoffError('Snapshot is truncated.')
+        offset += pending_size
+        states.append(SessionState(session_id, bool(flags & SESSION_ESTABLISHED),
+                                   access_level, codec, pending_data))
+    return startup_timestamp, listener_count, states
+
+
+def send_fds(sock, fds):
+    """Sends the given file descriptors over a Unix socket, in batches."""
+    for i in range(0, len(fds), FDS_PER_MESSAGE):
+        batch = array.array('i', fds[i:i + FDS_PER_MESSAGE])
+        sock.sendmsg([b'\x00'], [(socket.SOL_SOCKET, socket.SCM_RIGHTS, batch.tobytes())])
+
+
+def receive_fds(sock, count):
+    """Receives `count` file descriptors sent with `send_fds()`."""
+    fds = array.array('i')
+    while len(fds) < count:
+        batch_size = min(count - len(fds), FDS_PER_MESSAGE)
+        data, ancdata, flags, _ = sock.recvmsg(
+            1, socket.CMSG_LEN(batch_size * fds.itemsize))
+        if not data:
+            raise HandoffError('Connection closed while receiving descriptors.')
+        for level, type_, cmsg_data in ancdata:
+            if level == socket.SOL_SOCKET and type_ == socket.SCM_RIGHTS:
+                fds.frombytes(cmsg_data[:len(cmsg_data) - len(cmsg_data) % fds.itemsize])
+        if flags & socket.MSG_CTRUNC:
+            for fd in fds:
+                os.close(fd)
+            raise HandoffError('Descriptors were truncated.')
+    return list(fds)
+
+
+def receive_exactly(sock, size):
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise HandoffError('Connection closed during handoff.')
+        data += chunk
+    return bytes(data)
+
+
+def send_handoff(connection, snapshot, fds):
+    """Sends the snapshot and descriptors through the given connection,
+    and waits for the new process to acknowledge them.
+
+    This blocks, so `hand_off()` runs it in an executor.
+    """
+    connection.setblocking(True)
+    connection.settimeout(HANDOFF_TIMEOUT)
+    connection.sendall(SNAPSHOT_SIZE.pack(len(snapshot)) + snapshot)
+    send_fds(connection, fds)
+    if receive_exactly(connection, len(ACK)) != ACK:
+        raise HandoffError('Handoff was not acknowledged.')
+
+
+def listen(server, path):
+    """Waits (without blocking the event loop) for a new server process
+    to connect to the given path, and then hands the server over to it.
+    """
+    if os.path.exists(path):
+        os.unlink(path)
+    listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    listener.bind(path)
+    listener.listen(1)
+    listener.setblocking(False)
+
+    def on_connection():
+        try:
+            connection, _ = listener.accept()
+        except BlockingIOError:
+            return
+        server.event_loop.remove_reader(listener.fileno())
+        listener.close()
+        os.unlink(path)
+        asyncio.ensure_future(hand_off(server, connection), loop=server.event_loop)
+
+    server.event_loop.add_reader(listener.fileno(), on_connection)
+
+
+async def hand_off(server, connection):
+    """Hands the server's listening sockets and sessions over through
+    the given connection, to a process calling `receive()`.
+    """
+    event_loop = server.event_loop
+
+    # Our own copies of the listening sockets; closing the listeners
+    # stops us from accepting, while new connections wait in the
+    # backlog for the new process.
+    listener_sockets = [sock.dup() for listener in server.listeners for sock in listener.sockets]
+    for listener in server.listeners:
+        listener.close()
+    server.listeners = []
+
+    sessions = [session for session in server.sessions.values() if can_hand_off(session)]
+    for session in sessions:
+        session.transport.pause_reading()
+
+    # Outgoing data has to be written before the new process takes
+    # over; it could never finish a partially written frame. Zero-copy
+    # sends also have to complete, as their buffers are ours.
+    deadline = event_loop.time() + DRAIN_TIMEOUT
+    while event_loop.time() < deadline and any(
+            session.transport is not None and not is_drained(session)
+            for session in sessions):
+        await asyncio.sleep(DRAIN_INTERVAL)
+    sessions = [session for session in sessions
+                if session.transport is not None and is_drained(session)]
+
+    # The exchange runs in an executor, so the sessions we keep are
+    # served meanwhile. Ours are paused, but one might still be closed
+    # (by a timeout, say), so the descriptors sent are our own copies.
+    session_fds = []
+    try:
+        states = [SessionState.capture(session) for session in sessions]
+        snapshot = encode_snapshot(server.startup_timestamp, len(listener_sockets), states)
+        for session in sessions:
+            session_fds.append(os.dup(session.transport.get_extra_info('socket').fileno()))
+        fds = [sock.fileno() for sock in listener_sockets] + session_fds
+        await event_loop.run_in_executor(None, send_handoff, connection, snapshot, fds)
+    except (OSError, HandoffError):
+        logger.exception('Handoff failed; resuming.')
+        for sock in listener_sockets:
+            server.listeners.append(await event_loop.create_server(
+                lambda: server.PROTOCOL_CLS(server), sock=sock))
+        for session in sessions:
+            if session.transport is not None:
+                session.transport.resume_reading()
+        return
+    finally:
+        connection.close()
+        for fd in session_fds:
+            os.close(fd)
+
+    for sock in listener_sockets:
+        sock.close()
+    for session in sessions:
+        if session.transport is not None:
+            server.release_session(session)
+
+    logger.info('Handed off %d session(s).', len(sessions))
+    server.on_handed_off()
+
+
+def receive(server, path):
+    """Takes over the listening sockets and sessions of the server
+    process waiting at the given path (see `listen()`).
+
+    Must be called before the event loop is running.
+    """
+    connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    connection.settimeout(HANDOFF_TIMEOUT)
+    try:
+        connection.connect(path)
+    except OSError:
+        connection.close()
+        raise
+    take_over(server, connection)
+
+
+def take_over(server, connection):
+    """Takes over the listening sockets and sessions handed off through
+    the given connection, by a process in `hand_off()`.
+
+    Must be called before the event loop is running.
+    """
+    event_loop = server.event_loop
+
+    connection.settimeout(HANDOFF_TIMEOUT)
+    try:
+        snapshot_size, = SNAPSHOT_SIZE.unpack(receive_exactly(connection, SNAPSHOT_SIZE.size))
+        startup_timestamp, listener_count, states = \
+            decode_snapshot(receive_exactly(connection, snapshot_size))
+        fds = receive_fds(connection, listener_count + len(states))
+
+        # Acknowledge before reading from any of the sockets; from here
+        # on, the old process no longer will.
+        connection.sendall(ACK)
+    finally:
+        connection.close()
+
+    # Keep alive timestamps carry on from the old process' startup, on
+    # the same monotonic clock.
+    server.startup_timestamp = startup_timestamp
+
+    for fd in fds[:listener_count]:
+        server.listeners.append(event_loop.run_until_complete(event_loop.create_server(
+            lambda: server.PROTOCOL_CLS(server), sock=socket.socket(fileno=fd))))
+
+    def resume_session(state, fd):
+        protocol_factory = lambda: server.PROTOCOL_CLS(
+            server, session_id=state.id, resume=state.restore)
+        return event_loop.connect_accepted_socket(protocol_factory, socket.socket(fileno=fd))
+
+    if states:
+        event_loop.run_until_complete(asyncio.gather(*[
+            resume_session(state, fd) for state, fd in zip(states, fds[listener_count:])]))
+    logger.info('Resumed %d session(s).', len(states))
@@ -3,9 +3,16 @@ import logging
 import time
 from enum import IntEnum
 
+from . import handoff
+from .compression import SessionCompression
+from .delta import SessionDelta
+from .extensions import COMPRESSION_OPCODE, COMPRESSED_OPCODE, \
+    DELTA_OPCODE, DELTA_MESSAGE_OPCODE
 from .protocol.dml import MessageManager
-from .protocol.net import SessionCloseErrorCode, \
-    ServerSession as CServerSession, ClientSession as CClientSession, \
+from .extensions import build_frame
+from .protocol.net import SessionCloseErrorCode, ReceiveBuffer, OutboundQueue, rtt_stats, \
+    SessionRegistry, SessionGroup, BufferPool, ZeroCopySender, trace_frame, \
+    ServerSession as CServerSession, DMLSession as CDMLSession, ClientSession as CClientSession, \
     ServerDMLSession as CServerDMLSession, ClientDMLSession as CClientDMLSession
 from .services import ServiceParticipant
 from .tasks import TaskParticipant, TaskSignal, asyncio_task
@@ -26,8 +33,13 @@ class SessionBase(TaskParticipant):
     def __init__(self, transport):
         self.transport = transport
 
-        self._close_handlers = []
-        self._ensure_alive.start(delay=self.ENSURE_ALIVE_INTERVAL)
+        # Most sessions never get a close handler, so this is only
+        # created when one is added.
+        self._close_handlers = None
+
+        self.compression = None
+        self.delta = None
+        self.zerocopy = None
 
     def __repr__(self):
         return '%s<%d>' % (self.__class__.__name__, self.id)
@@ -52,11 +64,39 @@ class SessionBase(TaskParticipant):
         self.close(SessionCloseErrorCode.INVALID_MESSAGE)
 
     def send_packet_data(self, data, size):
-        """"Overrides `ki.protocol.net.Session.send_packet_data()`."""
+        """"Overrides `ki.protocol.net.Session.send_packet_data()`.
+
+        When zero-copy sends are enabled, frames are sent from a pooled
+        buffer as long as nothing else is waiting to be written.
+        """
         if self.transport is not None:
-            self.logger.debug('id=%d, send_packet_data(%r, %d)', self.id, data, size)
+            if self.compression is not None:
+                data = self.compression.compress_frame(data)
+            zerocopy = self.zerocopy
+            if zerocopy is not None and not self.transport.get_write_buffer_size():
+                remainder = zerocopy.send_frame(data)
+                if remainder is not None:
+                    if remainder:
+                        self.transport.write(remainder)
+                    return
             self.transport.write(data)
 
+    def send_frame(self, frame):
+        """Sends a complete frame that was built in Python, tracing it
+        as the native send path would have (see `ki.trace`).
+        """
+        trace_frame(self.id, frame)
+        self.send_packet_data(frame, len(frame))
+
+    def send_frames(self, frames):
+        """Sends the given list of complete frames in a single write."""
+        if self.transport is not None:
+            for frame in frames:
+                trace_frame(self.id, frame)
+            if self.compression is not None:
+                frames = [self.compression.compress_frame(frame) for frame in frames]
+            self.transport.write(b''.join(frames))
+
     def close(self, error):
         """"Overrides `ki.protocol.net.Session.close()`."""
         # close() might be called more than once.
@@ -70,11 +110,13 @@ class SessionBase(TaskParticipant):
         self.stop_tasks()
 
         # Invoke our close handlers, and then clear them.
-        for close_handler in self._close_handlers:
-            close_handler()
-        self._close_handlers = []
+        if self._close_handlers is not None:
+            for close_handler in self._close_handlers:
+                close_handler()
+            self._close_handlers = None
 
-        # Close the connection.
+        # Close the connection. Any zero-copy sender is dropped once the
+        # transport has written everything (see `Protocol.connection_lost()`).
         self.transport.close()
         self.transport = None
 
@@ -86,11 +128,63 @@ class SessionBase(TaskParticipant):
         self.logger.debug('id=%d, Session timed out!', self.id)
         self.close(SessionCloseErrorCode.SESSION_DIED)
 
+    def enable_compression(self, policy):
+        """Allows this session to negotiate compression with its peer,
+        according to the given `ki.compression.CompressionPolicy`.
+        """
+        self.compression = SessionCompression(self, policy)
+
+    def enable_zerocopy(self, pool, threshold):
+        """Lets messages be sent straight from the given
+        `ki.protocol.net.BufferPool`, with `MSG_ZEROCOPY` for those of at
+        least `threshold` bytes.
+
+        Does nothing where zero-copy sends are unsupported.
+        """
+        sock = self.transport.get_extra_info('socket')
+        if sock is None:
+            return
+        sender = ZeroCopySender(sock.fileno(), pool, self.id, threshold)
+        if sender.enabled:
+            self.zerocopy = sender
+
+    def handle_extension_frame(self, frame):
+        """Passes an incoming extension frame to the extension that owns
+        its opcode.
+
+        Returns the frame that should be processed in its place, if any.
+        """
+        control, opcode = frame[4], frame[5]
+        extension = None
+        if opcode in (COMPRESSION_OPCODE, COMPRESSED_OPCODE):
+            extension = self.compression
+        elif opcode in (DELTA_OPCODE, DELTA_MESSAGE_OPCODE):
+            extension = self.delta
+
+        if extension is None:
+            # Ignoring an offer for an extension we don't support (or
+            # have not enabled) is how we decline it. Anything else is
+            # only sent once we have agreed to it.
+            if not control:
+                self.logger.warning('id=%d, Got an unexpected extension packet! (opcode=0x%02X)',
+                                    self.id, opcode)
+                self.close(SessionCloseErrorCode.INVALID_MESSAGE)
+            return None
+
+        try:
+            return extension.handle_frame(frame)
+        except ValueError as e:
+            self.logger.warning('id=%d, Got an invalid extension packet! (%s)', self.id, e)
+            self.close(SessionCloseErrorCode.INVALID_MESSAGE)
+            return None
+
     def add_close_handler(self, func):
         """Adds the given function to this session's close handlers.
 
         A close handler is called immediately before the session is closed.
         """
+        if self._close_handlers is None:
+            self._close_handlers = []
         if func not in self._close_handlers:
             self._close_handlers.append(func)
 
@@ -99,7 +193,7 @@ class SessionBase(TaskParticipant):
 
         A close handler is called immediately before the session is closed.
         """
-        if func in self._close_handlers:
+        if self._close_handlers is not None and func in self._close_handlers:
             self._close_handlers.remove(func)
 
 
@@ -111,22 +205,16 @@ class ServerSessionBase(SessionBase):
 
         self.server = server
 
-    @asyncio_task
-    def _keep_alive(self):
-        """Sends a keep alive packet periodically."""
-        self.send_keep_alive(self.server.startup_time_delta)
-        return TaskSignal.AGAIN
-
     def on_established(self):
-        """"Overrides `ki.protocol.net.ServerSession.on_established()`."""
+        """"Overrides `ki.protocol.net.ServerSession.on_established()`.
+
+        From here on, the server sends us keep alive packets.
+        """
         self.logger.debug('id=%d, on_established()', self.id)
 
         # Set our access level to ESTABLISHED.
         self.access_level = AccessLevel.ESTABLISHED
 
-        # Start sending keep alive packets.
-        self._keep_alive.start(delay=self.KEEP_ALIVE_INTERVAL)
-
     def close(self, error):
         """"Overrides `SessionBase.close()`."""
         SessionBase.close(self, error)
@@ -142,6 +230,8 @@ class ClientSessionBase(SessionBase):
 
         self.client = client
 
+        self._ensure_alive.start(delay=self.ENSURE_ALIVE_INTERVAL)
+
     @asyncio_task
     def _keep_alive(self):
         """Sends a keep alive packet periodically."""
@@ -158,6 +248,12 @@ class ClientSessionBase(SessionBase):
         # Start sending keep alive packets.
         self._keep_alive.start(delay=self.KEEP_ALIVE_INTERVAL)
 
+        # Clients are the ones to offer compression and delta encoding.
+        if self.compression is not None:
+            self.compression.offer()
+        if self.delta is not None:
+            self.delta.offer()
+
     def close(self, error):
         """"Overrides `Session.close()`."""
         SessionBase.close(self, error)
@@ -177,38 +273,106 @@ class ClientSession(ClientSessionBase, CClientSession):
         CClientSession.__init__(self, id)
 
 
-class Protocol(asyncio.Protocol):
+# asyncio.BufferedProtocol is only available in Python 3.7+.
+_ProtocolBase = getattr(asyncio, 'BufferedProtocol', asyncio.Protocol)
+
+
+class Protocol(_ProtocolBase):
     logger = logging.getLogger('PROTOCOL')
 
+    #: The capacity of the per-connection receive buffer.
+    RECEIVE_BUFFER_CAPACITY = 0x10000
+
     def __init__(self):
         self.session = None
+        self.receive_buffer = ReceiveBuffer(self.RECEIVE_BUFFER_CAPACITY)
+        # The receive buffer's byte count as of the last `trim_if_idle()`.
+        self._idle_bytes_received = 0
 
     def connection_made(self, transport):
         """"Overrides `asyncio.Protocol.connection_made()`."""
         peername = transport.get_extra_info('peername')
         self.logger.debug('Connection made: %r', peername)
 
+    def get_buffer(self, sizehint):
+        """"Overrides `asyncio.BufferedProtocol.get_buffer()`.
+
+        Reads go directly into the free region of the receive buffer,
+        through a memoryview of it.
+        """
+        # Zero-copy completions wake the socket up for reading, so this
+        # is where they are collected.
+        if self.session is not None and self.session.zerocopy is not None:
+            self.session.zerocopy.poll_completions()
+        return self.receive_buffer.get_buffer(sizehint)
+
+    def buffer_updated(self, nbytes):
+        """"Overrides `asyncio.BufferedProtocol.buffer_updated()`.
+
+        Passes any complete packets off to the session for processing.
+        """
+        if self.session is not None:
+            self.receive_buffer.buffer_updated(nbytes)
+            self._process_received()
+
     def data_received(self, data):
         """"Overrides `asyncio.Protocol.data_received()`.
 
-        Passes the data off to the session for processing.
+        Only used when `asyncio.BufferedProtocol` is unavailable.
         """
-        if self.session is not None:
-            size = len(data)
-            self.logger.debug('process_data(%r, %d)', data, size)
-            self.session.process_data(data, size)
+        while data and self.session is not None:
+            written = self.receive_buffer.write(data)
+            self._process_received()
+            data = data[written:]
+
+    def _process_received(self):
+        # Extension frames are passed to the session even when it has
+        # none enabled, so that it can turn them down. Other frames go
+        # to the session's process_data(), which copies them into
+        # libki's own buffer; only extension frames are parsed in place.
+        self.receive_buffer.process(self.session, self.session.handle_extension_frame)
+
+    def trim_if_idle(self):
+        """Releases the receive buffer's storage if nothing has been
+        received since the last call.
+
+        Returns whether or not the storage was released.
+        """
+        receive_buffer = self.receive_buffer
+        bytes_received = receive_buffer.bytes_received
+        idle = bytes_received == self._idle_bytes_received
+        self._idle_bytes_received = bytes_received
+
+        if idle and receive_buffer.allocated and not receive_buffer.pending:
+            receive_buffer.trim()
+            return True
+        return False
 
     def connection_lost(self, exc):
-        """"Overrides `asyncio.Protocol.connection_lost()`."""
+        """"Overrides `asyncio.Protocol.connection_lost()`.
+
+        The socket is still open here, and everything buffered by the
+        transport has been written, so the session's zero-copy sender
+        can hand whatever is still in flight to its pool, which ends the
+        connection once the kernel is done with it.
+        """
         self.logger.debug('Connection lost: %r', exc)
+        if self.session is not None:
+            self.session.zerocopy = None
 
 
 class ServerProtocol(Protocol):
-    def __init__(self, server):
+    def __init__(self, server, session_id=None, resume=None):
         super().__init__()
 
         self.server = server
 
+        # When taking over a connection from another server process (see
+        # `ki.handoff`), the session keeps its ID, and `resume(protocol)`
+        # restores its state in place of the usual handshake.
+        self.session_id = session_id
+        self.resume = resume
+
     def connection_made(self, transport):
         """"Overrides `Protocol.connection_made()`.
 
@@ -217,7 +381,7 @@ class ServerProtocol(Protocol):
         super().connection_made(transport)
 
         try:
-            self.session = self.server.create_session(transport)
+            self.session = self.server.create_session(transport, self.session_id)
         except AllocationError:
             # An ID could not be allocated for a new session; refuse
             # connection.
@@ -225,7 +389,10 @@ class ServerProtocol(Protocol):
             self.logger.warning('Refusing connection.')
             transport.close()
         else:
-            self.session.on_connected()
+            if self.resume is None:
+                self.session.on_connected()
+            else:
+                self.resume(self)
 
     def connection_lost(self, exc):
         """"Overrides `Protocol.connection_lost()`.
@@ -276,7 +443,7 @@ class ClientProtocol(Protocol):
         self.client = None
 
 
-class Server(object):
+class Server(TaskParticipant):
     logger = logging.getLogger('SERVER')
 
     PROTOCOL_CLS = ServerProtocol
@@ -285,46 +452,264 @@ class Server(object):
     MIN_SESSION_ID = 1
     MAX_SESSION_ID = 0xFFFF
 
+    #: The maximum number of frames queued by `send_threadsafe()`.
+    OUTBOUND_QUEUE_CAPACITY = 0x10000
+    #: The maximum number of queued frames sent per event loop iteration.
+    OUTBOUND_DRAIN_BATCH = 1024
+
     def __init__(self, port):
         self.port = port
+        self.event_loop = None
+        self.listeners = []
 
-        self.startup_timestamp = time.time()
+        # Keep alive timestamps are relative to this, so it must not
+        # jump along with the system clock.
+        self.startup_timestamp = time.monotonic()
 
         self.session_id_allocator = IDAllocator(
             self.MIN_SESSION_ID, self.MAX_SESSION_ID)
         self.sessions = {}
+        # Session IDs are reused, so each session also gets a generation
+        # that frames queued by `send_threadsafe()` are checked against.
+        self.session_generation = 0
+        # Mirrors `sessions` natively, for session groups to send through.
+        self.session_registry = SessionRegistry()
+        self.outbound_queue = OutboundQueue(self.OUTBOUND_QUEUE_CAPACITY)
+
+        # Set to a `ki.compression.CompressionPolicy` to let sessions
+        # negotiate compression.
+        self.compression_policy = None
+
+        # Set to `True` to let DML sessions negotiate delta encoding.
+        self.delta_encoding = False
+
+        # Set to a size in bytes to have DML sessions send messages from
+        # pooled buffers, with `MSG_ZEROCOPY` from that size up (Linux
+        # only).
+        self.zerocopy_threshold = None
+        self.send_buffer_pool = None
 
     @property
     def startup_time_delta(self):
         """Returns the time that has elapsed since startup.
 
-        This value will be in milliseconds.
+        This value will be in milliseconds, wrapping around after 2^32.
         """
-        return int((time.time() - self.startup_timestamp) * 1000.0)
+        return int((time.monotonic() - self.startup_timestamp) * 1000.0) & 0xFFFFFFFF
+
+    @asyncio_task
+    def _ensure_sessions_alive(self):
+        """|task|
+
+        Periodically checks whether or not each session has been
+        receiving keep alive packets, and closes the ones that have not.
+
+        Sessions that have not received anything since the last check
+        also give up their receive buffer storage here, and finished
+        zero-copy sends give their buffers back, including those of
+        sessions that are no longer being read from, or are gone.
+        """
+        for session in list(self.sessions.values()):
+            if not session.alive:
+                session.on_timeout()
+                continue
+
+            get_protocol = getattr(session.transport, 'get_protocol', None)
+            if get_protocol is not None:
+                get_protocol().trim_if_idle()
+
+        if self.send_buffer_pool is not None:
+            self.send_buffer_pool.reclaim()
+        return TaskSignal.AGAIN
+
+    @asyncio_task
+    def _keep_sessions_alive(self):
+        """|task|
+
+        Periodically sends a keep alive packet to every established
+        session.
+        """
+        startup_time_delta = self.startup_time_delta
+        for session in list(self.sessions.values()):
+            if session.established:
+                session.send_keep_alive(startup_time_delta)
+        return TaskSignal.AGAIN
+
+    def _drain_outbound(self):
+        """Sends a batch of the frames queued by `send_threadsafe()`,
+        with one write per session.
+        """
+        frames = {}
+        batch = self.outbound_queue.drain(self.OUTBOUND_DRAIN_BATCH)
+        for session_id, generation, frame in batch:
+            key = (session_id, generation)
+            session_frames = frames.get(key)
+            if session_frames is None:
+                frames[key] = [frame]
+            else:
+                session_frames.append(frame)
+
+        for (session_id, generation), session_frames in frames.items():
+            session = self.sessions.get(session_id)
+            if session is not None and session.generation == generation:
+                session.send_frames(session_frames)
+
+        if self.outbound_queue.finish_drain():
+            self.event_loop.call_soon(self._drain_outbound)
+
+    def send_threadsafe(self, session_id, frame):
+        """Queues a complete frame to be sent to the given session.
+
+        Unlike the session's own send methods, this may be called from
+        any thread. Frames are sent in order, in batches, from the event
+        loop. They only go to the session that has the ID at the time of
+        this call; if it has closed by the time they are sent, they are
+        dropped, even if a new session has taken its ID.
+
+        Returns `False` if the frame was dropped straight away, as there
+        is no session with the given ID or the queue is full.
+        """
+        session = self.sessions.get(session_id)
+        if session is None:
+            return False
+
+        result = self.outbound_queue.push(session_id, session.generation, frame)
+        if result == OutboundQueue.PushResult.FULL:
+            return False
+        if result == OutboundQueue.PushResult.SCHEDULE_DRAIN:
+            self.event_loop.call_soon_threadsafe(self._drain_outbound)
+        return True
+
+    def rtt_stats(self, quantiles=(0.5, 0.9, 0.99)):
+        """Returns the round-trip time statistics of every session, as a
+        dict of columns (see `ki.protocol.net.rtt_stats()`).
+
+        Sessions measure their round-trip time from their own keep alive
+        requests, so this costs no extra traffic.
+        """
+        return rtt_stats(self.sessions.values(), list(quantiles))
 
     def run(self, event_loop):
         """Starts listening for incoming connections."""
+        self.event_loop = event_loop
         protocol_factory = lambda: self.PROTOCOL_CLS(self)
         coro = event_loop.create_server(protocol_factory, port=self.port)
-        event_loop.run_until_complete(coro)
+        self.listeners.append(event_loop.run_until_complete(coro))
+        self._start_keep_alive_tasks()
+
+    def resume(self, event_loop, path):
+        """Takes over the listening socket and sessions of the server
+        process waiting at the given handoff path, in place of `run()`.
+
+        See `ki.handoff`.
+        """
+        self.event_loop = event_loop
+        handoff.receive(self, path)
+        self._start_keep_alive_tasks()
+
+    def _start_keep_alive_tasks(self):
+        # A single task per server keeps every session alive, rather
+        # than a pair of tasks per session.
+        self._ensure_sessions_alive.start(delay=self.SESSION_CLS.ENSURE_ALIVE_INTERVAL,
+                                          event_loop=self.event_loop)
+        self._keep_sessions_alive.start(delay=self.SESSION_CLS.KEEP_ALIVE_INTERVAL,
+                                        event_loop=self.event_loop)
+
+    def listen_for_handoff(self, path):
+        """Lets a new server process take over from this one by calling
+        `resume()` with the same path.
+
+        See `ki.handoff`.
+        """
+        handoff.listen(self, path)
+
+    def on_handed_off(self):
+        """Invoked once another server process has taken over our
+        listening socket and sessions.
+
+        Sessions that could not be handed off are closed, and the event
+        loop is stopped.
+        """
+        self.close()
+        self.event_loop.stop()
 
     def close(self):
         """Close the server, and clean up."""
+        self.stop_tasks()
+        for listener in self.listeners:
+            listener.close()
+        self.listeners = []
         for session in self.sessions.copy().values():
             session.close(SessionCloseErrorCode.SESSION_DIED)
 
+    def release_session(self, session):
+        """Stops serving the given session without closing its
+        connection, as another server process has taken it over.
+        """
+        transport = session.transport
+        transport.get_protocol().session = None
+        session.stop_tasks()
+        session.zerocopy = None
+        session.transport = None
+
+        del self.sessions[session.id]
+        self.session_registry.remove(session.id)
+        self.session_id_allocator.free(session.id)
+
+        # The other process holds its own descriptor for the socket, so
+        # this does not end the connection.
+        transport.close()
+
     def on_session_closed(self, session):
-        """Invoked when the given session gets closed."""
+        """Invoked when the given session gets closed.
+
+        The session is also removed from every session group.
+        """
         if session.id in self.sessions:
             del self.sessions[session.id]
+            self.session_registry.remove(session.id)
 
-    def create_session(self, transport):
-        """Returns a new session."""
-        session_id = self.session_id_allocator.allocate()
+    def create_session(self, transport, session_id=None):
+        """Returns a new session, with the given ID if specified."""
+        session_id = self.allocate_session_id(session_id)
         session = self.SESSION_CLS(self, transport, session_id)
-        self.sessions[session.id] = session
+        if self.compression_policy is not None:
+            session.enable_compression(self.compression_policy)
+        self.add_session(session)
         return session
 
+    def allocate_session_id(self, session_id=None):
+        """Returns an unused session ID, or reserves the given one."""
+        if session_id is None:
+            return self.session_id_allocator.allocate()
+        return self.session_id_allocator.reserve(session_id)
+
+    def add_session(self, session):
+        """Starts tracking the given session."""
+        self.session_generation = (self.session_generation + 1) & 0xFFFFFFFF
+        session.generation = self.session_generation
+        self.sessions[session.id] = session
+
+        # Session groups can write straight to the transport, unless
+        # frames may need compressing or sending from a pooled buffer on
+        # the way.
+        if session.compression is None and session.zerocopy is None:
+            self.session_registry.add(session, session.transport.write)
+        else:
+            self.session_registry.add(session)
+
+    def create_session_group(self, session_ids=()):
+        """Returns a new `ki.protocol.net.SessionGroup` of this server's
+        sessions, such as everyone in a zone or chat channel.
+
+        Groups support set operations (`|`, `&`, `-`, `^`), and send a
+        message to all of their members with a single serialization.
+        Sessions leave every group automatically when they close.
+        """
+        group = SessionGroup(self.session_registry)
+        group.update(session_ids)
+        return group
+
 
 class Client(object):
     logger = logging.getLogger('CLIENT')
@@ -338,6 +723,13 @@ class Client(object):
 
         self.session = None
 
+        # Set to a `ki.compression.CompressionPolicy` to offer
+        # compression to the server.
+        self.compression_policy = None
+
+        # Set to `True` to offer delta encoding to the server.
+        self.delta_encoding = False
+
     def run(self, event_loop):
         """Attempts to connect to the server."""
         protocol_factory = lambda: self.PROTOCOL_CLS(self)
@@ -356,20 +748,57 @@ class Client(object):
     def create_session(self, transport):
         """Returns a new session."""
         session = self.SESSION_CLS(self, transport, 0)
+        if self.compression_policy is not None:
+            session.enable_compression(self.compression_policy)
         self.session = session
         return session
 
 
 class DMLSessionBase(SessionBase):
+    def send_message(self, message):
+        """"Overrides `ki.protocol.net.DMLSession.send_message()`.
+
+        When zero-copy sends are enabled, messages are serialized into a
+        pooled buffer and sent from there, as long as nothing else is
+        waiting to be written and the frame would not be compressed.
+        """
+        zerocopy = self.zerocopy
+        if zerocopy is not None and self.transport is not None and \
+                not self.transport.get_write_buffer_size() and \
+                (self.compression is None or not self.compression.active):
+            remainder = zerocopy.send_message(message)
+            if remainder is not None:
+                if remainder:
+                    self.transport.write(remainder)
+                return
+        CDMLSession.send_message(self, message)
+
     def on_message(self, message):
-        """"Overrides `ki.protocol.net.DMLSession.on_message()`."""
-        self.logger.debug('id=%d, on_message(%r)', self.id, message.handler)
+        """"Overrides `ki.protocol.net.DMLSession.on_message()`.
+
+        Received messages are traced natively (see `ki.trace`).
+        """
 
     def on_invalid_message(self, error):
         """"Overrides `ki.protocol.net.DMLSession.on_invalid_message()`."""
         self.logger.warning('id=%d, Got an invalid message! (%r)', self.id, error)
         self.close(SessionCloseErrorCode.INVALID_MESSAGE)
 
+    def enable_delta_encoding(self):
+        """Allows this session to negotiate delta encoding with its peer."""
+        self.delta = SessionDelta(self)
+
+    def send_delta(self, message):
+        """Sends the given message, only including the fields that changed
+        since the last message of its type if the peer supports it.
+
+        Meant for messages that are sent repeatedly with few changes.
+        """
+        if self.delta is None:
+            self.send_message(message)
+        else:
+            self.delta.send_message(message)
+
 
 class ServerDMLSession(DMLSessionBase, ServerSessionBase, CServerDMLSession):
     def __init__(self, server, transport, id, manager):
@@ -411,13 +840,47 @@ class DMLServer(Server, ServiceParticipant):
         Server.__init__(self, port)
         ServiceParticipant.__init__(self)
 
-    def create_session(self, transport):
-        """Returns a new session."""
-        session_id = self.session_id_allocator.allocate()
+    def close(self):
+        """"Overrides `Server.close()`."""
+        Server.close(self)
+        self.stop_offload_pool()
+
+    def get_session(self, session_id):
+        """"Overrides `ServiceParticipant.get_session()`."""
+        return self.sessions.get(session_id)
+
+    def create_session(self, transport, session_id=None):
+        """Returns a new session, with the given ID if specified."""
+        session_id = self.allocate_session_id(session_id)
         session = self.SESSION_CLS(self, transport, session_id, self.message_mgr)
-        self.sessions[session.id] = session
+        session.message_mgr_version = self.message_mgr_version
+        if self.compression_policy is not None:
+            session.enable_compression(self.compression_policy)
+        if self.delta_encoding:
+            session.enable_delta_encoding()
+        if self.zerocopy_threshold is not None:
+            if self.send_buffer_pool is None:
+                self.send_buffer_pool = BufferPool()
+            session.enable_zerocopy(self.send_buffer_pool, self.zerocopy_threshold)
+        self.add_session(session)
         return session
 
+    def send_message_threadsafe(self, session_id, message):
+        """Queues the given DML message to be sent to the given session.
+
+        See `Server.send_threadsafe()`.
+        """
+        return self.send_threadsafe(session_id, build_frame(False, 0, message.to_bytes()))
+
+    def iter_stale_sessions(self):
+        """A generator that can be used to iterate over the sessions that
+        are still using message definitions from before the last
+        `reload_message_modules()`.
+        """
+        for session in self.sessions.values():
+            if session.message_mgr_version != self.message_mgr_version:
+                yield session
+
 
 class DMLClient(Client, ServiceParticipant):
     PROTOCOL_CLS = ClientDMLProtocol
@@ -427,8 +890,23 @@ class DMLClient(Client, ServiceParticipant):
         Client.__init__(self, host, port)
         ServiceParticipant.__init__(self)
 
+    def close(self):
+        """"Overrides `Client.close()`."""
+        Client.close(self)
+        self.stop_offload_pool()
+
+    def get_session(self, session_id):
+        """"Overrides `ServiceParticipant.get_session()`."""
+        if self.session is not None and self.session.id == session_id:
+            return self.session
+        return None
+
     def create_session(self, transport):
         """Returns a new session."""
         session = self.SESSION_CLS(self, transport, 0, self.message_mgr)
+        if self.compression_policy is not None:
+            session.enable_compression(self.compression_policy)
+        if self.delta_encoding:
+            session.enable_delta_encoding()
         self.session = session
         return session
\ No newline at end of file
@@ -0,0 +1,294 @@
+import asyncio
+import collections
+import logging
+import multiprocessing
+import multiprocessing.connection
+import os
+import threading
+import traceback
+
+from .protocol.dml import MessageManager
+
+
+class OffloadError(Exception):
+    pass
+
+
+def _worker_main(definitions, handlers, requests, replies, slot_size,
+                 task_queue, results):
+    """The entry point of an offload worker process."""
+    message_mgr = MessageManager()
+    for filepath in definitions:
+        message_mgr.load_module(filepath)
+
+    requests = memoryview(requests).cast('B')
+    replies = memoryview(replies).cast('B')
+
+    while True:
+        task = task_queue.get()
+        if task is None:
+            break
+
+        slot, session_id, size, name = task
+        offset = slot * slot_size
+        try:
+            message = message_mgr.message_from_bytes(
+                bytes(requests[offset:offset + size]))
+            if message is None:
+                raise OffloadError('Failed to decode message for handler: %s' % name)
+
+            result = handlers[name](session_id, message)
+            if result is None:
+                result = []
+            elif not isinstance(result, (list, tuple)):
+                result = [result]
+
+            data = b''.join(reply.to_bytes() for reply in result)
+            if len(data) > slot_size:
+                raise OffloadError('Reply of %d bytes exceeds the slot size of %d bytes.' %
+                                   (len(data), slot_size))
+            replies[offset:offset + len(data)] = data
+        except Exception:
+            results.send((slot, session_id, 0, traceback.format_exc()))
+        else:
+            results.send((slot, session_id, len(data), None))
+
+
+class OffloadPool(object):
+    """A pool of worker processes that run CPU-heavy message handlers
+    away from the event loop.
+
+    Messages are handed to the workers as serialized DML messages
+    through a shared memory slot, and the workers write any replies back
+    into a matching reply slot. Only the slot index and session ID are
+    sent through the task queues.
+
+    Messages from the same session are always handled by the same
+    worker, and therefore in order. A worker that dies is replaced, and
+    the messages it was given fail with an `OffloadError`.
+    """
+    logger = logging.getLogger('OFFLOAD-POOL')
+
+    SLOT_COUNT = 256
+    SLOT_SIZE = 0x10000
+
+    def __init__(self, definitions, handlers, workers=None,
+                 slot_count=None, slot_size=None):
+        self.definitions = [os.path.abspath(filepath) for filepath in definitions]
+        self.handlers = dict(handlers)
+
+        self.worker_count = workers or os.cpu_count() or 1
+        self.slot_count = slot_count or self.SLOT_COUNT
+        self.slot_size = slot_size or self.SLOT_SIZE
+
+        self._requests = multiprocessing.RawArray('B', self.slot_count * self.slot_size)
+        self._replies = multiprocessing.RawArray('B', self.slot_count * self.slot_size)
+        self._request_view = memoryview(self._requests).cast('B')
+        self._reply_view = memoryview(self._replies).cast('B')
+
+        self._free_slots = list(range(self.slot_count))
+        self._backlog = collections.deque()
+        # The future of the message in each slot that is in use, and the
+        # index of the worker it was given to.
+        self._slot_futures = {}
+        self._slot_workers = {}
+
+        self._task_queues = []
+        self._workers = []
+        self.event_loop = None
+
+        self._closing = False
+        self._stopped = False
+
+    @property
+    def running(self):
+        """Returns whether or not the worker processes are running."""
+        return bool(self._workers)
+
+    @property
+    def outstanding(self):
+        """Returns the number of submitted messages that have not been
+        handled yet.
+        """
+        return len(self._slot_futures) + len(self._backlog)
+
+    def start(self, event_loop=None):
+        """Starts the worker processes, which hand their results to the
+        given event loop (the running one if not given).
+
+        A pool can only be started once.
+        """
+        if self.running:
+            return
+        if self._stopped:
+            raise OffloadError('A stopped offload pool can not be started again.')
+
+        self.event_loop = event_loop or asyncio.get_running_loop()
+        self._task_queues = [None] * self.worker_count
+        self._workers = [None] * self.worker_count
+        for index in range(self.worker_count):
+            self._start_worker(index)
+
+    def _start_worker(self, index):
+        task_queue = multiprocessing.SimpleQueue()
+        reader, writer = multiprocessing.Pipe(duplex=False)
+        worker = multiprocessing.Process(
+            target=_worker_main,
+            args=(self.definitions, self.handlers, self._requests,
+                  self._replies, self.slot_size, task_queue, writer),
+            daemon=True)
+        worker.start()
+        writer.close()
+
+        self._task_queues[index] = task_queue
+        self._workers[index] = worker
+        threading.Thread(target=self._read_results, args=(worker, reader),
+                         name='offload-results-%d' % index, daemon=True).start()
+
+    def close(self):
+        """Stops taking new messages, and stops the worker processes once
+        every message submitted so far has been handled.
+
+        Does not block.
+        """
+        self._closing = True
+        if not self.outstanding:
+            self.stop()
+
+    def stop(self):
+        """Stops the worker processes right away, failing every message
+        that has not been handled yet with an `OffloadError` (see
+        `close()` to let them finish instead).
+
+        Does not block; workers finish whatever message they are busy
+        with in the background.
+        """
+        if not self.running:
+            return
+
+        self._closing = True
+        self._stopped = True
+
+        # Each worker is joined by its result thread once it exits.
+        for task_queue in self._task_queues:
+            task_queue.put(None)
+        self._task_queues = []
+        self._workers = []
+
+        futures = list(self._slot_futures.values())
+        futures += [future for future, _, _, _ in self._backlog]
+        self._slot_futures.clear()
+        self._slot_workers.clear()
+        self._backlog.clear()
+        for future in futures:
+            if not future.done():
+                future.set_exception(OffloadError('Offload pool was stopped.'))
+
+    def submit(self, session_id, name, data):
+        """Queues the handler with the given name to be invoked with the
+        given serialized message on behalf of the given session.
+
+        Returns an `asyncio.Future` for the handler's serialized replies,
+        which fails with an `OffloadError` if the handler does.
+        """
+        if self._closing or not self.running:
+            raise OffloadError('Offload pool is not running.')
+        if name not in self.handlers:
+            raise OffloadError('No offload handler found: %s' % name)
+        if len(data) > self.slot_size:
+            raise OffloadError('Message of %d bytes exceeds the slot size of %d bytes.' %
+                               (len(data), self.slot_size))
+
+        future = self.event_loop.create_future()
+        if not self._free_slots:
+            # Every slot is in use; wait for one to be released.
+            self._backlog.append((future, session_id, name, data))
+        else:
+            self._dispatch(self._free_slots.pop(), future, session_id, name, data)
+        return future
+
+    def _dispatch(self, slot, future, session_id, name, data):
+        offset = slot * self.slot_size
+        self._request_view[offset:offset + len(data)] = data
+        self._slot_futures[slot] = future
+
+        index = session_id % len(self._task_queues)
+        self._slot_workers[slot] = index
+        self._task_queues[index].put((slot, session_id, len(data), name))
+
+    def _release_slot(self, slot):
+        """Frees the given slot, and returns the future of the message
+        that was in it.
+        """
+        future = self._slot_futures.pop(slot)
+        del self._slot_workers[slot]
+
+        # Hand the slot to the next message waiting on one.
+        if self._backlog:
+            self._dispatch(slot, *self._backlog.popleft())
+        else:
+            self._free_slots.append(slot)
+        return future
+
+    def _read_results(self, worker, reader):
+        """Hands the results of the given worker to the event loop until
+        it exits, and then reports its exit.
+        """
+        try:
+            while True:
+                multiprocessing.connection.wait([reader, worker.sentinel])
+                try:
+                    while reader.poll():
+                        self.event_loop.call_soon_threadsafe(self._on_result, *reader.recv())
+                except EOFError:
+                    break
+                if not worker.is_alive():
+                    break
+
+            worker.join()
+            self.event_loop.call_soon_threadsafe(self._on_worker_exit, worker)
+        except RuntimeError:
+            # The event loop has been closed.
+            pass
+        finally:
+            reader.close()
+
+    def _on_worker_exit(self, worker):
+        if worker not in self._workers:
+            # The pool was stopped.
+            return
+
+        index = self._workers.index(worker)
+        self.logger.error('Offload worker %d died (exit code %r); restarting it.',
+                          index, worker.exitcode)
+        self._start_worker(index)
+
+        # Whatever the worker was given is lost.
+        slots = [slot for slot, worker_index in self._slot_workers.items()
+                 if worker_index == index]
+        for slot in slots:
+            future = self._release_slot(slot)
+            if not future.done():
+                future.set_exception(OffloadError('Offload worker %d died.' % index))
+
+        if self._closing and not self.outstanding:
+            self.stop()
+
+    def _on_result(self, slot, session_id, size, error):
+        if slot not in self._slot_futures:
+            # The pool was stopped in the meantime.
+            return
+
+        offset = slot * self.slot_size
+        data = bytes(self._reply_view[offset:offset + size])
+        future = self._release_slot(slot)
+
+        if not future.done():
+            if error is not None:
+                future.set_exception(OffloadError(
+                    'Offload handler failed for session %d!\n%s' % (session_id, error)))
+            else:
+                future.set_result(data)
+
+        if self._closing and not self.outstanding:
+            self.stop()
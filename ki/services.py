@@ -1,6 +1,9 @@
+import asyncio
+import collections
 import logging
 import weakref
 
+from .offload import OffloadPool
 from .protocol.dml import MessageManager
 
 
@@ -19,6 +22,39 @@ class MessageHandler(object):
     def __call__(self, sender, message):
         return self._func(self._service(), sender, message)
 
+    @property
+    def is_coroutine(self):
+        """Returns whether or not this message handler was defined with
+        `async def`.
+        """
+        return asyncio.iscoroutinefunction(self._func)
+
+
+class OffloadHandler(object):
+    """A message handler that hands messages to a `ServiceParticipant`'s
+    offload pool, and sends the replies back to the sender.
+
+    It is invoked by passing (sender, data), where `data` is the
+    serialized message, and always runs through the sender's
+    `MessageQueue` so that offloaded messages keep their place in line.
+    """
+    is_coroutine = True
+
+    def __init__(self, participant, name):
+        self._participant = weakref.ref(participant)
+        self.name = name
+
+    async def __call__(self, sender, data):
+        participant = self._participant()
+        offload_pool = participant.offload_pool
+        if offload_pool is None:
+            participant.logger.warning("sender=%r, Offload pool stopped; dropping '%s'.",
+                                       sender, self.name)
+            return
+
+        data = await offload_pool.submit(sender.id, self.name, data)
+        participant.on_offload_reply(sender, data)
+
 
 class MessageHandlerDecorator(object):
     """A decorator used to define a new message handler for a `Service`
@@ -63,15 +99,112 @@ class Service(object):
                 yield attr
 
 
+class MessageQueue(object):
+    """Invokes a single sender's deferred message handlers, one at a
+    time, in the order that their messages were received.
+    """
+    logger = logging.getLogger('MESSAGE-QUEUE')
+
+    def __init__(self, sender, max_pending, on_empty=None):
+        self._sender = weakref.ref(sender)
+        self.max_pending = max_pending
+        self._on_empty = on_empty
+
+        self._pending = collections.deque()
+        self._worker = None
+        self._reading_paused = False
+
+    def __len__(self):
+        return len(self._pending)
+
+    @property
+    def sender(self):
+        """Returns the sender whose messages are queued."""
+        return self._sender()
+
+    @property
+    def running(self):
+        """Returns whether or not any message handlers are pending."""
+        return self._worker is not None
+
+    def put(self, message_handler, message):
+        """Queues the given message handler to be invoked with the
+        given message.
+        """
+        self._pending.append((message_handler, message))
+        if len(self._pending) >= self.max_pending:
+            self._set_reading_paused(True)
+
+        if self._worker is None:
+            self._worker = asyncio.ensure_future(self._run())
+
+    def cancel(self):
+        """Cancels every pending message handler."""
+        self._pending.clear()
+        if self._worker is not None:
+            self._worker.cancel()
+            self._worker = None
+
+    def _set_reading_paused(self, paused):
+        # Stop reading from the sender's connection while it has too
+        # many messages in flight; TCP flow control does the rest.
+        transport = getattr(self.sender, 'transport', None)
+        if transport is None or paused == self._reading_paused:
+            return
+
+        self._reading_paused = paused
+        if paused:
+            transport.pause_reading()
+        else:
+            transport.resume_reading()
+
+    async def _run(self):
+        try:
+            while self._pending:
+                message_handler, message = self._pending[0]
+                try:
+                    result = message_handler(self.sender, message)
+                    if asyncio.iscoroutine(result):
+                        await result
+                except asyncio.CancelledError:
+                    raise
+                except Exception:
+                    self.logger.exception("sender=%r, Message handler '%s' failed!",
+                                          self.sender, message_handler.name)
+
+                self._pending.popleft()
+                if len(self._pending) <= self.max_pending // 2:
+                    self._set_reading_paused(False)
+        except asyncio.CancelledError:
+            pass
+        finally:
+            self._worker = None
+
+        if self._on_empty is not None:
+            self._on_empty(self)
+
+
 class ServiceParticipant(object):
     """The base for any class that wishes to house a service, and
     invoke its message handlers.
     """
     logger = logging.getLogger('SERVICE-PARTICIPANT')
 
+    #: The maximum number of messages a single sender may have waiting
+    #: on their handlers before we stop reading from them.
+    MAX_PENDING_MESSAGES = 64
+
     def __init__(self):
         self.message_mgr = MessageManager()
+        self.message_mgr_version = 0
+        self.message_definitions = []
         self.message_handlers = {}
+        self.services = []
+
+        self._message_queues = {}
+
+        self.offload_handlers = {}
+        self.offload_pool = None
 
     def register_service(self, service):
         """Adds the given service's message handlers to our managed
@@ -79,10 +212,75 @@ class ServiceParticipant(object):
         """
         for message_handler in service.iter_message_handlers():
             self.message_handlers[message_handler.name] = message_handler
+        if service not in self.services:
+            self.services.append(service)
+
+    def load_message_module(self, filepath):
+        """Loads the given message module into our message manager, and
+        remembers it for `reload_message_modules()`.
+        """
+        module = self.message_mgr.load_module(filepath)
+        if filepath not in self.message_definitions:
+            self.message_definitions.append(filepath)
+        return module
+
+    def reload_message_modules(self, definitions=None):
+        """Replaces our message manager with a new one, built from the
+        given message module files (or the ones loaded so far).
+
+        Live sessions keep decoding with the manager they were created
+        with, which stays alive until the last of them is closed; only
+        sessions created from here on use the new definitions. Messages
+        keep their manager alive too. If any module fails to load, a
+        `ValueError` is raised, and the current manager is left
+        untouched.
+        """
+        if definitions is None:
+            definitions = self.message_definitions
+
+        message_mgr = MessageManager()
+        for filepath in definitions:
+            if message_mgr.load_module(filepath) is None:
+                raise ValueError('Failed to load message module: %r' % filepath)
+
+        self.message_mgr = message_mgr
+        self.message_mgr_version += 1
+        self.message_definitions = list(definitions)
+        for service in self.services:
+            service.message_mgr = message_mgr
+
+        # The offload workers keep their own copy of the definitions, so
+        # start a new pool. The old one finishes the messages it already
+        # has before it stops.
+        if self.offload_pool is not None:
+            offload_pool = self.offload_pool
+            offload_pool.close()
+            self.offload_pool = None
+            self.start_offload_pool(self.message_definitions,
+                                    event_loop=offload_pool.event_loop,
+                                    workers=offload_pool.worker_count,
+                                    slot_count=offload_pool.slot_count,
+                                    slot_size=offload_pool.slot_size)
+
+        self.logger.info('Reloaded message modules (version %d).',
+                         self.message_mgr_version)
 
     def handle_message(self, sender, message):
-        """Invokes the correct message handler for the given message."""
-        self.logger.debug('handle_message(%r, %r)', sender, message.handler)
+        """Invokes the correct message handler for the given message.
+
+        Coroutine message handlers are scheduled rather than invoked
+        immediately. Messages from the same sender are always handled
+        in the order that they were received, while different senders
+        are handled concurrently.
+        """
+        if self.offload_pool is not None and message.handler in self.offload_handlers:
+            # Offloaded messages wait their turn behind the sender's other
+            # messages, like any coroutine handler.
+            message_queue = self._message_queues.get(id(sender))
+            if message_queue is None:
+                message_queue = self._create_message_queue(sender)
+            message_queue.put(OffloadHandler(self, message.handler), message.to_bytes())
+            return
 
         message_handler = self.message_handlers.get(message.handler)
         if message_handler is None:
@@ -90,4 +288,99 @@ class ServiceParticipant(object):
                                 sender, message.handler)
             return
 
-        message_handler(sender, message)
+        message_queue = self._message_queues.get(id(sender))
+        if not message_handler.is_coroutine and message_queue is None:
+            # Nothing is waiting on this sender; take the fast path.
+            message_handler(sender, message)
+            return
+
+        if message_queue is None:
+            message_queue = self._create_message_queue(sender)
+
+        # The message we were given only lives for the duration of this
+        # call, so hold onto a copy of it instead.
+        message_mgr = getattr(sender, 'manager', self.message_mgr)
+        message = message_mgr.message_from_bytes(message.to_bytes())
+        message_queue.put(message_handler, message)
+
+    def register_offload_handler(self, name, func):
+        """Registers the given function to handle messages with the
+        given handler name inside of an offload worker process.
+
+        The function is invoked as `func(session_id, message)`, and may
+        return a message, or a list of messages, to send back to the
+        session. It must be defined at the top level of a module, so
+        that the worker processes can import it.
+
+        This must be done before `start_offload_pool()`.
+        """
+        self.offload_handlers[name] = func
+
+    def start_offload_pool(self, definitions, workers=None, event_loop=None, **kwargs):
+        """Starts the worker processes for our offload handlers, which
+        hand their replies to the given event loop (the running one if
+        not given).
+
+        `definitions` are the message module files the workers should
+        load; they must match those loaded into our message manager.
+        """
+        if self.offload_pool is not None:
+            return
+
+        self.offload_pool = OffloadPool(definitions, self.offload_handlers,
+                                        workers=workers, **kwargs)
+        self.offload_pool.start(event_loop)
+
+    def stop_offload_pool(self):
+        """Stops the worker processes for our offload handlers, without
+        waiting on them. Offloaded messages that have not been handled
+        yet are dropped.
+        """
+        if self.offload_pool is not None:
+            self.offload_pool.stop()
+            self.offload_pool = None
+
+    def get_session(self, session_id):
+        """Returns the session with the given ID, or `None` if it does
+        not exist.
+        """
+        return None
+
+    def on_offload_reply(self, sender, data):
+        """Invoked when an offload handler has replies to send to the
+        given sender.
+        """
+        # Session IDs are reused, so make sure the reply goes to the very
+        # session that sent the message, and not to whoever took its ID.
+        if self.get_session(sender.id) is not sender:
+            self.logger.debug('session_id=%d, Dropping offload reply for a closed session.',
+                              sender.id)
+            return
+
+        message_mgr = getattr(sender, 'manager', self.message_mgr)
+        for message in message_mgr.messages_from_bytes(data, threads=1):
+            if message is not None:
+                sender.send_message(message)
+
+    def _create_message_queue(self, sender):
+        key = id(sender)
+
+        def on_close():
+            message_queue = self._message_queues.pop(key, None)
+            if message_queue is not None:
+                message_queue.cancel()
+
+        def on_empty(message_queue):
+            if self._message_queues.get(key) is message_queue:
+                del self._message_queues[key]
+
+            sender = message_queue.sender
+            if hasattr(sender, 'remove_close_handler'):
+                sender.remove_close_handler(on_close)
+
+        message_queue = MessageQueue(sender, self.MAX_PENDING_MESSAGES,
+                                     on_empty=on_empty)
+        self._message_queues[key] = message_queue
+        if hasattr(sender, 'add_close_handler'):
+            sender.add_close_handler(on_close)
+        return message_queue
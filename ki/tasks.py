@@ -42,11 +42,18 @@ class Task(object):
         """Returns whether or not this task is currently running."""
         return self.asyncio_task is not None
 
-    def start(self, delay=None, args=None):
-        """Starts the task."""
+    def start(self, delay=None, args=None, event_loop=None):
+        """Starts the task.
+
+        The task runs on the given event loop, or the running one if
+        `event_loop` is `None`.
+        """
         if not self.running:
-            Task.running_tasks[self.name] = \
-                asyncio.ensure_future(self._tick(delay=delay, args=args))
+            coro = self._tick(delay=delay, args=args)
+            if event_loop is not None:
+                Task.running_tasks[self.name] = event_loop.create_task(coro)
+            else:
+                Task.running_tasks[self.name] = asyncio.ensure_future(coro)
 
     def stop(self):
         """Stops the task."""
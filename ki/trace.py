@@ -0,0 +1,119 @@
+"""Decodes packet traces dumped by `ki.protocol.net.tracer`.
+
+Tracing is off by default. To record one in every 100 events across all
+sessions, and every event of session 42:
+
+    from ki.protocol.net import tracer
+    tracer.sample_rate = 100
+    tracer.trace_session(42)
+    ...
+    tracer.dump('session.trace')
+
+Dumps can then be read with `read_trace()`, or printed with:
+
+    python -m ki.trace session.trace
+"""
+import argparse
+import struct
+import sys
+from collections import namedtuple
+from enum import IntEnum
+
+TRACE_MAGIC = b'KITRACE\x00'
+TRACE_VERSION = 1
+
+TRACE_HEADER = struct.Struct('<8sHHIQQ')
+TRACE_EVENT = struct.Struct('<QIIHBBBBBx')
+
+
+class TraceEventType(IntEnum):
+    FRAME_SENT = 1
+    CONTROL_RECEIVED = 2
+    APPLICATION_RECEIVED = 3
+    MESSAGE_RECEIVED = 4
+    INVALID_PACKET = 5
+    INVALID_MESSAGE = 6
+    CLOSED = 7
+
+
+TraceEvent = namedtuple('TraceEvent', [
+    'timestamp',  # seconds since the epoch
+    'session_id',
+    'type',
+    'control',
+    'opcode',
+    'service_id',
+    'message_type',
+    'size',
+    'detail',
+])
+
+
+class TraceError(Exception):
+    pass
+
+
+def decode_trace(data):
+    """Returns the events of the given trace dump, oldest first."""
+    if len(data) < TRACE_HEADER.size:
+        raise TraceError('Trace is too short.')
+    magic, version, event_size, count, steady_time, system_time = \
+        TRACE_HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC:
+        raise TraceError('Not a trace dump.')
+    if version != TRACE_VERSION or event_size != TRACE_EVENT.size:
+        raise TraceError('Unsupported trace version: %d' % version)
+    if len(data) < TRACE_HEADER.size + count * event_size:
+        raise TraceError('Trace is truncated.')
+
+    # Event timestamps come from a monotonic clock; the header says what
+    # that clock read at the time of the dump.
+    offset = system_time - steady_time
+
+    events = []
+    for i in range(count):
+        timestamp, size, detail, session_id, event_type, control, opcode, \
+            service_id, message_type = TRACE_EVENT.unpack_from(
+                data, TRACE_HEADER.size + i * event_size)
+        events.append(TraceEvent(
+            (timestamp + offset) / 1e9, session_id, TraceEventType(event_type),
+            bool(control), opcode, service_id, message_type, size, detail))
+    return events
+
+
+def read_trace(filepath):
+    """Returns the events of the given trace dump file, oldest first."""
+    with open(filepath, 'rb') as f:
+        return decode_trace(f.read())
+
+
+def format_event(event):
+    line = '%.6f session=%d %s' % (event.timestamp, event.session_id, event.type.name)
+    if event.type in (TraceEventType.FRAME_SENT, TraceEventType.CONTROL_RECEIVED,
+                      TraceEventType.APPLICATION_RECEIVED):
+        line += ' control=%d opcode=0x%02X' % (event.control, event.opcode)
+    if event.service_id or event.message_type:
+        line += ' service_id=%d message_type=%d' % (event.service_id, event.message_type)
+    if event.size:
+        line += ' size=%d' % event.size
+    if event.detail:
+        line += ' detail=%d' % event.detail
+    return line
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(
+        prog='python -m ki.trace',
+        description='Prints the events of a packet trace dump.')
+    parser.add_argument('--session', type=int,
+                        help='only print the events of this session')
+    parser.add_argument('filepath', help='the trace dump to read')
+    args = parser.parse_args(argv)
+
+    for event in read_trace(args.filepath):
+        if args.session is None or event.session_id == args.session:
+            print(format_event(event))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
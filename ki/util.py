@@ -25,6 +25,22 @@ class IDAllocator(object):
         self.next_id += 1
         return allocated_id
 
+    def reserve(self, id):
+        """Allocates the given ID specifically.
+
+        If the ID is already in use, or outside of the pool, an
+        AllocationError will be thrown.
+        """
+        if id in self.unused_ids:
+            self.unused_ids.remove(id)
+        elif self.next_id <= id <= self.max_id:
+            # Skipped IDs remain available.
+            self.unused_ids.update(range(self.next_id, id))
+            self.next_id = id + 1
+        else:
+            raise AllocationError('ID is unavailable -- %d' % id)
+        return id
+
     def free(self, id):
         """Allows the given ID to be allocated again."""
         self.unused_ids.add(id)
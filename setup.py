@@ -49,6 +49,10 @@ class CMakeBuild(build_ext):
         ext_dir = os.path.abspath(os.path.dirname(self.get_ext_fullpath(ext.name)))
         cmake_args = ['-DCMAKE_LIBRARY_OUTPUT_DIRECTORY=' + ext_dir,
                       '-DPYTHON_EXECUTABLE=' + sys.executable]
+        if message_definitions:
+            cmake_args += ['-DKIPY_MESSAGE_DEFINITIONS=' + ';'.join(message_definitions)]
+        if os.environ.get('KIPY_WITH_ZSTD'):
+            cmake_args += ['-DKIPY_WITH_ZSTD=ON']
 
         cfg = 'Debug' if self.debug else 'Release'
         build_args = ['--config', cfg]
@@ -84,6 +88,19 @@ with open('README.md', 'r', encoding='utf-8') as f:
     long_description = f.read()
 
 
+# Typed message bindings are only built when message definitions are
+# provided, e.g. KIPY_MESSAGE_DEFINITIONS=LoginMessages.xml:GameMessages.xml
+message_definitions = [os.path.abspath(path) for path in
+                       os.environ.get('KIPY_MESSAGE_DEFINITIONS', '').split(os.pathsep)
+                       if path]
+
+ext_modules = [
+    CMakeExtension('ki.dml'),
+    CMakeExtension('ki.protocol')
+]
+if message_definitions:
+    ext_modules.append(CMakeExtension('ki.messages'))
+
 setup_requires = ['pytest-runner']
 install_requires = ['ruamel.yaml>=0.15.35']
 tests_require = ['pytest>=3.0.0']
@@ -98,11 +115,7 @@ setup(
     description=about['__description__'],
     long_description=long_description,
     packages=find_packages(),
-    ext_modules=[
-        CMakeExtension('ki.dml'),
-        CMakeExtension('ki.protocol')
-
-    ],
+    ext_modules=ext_modules,
     cmdclass={
         'build_ext': CMakeBuild
     },
@@ -0,0 +1,163 @@
+#pragma once
+#ifdef KIPY_WITH_ZSTD
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <zstd.h>
+#include <zdict.h>
+
+#include <ki/protocol/exception.h>
+
+namespace kipy
+{
+    /**
+     * A zstd dictionary, digested once for compression (at a fixed
+     * level) and once for decompression.
+     *
+     * Instances are never modified after construction, so one can be
+     * shared by every session that uses the same dictionary, even across
+     * threads.
+     */
+    class ZstdDictionary
+    {
+    public:
+        explicit ZstdDictionary(const std::string &dictionary, const int level = 3)
+            : m_level(level), m_id(ZDICT_getDictID(dictionary.data(), dictionary.size())),
+              m_cdict(ZSTD_createCDict(dictionary.data(), dictionary.size(), level), ZSTD_freeCDict),
+              m_ddict(ZSTD_createDDict(dictionary.data(), dictionary.size()), ZSTD_freeDDict)
+        {
+            if (dictionary.empty() || !m_cdict || !m_ddict)
+                throw ki::protocol::value_error("Invalid zstd dictionary.");
+        }
+
+        int get_level() const { return m_level; }
+        unsigned int get_id() const { return m_id; }
+        const ZSTD_CDict *get_cdict() const { return m_cdict.get(); }
+        const ZSTD_DDict *get_ddict() const { return m_ddict.get(); }
+
+    private:
+        int m_level;
+        unsigned int m_id;
+        std::unique_ptr<ZSTD_CDict, size_t (*)(ZSTD_CDict *)> m_cdict;
+        std::unique_ptr<ZSTD_DDict, size_t (*)(ZSTD_DDict *)> m_ddict;
+    };
+
+    /**
+     * A zstd compressor/decompressor pair with an optional, shared
+     * dictionary.
+     *
+     * Each context is created the first time it is needed and reused
+     * for every message after that, which is what makes compressing small
+     * messages cheap; a codec that is only used in one direction never
+     * creates the other context. Instances are meant to be owned by one
+     * session.
+     */
+    class ZstdCodec
+    {
+    public:
+        /**
+         * When a dictionary is given, its level is used in place of
+         * `level`.
+         */
+        explicit ZstdCodec(const int level = 3,
+            std::shared_ptr<ZstdDictionary> dictionary = nullptr)
+            : m_level(dictionary ? dictionary->get_level() : level),
+              m_dictionary(std::move(dictionary)),
+              m_cctx(nullptr, ZSTD_freeCCtx),
+              m_dctx(nullptr, ZSTD_freeDCtx)
+        {}
+
+        int get_level() const { return m_level; }
+        unsigned int get_dictionary_id() const
+        {
+            return m_dictionary ? m_dictionary->get_id() : 0;
+        }
+
+        std::string compress(const char *data, const size_t size)
+        {
+            if (!m_cctx)
+            {
+                m_cctx.reset(ZSTD_createCCtx());
+                if (!m_cctx)
+                    throw ki::protocol::runtime_error("Failed to create zstd context.");
+            }
+
+            std::string output(ZSTD_compressBound(size), '\0');
+            size_t result;
+            if (m_dictionary)
+                result = ZSTD_compress_usingCDict(m_cctx.get(),
+                    &output[0], output.size(), data, size, m_dictionary->get_cdict());
+            else
+                result = ZSTD_compressCCtx(m_cctx.get(),
+                    &output[0], output.size(), data, size, m_level);
+
+            check(result);
+            output.resize(result);
+            return output;
+        }
+
+        std::string decompress(const char *data, const size_t size, const size_t decompressed_size)
+        {
+            if (!m_dctx)
+            {
+                m_dctx.reset(ZSTD_createDCtx());
+                if (!m_dctx)
+                    throw ki::protocol::runtime_error("Failed to create zstd context.");
+            }
+
+            std::string output(decompressed_size, '\0');
+            size_t result;
+            if (m_dictionary)
+                result = ZSTD_decompress_usingDDict(m_dctx.get(),
+                    &output[0], output.size(), data, size, m_dictionary->get_ddict());
+            else
+                result = ZSTD_decompressDCtx(m_dctx.get(),
+                    &output[0], output.size(), data, size);
+
+            check(result);
+            if (result != decompressed_size)
+                throw ki::protocol::parse_error("Decompressed size does not match.");
+            return output;
+        }
+
+        /**
+         * Trains a dictionary from samples of captured traffic.
+         */
+        static std::string train_dictionary(
+            const std::vector<std::string> &samples, const size_t size)
+        {
+            std::string buffer;
+            std::vector<size_t> sample_sizes;
+            for (const auto &sample : samples)
+            {
+                buffer += sample;
+                sample_sizes.push_back(sample.size());
+            }
+
+            std::string dictionary(size, '\0');
+            const auto result = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(),
+                buffer.data(), sample_sizes.data(), static_cast<unsigned int>(sample_sizes.size()));
+            if (ZDICT_isError(result))
+                throw ki::protocol::runtime_error(
+                    std::string("Failed to train dictionary: ") + ZDICT_getErrorName(result));
+            dictionary.resize(result);
+            return dictionary;
+        }
+
+    private:
+        int m_level;
+        std::shared_ptr<ZstdDictionary> m_dictionary;
+        std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> m_cctx;
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> m_dctx;
+
+        static void check(const size_t result)
+        {
+            if (ZSTD_isError(result))
+                throw ki::protocol::runtime_error(
+                    std::string("zstd: ") + ZSTD_getErrorName(result));
+        }
+    };
+}
+#endif
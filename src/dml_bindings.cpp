@@ -1,5 +1,9 @@
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <vector>
 
 #include <pybind11/pybind11.h>
 
@@ -8,6 +12,8 @@
 #include <ki/dml/FieldBase.h>
 #include <ki/dml/Field.h>
 
+#include "record_columns.h"
+
 #define DEF_FIELD_CLASS(NAME, TYPE)                                             \
     py::class_<Field<TYPE>>(m, NAME)                                            \
         .def(py::init<std::string>())                                           \
@@ -63,8 +69,252 @@
         },                                 \
         py::arg("data"))
 
+#define DEF_VALUE_COLUMN_CLASS(NAME, TYPE)                                     \
+    track_column_exports(                                                      \
+        py::class_<ValueColumn<TYPE>, Column>(m, NAME, py::buffer_protocol())  \
+            .def_buffer(&get_column_buffer<TYPE>)                              \
+            .def("__getitem__",                                                \
+                &get_column_value<TYPE>,                                       \
+                py::arg("row"),                                                \
+                py::return_value_policy::copy)                                 \
+            .def("assign",                                                     \
+                &assign_column_values<TYPE>,                                   \
+                py::arg("values")))
+
 namespace py = pybind11;
 
+/**
+ * Raises a BufferError if the given column (or batch) is being
+ * modified without the GIL.
+ */
+template <typename T>
+void check_unlocked(const T &self, const std::string &name)
+{
+    if (!self.is_locked())
+        return;
+    PyErr_SetString(PyExc_BufferError, (name + " is being modified").c_str());
+    throw py::error_already_set();
+}
+
+/**
+ * Raises a BufferError if the storage of the given column (or of any
+ * column of the given batch) could be referred to by a buffer export,
+ * and must not be resized.
+ */
+template <typename T>
+void check_resizable(const T &self, const std::string &name)
+{
+    check_unlocked(self, name);
+    if (!self.is_exported())
+        return;
+    PyErr_SetString(PyExc_BufferError,
+        (name + " can not be resized while its buffer is exported").c_str());
+    throw py::error_already_set();
+}
+
+// pybind11's buffer protocol functions, shared by every class.
+getbufferproc base_getbuffer = nullptr;
+releasebufferproc base_releasebuffer = nullptr;
+
+kipy::Column *get_exporting_column(PyObject *obj)
+{
+    try
+    {
+        return py::handle(obj).cast<kipy::Column *>();
+    }
+    catch (const py::cast_error &)
+    {
+        return nullptr;
+    }
+}
+
+int get_column_export(PyObject *obj, Py_buffer *view, int flags)
+{
+    auto *column = get_exporting_column(obj);
+    if (!column || column->is_locked())
+    {
+        PyErr_SetString(PyExc_BufferError, "Column is being modified");
+        view->obj = nullptr;
+        return -1;
+    }
+
+    const auto result = base_getbuffer(obj, view, flags);
+    if (result == 0)
+        column->add_export();
+    return result;
+}
+
+void release_column_export(PyObject *obj, Py_buffer *view)
+{
+    base_releasebuffer(obj, view);
+    if (auto *column = get_exporting_column(obj))
+        column->release_export();
+}
+
+/**
+ * Counts the buffer exports of the given column class, which must have
+ * been given a buffer with `def_buffer()`.
+ */
+void track_column_exports(py::handle cls)
+{
+    auto *buffer_procs = reinterpret_cast<PyTypeObject *>(cls.ptr())->tp_as_buffer;
+    if (!base_getbuffer)
+    {
+        base_getbuffer = buffer_procs->bf_getbuffer;
+        base_releasebuffer = buffer_procs->bf_releasebuffer;
+    }
+    buffer_procs->bf_getbuffer = &get_column_export;
+    buffer_procs->bf_releasebuffer = &release_column_export;
+}
+
+template <typename ValueT>
+py::buffer_info get_column_buffer(kipy::ValueColumn<ValueT> &self)
+{
+    auto &values = self.get_values();
+    return py::buffer_info(
+        values.data(),
+        sizeof(ValueT),
+        py::format_descriptor<ValueT>::format(),
+        1,
+        { static_cast<Py_ssize_t>(values.size()) },
+        { static_cast<Py_ssize_t>(sizeof(ValueT)) });
+}
+
+template <typename ValueT>
+ValueT get_column_value(const kipy::ValueColumn<ValueT> &self, const size_t row)
+{
+    if (row >= self.get_row_count())
+        throw py::index_error("Row " + std::to_string(row) + " is out of range");
+    return self.get_values()[row];
+}
+
+template <typename ValueT>
+void assign_column_values(kipy::ValueColumn<ValueT> &self, py::buffer values)
+{
+    // Accept any 1-dimensional buffer with the same kind and size of
+    // element, regardless of the exact format character used.
+    const auto info = values.request();
+    const char kind = info.format.empty() ? '\0' : info.format.back();
+    bool compatible = info.ndim == 1 && info.itemsize == sizeof(ValueT) && kind != '\0';
+    if (std::is_floating_point<ValueT>::value)
+        compatible = compatible && (kind == 'f' || kind == 'd');
+    else if (std::is_signed<ValueT>::value)
+        compatible = compatible && std::strchr("bhilq", kind) != nullptr;
+    else
+        compatible = compatible && std::strchr("BHILQ", kind) != nullptr;
+    if (!compatible)
+        throw ki::dml::value_error("Buffer is not compatible with column '" + self.get_name() + "'");
+    check_resizable(self, "Column '" + self.get_name() + "'");
+
+    auto &column_values = self.get_values();
+    column_values.resize(info.shape[0]);
+    const auto *data = static_cast<const char *>(info.ptr);
+    for (Py_ssize_t i = 0; i < info.shape[0]; ++i)
+        std::memcpy(&column_values[i], data + i * info.strides[0], sizeof(ValueT));
+}
+
+/**
+ * Reads a field's value into a Python object.
+ */
+struct FieldValueGetter
+{
+    const ki::dml::FieldBase &field;
+
+    template <typename ValueT>
+    py::object visit() const
+    {
+        return py::cast(static_cast<const ki::dml::Field<ValueT> &>(field).get_value());
+    }
+};
+
+/**
+ * Converts a Python object into a field's value, and returns a function
+ * that writes it into the field.
+ */
+struct FieldValueSetter
+{
+    ki::dml::FieldBase &field;
+    py::handle value;
+
+    template <typename ValueT>
+    std::function<void()> visit() const
+    {
+        auto &typed_field = static_cast<ki::dml::Field<ValueT> &>(field);
+        const auto converted = value.cast<ValueT>();
+        return [&typed_field, converted]() { typed_field.set_value(converted); };
+    }
+};
+
+/**
+ * Resolves a field by name (str) or by index (int), as returned by
+ * Record.field_indices().
+ */
+ki::dml::FieldBase &resolve_field(const ki::dml::Record &record, py::handle key)
+{
+    if (py::isinstance<py::str>(key))
+    {
+        const auto name = key.cast<std::string>();
+        auto *field = record.get_field(name);
+        if (!field)
+            throw py::key_error("Field '" + name + "' does not exist");
+        return *field;
+    }
+
+    size_t index;
+    try
+    {
+        index = key.cast<size_t>();
+    }
+    catch (const py::cast_error &)
+    {
+        throw py::type_error("Fields must be given by name or by index");
+    }
+    if (index >= record.get_field_count())
+        throw py::index_error("Field index " + std::to_string(index) + " is out of range");
+    return **(record.fields_begin() + index);
+}
+
+py::object get_field_value(const ki::dml::FieldBase &field)
+{
+    const FieldValueGetter getter{ field };
+    return kipy::visit_field_type(kipy::get_field_type(field), getter);
+}
+
+/**
+ * Converts a Python object into a field's value without setting it yet.
+ */
+std::function<void()> prepare_field_value(ki::dml::FieldBase &field, py::handle value)
+{
+    const FieldValueSetter setter{ field, value };
+    try
+    {
+        return kipy::visit_field_type(kipy::get_field_type(field), setter);
+    }
+    catch (const py::cast_error &)
+    {
+        throw py::type_error("Field '" + field.get_name() + "' can not be set to a value of type '" +
+            std::string(py::str(value.get_type().attr("__name__"))) + "'");
+    }
+}
+
+/**
+ * Sets several fields at once. Every value is converted before any
+ * field is changed, so that a bad value leaves the record untouched.
+ */
+void set_field_values(const ki::dml::Record &record, py::dict values, const bool names_only)
+{
+    std::vector<std::function<void()>> setters;
+    setters.reserve(values.size());
+    for (auto item : values)
+    {
+        if (names_only && !py::isinstance<py::str>(item.first))
+            throw py::type_error("Field names must be strings");
+        setters.push_back(prepare_field_value(resolve_field(record, item.first), item.second));
+    }
+    for (const auto &setter : setters)
+        setter();
+}
+
 PYBIND11_MODULE(dml, m)
 {
     using namespace ki::dml;
@@ -173,8 +423,216 @@ PYBIND11_MODULE(dml, m)
         DEF_ADD_FIELD_METHOD("add_dbl_field", DBL)
         DEF_ADD_FIELD_METHOD("add_gid_field", GID)
 
+        // Extension: field_indices()
+        .def("field_indices",
+            [](const Record &self, py::iterable names)
+            {
+                py::list indices;
+                for (auto item : names)
+                {
+                    const auto name = item.cast<std::string>();
+                    const auto it = std::find_if(self.fields_begin(), self.fields_end(),
+                        [&name](const FieldBase *field) { return field->get_name() == name; });
+                    if (it == self.fields_end())
+                        throw py::key_error("Field '" + name + "' does not exist");
+                    indices.append(it - self.fields_begin());
+                }
+                return indices;
+            },
+            py::arg("names"))
+        // Extension: get_values()
+        .def("get_values",
+            [](const Record &self, py::iterable keys)
+            {
+                py::list values;
+                for (auto key : keys)
+                    values.append(get_field_value(resolve_field(self, key)));
+                return values;
+            },
+            py::arg("keys"))
+        // Extension: set_values()
+        .def("set_values",
+            [](Record &self, py::dict values)
+            {
+                set_field_values(self, values, false);
+            },
+            py::arg("values"))
+        // Extension: to_dict()
+        .def("to_dict",
+            [](const Record &self)
+            {
+                py::dict values;
+                for (auto it = self.fields_begin(); it != self.fields_end(); ++it)
+                    values[py::str((*it)->get_name())] = get_field_value(**it);
+                return values;
+            })
+        // Extension: from_dict()
+        .def("from_dict",
+            [](Record &self, py::dict values)
+            {
+                set_field_values(self, values, true);
+            },
+            py::arg("values"))
+
         // Extension: to_bytes()
         DEF_TO_BYTES_EXTENSION(Record)
         // Extension: from_bytes()
         DEF_FROM_BYTES_EXTENSION(Record);
+
+    using namespace kipy;
+
+    // Class: Column
+    py::class_<Column>(m, "Column")
+
+        // Descriptor: __len__
+        .def("__len__", &Column::get_row_count)
+
+        // Property: name (read-only)
+        .def_property_readonly("name", &Column::get_name,
+            py::return_value_policy::copy)
+        // Property: type_name (read-only)
+        .def_property_readonly("type_name",
+            [](const Column &self)
+            {
+                return get_field_type_name(self.get_type());
+            },
+            py::return_value_policy::copy);
+
+    // Classes: *Column
+    DEF_VALUE_COLUMN_CLASS("BytColumn", BYT);
+    DEF_VALUE_COLUMN_CLASS("UBytColumn", UBYT);
+    DEF_VALUE_COLUMN_CLASS("ShrtColumn", SHRT);
+    DEF_VALUE_COLUMN_CLASS("UShrtColumn", USHRT);
+    DEF_VALUE_COLUMN_CLASS("IntColumn", INT);
+    DEF_VALUE_COLUMN_CLASS("UIntColumn", UINT);
+    DEF_VALUE_COLUMN_CLASS("FltColumn", FLT);
+    DEF_VALUE_COLUMN_CLASS("DblColumn", DBL);
+    DEF_VALUE_COLUMN_CLASS("GidColumn", GID);
+
+    // Class: StrColumn
+    py::class_<StringColumn<STR>, Column>(m, "StrColumn")
+
+        // Descriptor: __getitem__
+        .def("__getitem__",
+            [](const StringColumn<STR> &self, const size_t row)
+            {
+                if (row >= self.get_row_count())
+                    throw py::index_error("Row " + std::to_string(row) + " is out of range");
+                return self.get_value(row);
+            },
+            py::arg("row"),
+            py::return_value_policy::copy)
+
+        // Property: offsets (read-only)
+        .def_property_readonly("offsets",
+            static_cast<ValueColumn<uint32_t> &(StringColumn<STR>::*)()>(
+                &StringColumn<STR>::get_offsets),
+            py::return_value_policy::reference_internal)
+        // Property: data (read-only)
+        .def_property_readonly("data",
+            static_cast<ValueColumn<uint8_t> &(StringColumn<STR>::*)()>(
+                &StringColumn<STR>::get_data),
+            py::return_value_policy::reference_internal);
+
+    // Class: WStrColumn
+    py::class_<StringColumn<WSTR>, Column>(m, "WStrColumn")
+
+        // Descriptor: __getitem__
+        .def("__getitem__",
+            [](const StringColumn<WSTR> &self, const size_t row)
+            {
+                if (row >= self.get_row_count())
+                    throw py::index_error("Row " + std::to_string(row) + " is out of range");
+                return self.get_value(row);
+            },
+            py::arg("row"),
+            py::return_value_policy::copy)
+
+        // Property: offsets (read-only)
+        .def_property_readonly("offsets",
+            static_cast<ValueColumn<uint32_t> &(StringColumn<WSTR>::*)()>(
+                &StringColumn<WSTR>::get_offsets),
+            py::return_value_policy::reference_internal)
+        // Property: data (read-only)
+        .def_property_readonly("data",
+            static_cast<ValueColumn<uint16_t> &(StringColumn<WSTR>::*)()>(
+                &StringColumn<WSTR>::get_data),
+            py::return_value_policy::reference_internal);
+
+    // Class: ColumnBatch
+    py::class_<ColumnBatch>(m, "ColumnBatch")
+
+        // Initializer
+        .def(py::init<const Record &>(),
+            py::arg("record"))
+
+        // Descriptor: __getitem__
+        .def("__getitem__",
+            [](const ColumnBatch &self, std::string key)
+            {
+                auto *column = self.get_column(key);
+                if (column)
+                    return column;
+                throw py::key_error("Column '" + key + "' does not exist");
+            },
+            py::arg("key"),
+            py::return_value_policy::reference_internal)
+        // Descriptor: __contains__
+        .def("__contains__",
+            [](const ColumnBatch &self, std::string key)
+            {
+                return self.get_column(key) != nullptr;
+            },
+            py::arg("key"),
+            py::return_value_policy::copy)
+        // Descriptor: __len__
+        .def("__len__", &ColumnBatch::get_row_count)
+
+        // Property: row_count (read-only)
+        .def_property_readonly("row_count", &ColumnBatch::get_row_count,
+            py::return_value_policy::copy)
+        // Property: column_names (read-only)
+        .def_property_readonly("column_names",
+            [](const ColumnBatch &self)
+            {
+                py::list column_names;
+                for (size_t i = 0; i < self.get_column_count(); ++i)
+                    column_names.append(self.get_column(i)->get_name());
+                return column_names;
+            })
+
+        // Method: clear()
+        .def("clear",
+            [](ColumnBatch &self)
+            {
+                check_resizable(self, "ColumnBatch");
+                self.clear();
+            })
+
+        // Extension: to_bytes()
+        .def("to_bytes",
+            [](ColumnBatch &self)
+            {
+                check_unlocked(self, "ColumnBatch");
+                std::string buffer;
+                {
+                    ColumnBatchLock lock(self);
+                    py::gil_scoped_release release;
+                    ByteWriter writer(buffer);
+                    self.write_to(writer);
+                }
+                return py::bytes(buffer);
+            },
+            py::return_value_policy::copy)
+        // Extension: from_bytes()
+        .def("from_bytes",
+            [](ColumnBatch &self, std::string data)
+            {
+                check_resizable(self, "ColumnBatch");
+                ColumnBatchLock lock(self);
+                py::gil_scoped_release release;
+                ByteReader reader(data.data(), data.size());
+                self.replace_from(reader);
+            },
+            py::arg("data"));
 }
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include <ki/dml/types.h>
+#include <ki/dml/exception.h>
+#include <ki/dml/FieldBase.h>
+#include <ki/dml/Field.h>
+
+namespace kipy
+{
+    /**
+     * Identifies the value type of a ki::dml::FieldBase, so that
+     * native code can dispatch on it without repeated is_type<>() checks.
+     */
+    enum class FieldType : uint8_t
+    {
+        BYT,
+        UBYT,
+        SHRT,
+        USHRT,
+        INT,
+        UINT,
+        STR,
+        WSTR,
+        FLT,
+        DBL,
+        GID,
+        UNKNOWN
+    };
+
+    inline FieldType get_field_type(const ki::dml::FieldBase &field)
+    {
+        using namespace ki::dml;
+
+        if (field.is_type<BYT>())
+            return FieldType::BYT;
+        if (field.is_type<UBYT>())
+            return FieldType::UBYT;
+        if (field.is_type<SHRT>())
+            return FieldType::SHRT;
+        if (field.is_type<USHRT>())
+            return FieldType::USHRT;
+        if (field.is_type<INT>())
+            return FieldType::INT;
+        if (field.is_type<UINT>())
+            return FieldType::UINT;
+        if (field.is_type<STR>())
+            return FieldType::STR;
+        if (field.is_type<WSTR>())
+            return FieldType::WSTR;
+        if (field.is_type<FLT>())
+            return FieldType::FLT;
+        if (field.is_type<DBL>())
+            return FieldType::DBL;
+        if (field.is_type<GID>())
+            return FieldType::GID;
+        return FieldType::UNKNOWN;
+    }
+
+    inline std::string get_field_type_name(const FieldType type)
+    {
+        switch (type)
+        {
+        case FieldType::BYT: return "BYT";
+        case FieldType::UBYT: return "UBYT";
+        case FieldType::SHRT: return "SHRT";
+        case FieldType::USHRT: return "USHRT";
+        case FieldType::INT: return "INT";
+        case FieldType::UINT: return "UINT";
+        case FieldType::STR: return "STR";
+        case FieldType::WSTR: return "WSTR";
+        case FieldType::FLT: return "FLT";
+        case FieldType::DBL: return "DBL";
+        case FieldType::GID: return "GID";
+        default: return "UNKNOWN";
+        }
+    }
+
+    /**
+     * Invokes visitor.template visit<ValueT>() with the value type
+     * identified by the given FieldType, and returns its result.
+     */
+    template <typename VisitorT>
+    auto visit_field_type(const FieldType type, VisitorT &visitor)
+        -> decltype(visitor.template visit<ki::dml::BYT>())
+    {
+        using namespace ki::dml;
+
+        switch (type)
+        {
+        case FieldType::BYT: return visitor.template visit<BYT>();
+        case FieldType::UBYT: return visitor.template visit<UBYT>();
+        case FieldType::SHRT: return visitor.template visit<SHRT>();
+        case FieldType::USHRT: return visitor.template visit<USHRT>();
+        case FieldType::INT: return visitor.template visit<INT>();
+        case FieldType::UINT: return visitor.template visit<UINT>();
+        case FieldType::STR: return visitor.template visit<STR>();
+        case FieldType::WSTR: return visitor.template visit<WSTR>();
+        case FieldType::FLT: return visitor.template visit<FLT>();
+        case FieldType::DBL: return visitor.template visit<DBL>();
+        case FieldType::GID: return visitor.template visit<GID>();
+        default:
+            throw ki::dml::value_error("Field has an unsupported value type.");
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <unordered_map>
+
+#include <pybind11/pybind11.h>
+
+#include <ki/protocol/exception.h>
+#include <ki/protocol/dml/Message.h>
+#include <ki/protocol/dml/MessageManager.h>
+
+#include "message_codec.h"
+
+/**
+ * Support code for the typed message bindings emitted by ki.codegen.
+ *
+ * A generated message is a plain struct with one member per
+ * transferable field, and the following static interface:
+ *   static constexpr uint8_t SERVICE_ID;
+ *   static constexpr uint8_t TYPE;
+ *   static constexpr const char *NAME;
+ *   size_t get_record_size() const;
+ *   void write_record(kipy::ByteWriter &writer) const;
+ *   void read_record(kipy::ByteReader &reader);
+ */
+namespace kipy
+{
+    namespace py = pybind11;
+
+    inline uint16_t get_message_key(const uint8_t service_id, const uint8_t type)
+    {
+        return static_cast<uint16_t>((service_id << 8) | type);
+    }
+
+    template <typename MessageT>
+    void read_message(ByteReader &reader, MessageT &message)
+    {
+        const auto header = read_message_header(reader);
+        if (header.service_id != MessageT::SERVICE_ID || header.type != MessageT::TYPE)
+            throw ki::protocol::value_error(
+                std::string("Data does not contain a ") + MessageT::NAME + " message.");
+
+        const size_t record_size = header.size - DMLMessageHeader::SIZE;
+        ByteReader record_reader(reader.read_bytes(record_size), record_size);
+        message.read_record(record_reader);
+    }
+
+    template <typename MessageT>
+    void write_message(ByteWriter &writer, const MessageT &message)
+    {
+        const auto record_size = message.get_record_size();
+        writer.reserve(DMLMessageHeader::SIZE + record_size);
+        write_message_header(writer, MessageT::SERVICE_ID, MessageT::TYPE, record_size);
+        message.write_record(writer);
+    }
+
+    /**
+     * Maps (service ID, message type) pairs to generated message
+     * classes, so that raw messages can be decoded straight into the
+     * correct typed representation.
+     */
+    class MessageRegistry
+    {
+    public:
+        typedef py::object (*MessageFactory)(ByteReader &reader);
+
+        template <typename MessageT>
+        void add_message()
+        {
+            m_factories[get_message_key(MessageT::SERVICE_ID, MessageT::TYPE)] =
+                [](ByteReader &reader) -> py::object
+                {
+                    MessageT message;
+                    read_message(reader, message);
+                    return py::cast(std::move(message));
+                };
+        }
+
+        py::object message_from_bytes(const std::string &data) const
+        {
+            ByteReader reader(data.data(), data.size());
+            const auto header = read_message_header(reader);
+            const auto it = m_factories.find(get_message_key(header.service_id, header.type));
+            if (it == m_factories.end())
+                return py::none();
+
+            reader.seek(0);
+            return it->second(reader);
+        }
+
+    private:
+        std::unordered_map<uint16_t, MessageFactory> m_factories;
+    };
+
+    template <typename MessageT>
+    py::class_<MessageT> bind_message(py::module &m, const char *name)
+    {
+        py::class_<MessageT> cls(m, name);
+        cls
+
+            // Initializer
+            .def(py::init<>())
+
+            // Property: size (read-only)
+            .def_property_readonly("size",
+                [](const MessageT &self)
+                {
+                    return DMLMessageHeader::SIZE + self.get_record_size();
+                },
+                py::return_value_policy::copy)
+
+            // Extension: to_bytes()
+            .def("to_bytes",
+                [](const MessageT &self)
+                {
+                    std::string buffer;
+                    ByteWriter writer(buffer);
+                    write_message(writer, self);
+                    return py::bytes(buffer);
+                },
+                py::return_value_policy::copy)
+            // Extension: from_bytes()
+            .def("from_bytes",
+                [](MessageT &self, std::string data)
+                {
+                    ByteReader reader(data.data(), data.size());
+                    read_message(reader, self);
+                },
+                py::arg("data"))
+
+            // Extension: to_message()
+            .def("to_message",
+                [](const MessageT &self, py::object manager)
+                {
+                    std::string buffer;
+                    ByteWriter writer(buffer);
+                    write_message(writer, self);
+
+                    // Decoded through the manager's own binding, which
+                    // locks its definitions.
+                    return manager.attr("message_from_bytes")(py::bytes(buffer));
+                },
+                py::arg("manager"))
+            // Extension: from_message()
+            .def("from_message",
+                [](MessageT &self, const ki::protocol::dml::Message &message)
+                {
+                    std::ostringstream oss;
+                    message.write_to(oss);
+
+                    const auto data = oss.str();
+                    ByteReader reader(data.data(), data.size());
+                    read_message(reader, self);
+                },
+                py::arg("message"));
+
+        cls.attr("SERVICE_ID") = py::int_(MessageT::SERVICE_ID);
+        cls.attr("TYPE") = py::int_(MessageT::TYPE);
+        cls.attr("NAME") = py::str(MessageT::NAME);
+        return cls;
+    }
+}
@@ -0,0 +1,241 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+
+#include <ki/dml/types.h>
+#include <ki/dml/exception.h>
+
+namespace kipy
+{
+    /**
+     * Reads DML values directly out of a contiguous buffer.
+     *
+     * This is used by the native fast paths that do not need a full
+     * ki::dml::Record to be constructed for every message they touch.
+     */
+    class ByteReader
+    {
+    public:
+        ByteReader(const char *data, const size_t size)
+            : m_data(data), m_size(size), m_position(0) {}
+
+        const char *get_data() const { return m_data; }
+        size_t get_size() const { return m_size; }
+        size_t get_position() const { return m_position; }
+        size_t get_remaining() const { return m_size - m_position; }
+        bool is_empty() const { return m_position >= m_size; }
+
+        void seek(const size_t position)
+        {
+            if (position > m_size)
+                throw ki::dml::parse_error("Attempted to seek past the end of the buffer.");
+            m_position = position;
+        }
+
+        const char *read_bytes(const size_t size)
+        {
+            if (size > get_remaining())
+                throw ki::dml::parse_error("Not enough data to read value.");
+            const char *data = m_data + m_position;
+            m_position += size;
+            return data;
+        }
+
+    private:
+        const char *m_data;
+        size_t m_size;
+        size_t m_position;
+    };
+
+    /**
+     * Appends DML values to a std::string.
+     */
+    class ByteWriter
+    {
+    public:
+        explicit ByteWriter(std::string &buffer)
+            : m_buffer(buffer) {}
+
+        std::string &get_buffer() const { return m_buffer; }
+        size_t get_size() const { return m_buffer.size(); }
+
+        void write_bytes(const char *data, const size_t size)
+        {
+            m_buffer.append(data, size);
+        }
+
+        void reserve(const size_t size)
+        {
+            m_buffer.reserve(m_buffer.size() + size);
+        }
+
+    private:
+        std::string &m_buffer;
+    };
+
+    /**
+     * A read-only std::streambuf over existing memory, for handing
+     * slices of a larger buffer to libki's stream-based readers
+     * without copying them.
+     */
+    class InputMemoryBuffer : public std::streambuf
+    {
+    public:
+        InputMemoryBuffer(const char *data, const size_t size)
+        {
+            auto *begin = const_cast<char *>(data);
+            setg(begin, begin, begin + size);
+        }
+    };
+
+    // All DML values are little-endian on the wire.
+    template <typename IntegerT>
+    typename std::enable_if<std::is_integral<IntegerT>::value, IntegerT>::type
+        load_le(const char *data)
+    {
+        typedef typename std::make_unsigned<IntegerT>::type UnsignedT;
+        UnsignedT value = 0;
+        for (size_t i = 0; i < sizeof(IntegerT); ++i)
+            value |= static_cast<UnsignedT>(static_cast<uint8_t>(data[i])) << (i * 8);
+        return static_cast<IntegerT>(value);
+    }
+
+    template <typename IntegerT>
+    typename std::enable_if<std::is_integral<IntegerT>::value>::type
+        store_le(char *data, const IntegerT value)
+    {
+        typedef typename std::make_unsigned<IntegerT>::type UnsignedT;
+        const auto unsigned_value = static_cast<UnsignedT>(value);
+        for (size_t i = 0; i < sizeof(IntegerT); ++i)
+            data[i] = static_cast<char>((unsigned_value >> (i * 8)) & 0xFF);
+    }
+
+    /* Value sizes */
+    template <typename ValueT>
+    typename std::enable_if<std::is_arithmetic<ValueT>::value, size_t>::type
+        get_value_size(const ValueT &)
+    {
+        return sizeof(ValueT);
+    }
+    inline size_t get_value_size(const ki::dml::STR &value)
+    {
+        return sizeof(uint16_t) + value.size();
+    }
+    inline size_t get_value_size(const ki::dml::WSTR &value)
+    {
+        return sizeof(uint16_t) + value.size() * sizeof(char16_t);
+    }
+
+    /* Integral values */
+    template <typename IntegerT>
+    typename std::enable_if<std::is_integral<IntegerT>::value>::type
+        write_value(ByteWriter &writer, const IntegerT value)
+    {
+        char data[sizeof(IntegerT)];
+        store_le(data, value);
+        writer.write_bytes(data, sizeof(IntegerT));
+    }
+    template <typename IntegerT>
+    typename std::enable_if<std::is_integral<IntegerT>::value>::type
+        read_value(ByteReader &reader, IntegerT &value)
+    {
+        value = load_le<IntegerT>(reader.read_bytes(sizeof(IntegerT)));
+    }
+
+    /* Floating point values */
+    inline void write_value(ByteWriter &writer, const ki::dml::FLT value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        write_value(writer, bits);
+    }
+    inline void read_value(ByteReader &reader, ki::dml::FLT &value)
+    {
+        uint32_t bits;
+        read_value(reader, bits);
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+    inline void write_value(ByteWriter &writer, const ki::dml::DBL value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        write_value(writer, bits);
+    }
+    inline void read_value(ByteReader &reader, ki::dml::DBL &value)
+    {
+        uint64_t bits;
+        read_value(reader, bits);
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+
+    /* String values (length-prefixed) */
+    inline void write_value(ByteWriter &writer, const ki::dml::STR &value)
+    {
+        if (value.size() > UINT16_MAX)
+            throw ki::dml::value_error("STR value exceeds the maximum length.");
+        write_value(writer, static_cast<uint16_t>(value.size()));
+        writer.write_bytes(value.data(), value.size());
+    }
+    inline void read_value(ByteReader &reader, ki::dml::STR &value)
+    {
+        uint16_t length;
+        read_value(reader, length);
+        value.assign(reader.read_bytes(length), length);
+    }
+    inline void write_value(ByteWriter &writer, const ki::dml::WSTR &value)
+    {
+        if (value.size() > UINT16_MAX)
+            throw ki::dml::value_error("WSTR value exceeds the maximum length.");
+        write_value(writer, static_cast<uint16_t>(value.size()));
+        for (const auto c : value)
+            write_value(writer, static_cast<uint16_t>(c));
+    }
+    inline void read_value(ByteReader &reader, ki::dml::WSTR &value)
+    {
+        uint16_t length;
+        read_value(reader, length);
+        const char *data = reader.read_bytes(length * sizeof(char16_t));
+        value.resize(length);
+        for (uint16_t i = 0; i < length; ++i)
+            value[i] = static_cast<char16_t>(load_le<uint16_t>(data + i * sizeof(char16_t)));
+    }
+
+    /**
+     * Every DML message is prefixed with a header containing the
+     * service ID (UBYT), the message type (UBYT), and the message
+     * size (USHRT). The message size includes the header itself.
+     */
+    struct DMLMessageHeader
+    {
+        static const size_t SIZE = 4;
+
+        uint8_t service_id;
+        uint8_t type;
+        uint16_t size;
+    };
+
+    inline DMLMessageHeader read_message_header(ByteReader &reader)
+    {
+        DMLMessageHeader header;
+        read_value(reader, header.service_id);
+        read_value(reader, header.type);
+        read_value(reader, header.size);
+        if (header.size < DMLMessageHeader::SIZE)
+            throw ki::dml::parse_error("DML message size is smaller than its header.");
+        return header;
+    }
+
+    inline void write_message_header(ByteWriter &writer,
+        const uint8_t service_id, const uint8_t type, const size_t record_size)
+    {
+        const size_t message_size = DMLMessageHeader::SIZE + record_size;
+        if (message_size > UINT16_MAX)
+            throw ki::dml::value_error("DML message exceeds the maximum message size.");
+        write_value(writer, service_id);
+        write_value(writer, type);
+        write_value(writer, static_cast<uint16_t>(message_size));
+    }
+}
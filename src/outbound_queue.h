@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace kipy
+{
+    /**
+     * A bounded, lock-free, multi-producer single-consumer queue of
+     * outgoing frames, each addressed to a session ID and generation.
+     *
+     * Session IDs are reused once a session closes, so the generation
+     * tells the consumer whether the frame is still meant for the
+     * session that now holds the ID.
+     *
+     * Any thread may push(); only the thread that owns the sessions
+     * (the event loop) may drain. The queue also tracks whether a drain
+     * has been scheduled, so that producers only need to wake the
+     * consumer once per batch rather than once per frame.
+     *
+     * This is Dmitry Vyukov's intrusive MPSC queue: producers swap
+     * themselves in as the new head with a single atomic exchange, and
+     * the consumer follows the next pointers from the tail.
+     */
+    class OutboundQueue
+    {
+    public:
+        enum class PushResult
+        {
+            // Queued; a drain is already scheduled.
+            QUEUED,
+            // Queued; the caller must schedule a drain.
+            SCHEDULE_DRAIN,
+            // The queue is full, and the frame was dropped.
+            FULL
+        };
+
+        explicit OutboundQueue(const size_t capacity)
+            : m_head(&m_stub), m_tail(&m_stub), m_capacity(capacity),
+              m_size(0), m_drain_scheduled(false)
+        {
+            m_stub.next.store(nullptr, std::memory_order_relaxed);
+        }
+
+        OutboundQueue(const OutboundQueue &) = delete;
+        OutboundQueue &operator=(const OutboundQueue &) = delete;
+
+        ~OutboundQueue()
+        {
+            while (auto *node = pop())
+                delete node;
+        }
+
+        size_t get_capacity() const { return m_capacity; }
+        size_t get_size() const { return m_size.load(std::memory_order_relaxed); }
+
+        /**
+         * Queues a frame for the given session. Safe to call from any
+         * thread.
+         */
+        PushResult push(const uint16_t session_id, const uint32_t generation,
+            const char *data, const size_t size)
+        {
+            return push(session_id, generation, std::string(data, size));
+        }
+
+        PushResult push(const uint16_t session_id, const uint32_t generation,
+            std::string &&data)
+        {
+            // Sequentially consistent, along with the exchange below, so
+            // that finish_drain() can not miss this frame while we see
+            // its drain as still scheduled.
+            if (m_size.fetch_add(1, std::memory_order_seq_cst) >= m_capacity)
+            {
+                m_size.fetch_sub(1, std::memory_order_relaxed);
+                return PushResult::FULL;
+            }
+
+            auto *node = new Node(session_id, generation, std::move(data));
+            push(node);
+
+            if (m_drain_scheduled.exchange(true, std::memory_order_seq_cst))
+                return PushResult::QUEUED;
+            return PushResult::SCHEDULE_DRAIN;
+        }
+
+        /**
+         * Hands up to `max_count` queued frames, in order, to
+         * `sink(uint16_t session_id, uint32_t generation, std::string &&data)`.
+         * Consumer only.
+         * Returns the number of frames drained.
+         */
+        template <typename SinkT>
+        size_t drain(SinkT &&sink, const size_t max_count)
+        {
+            size_t count = 0;
+            while (count < max_count)
+            {
+                auto *node = pop();
+                if (!node)
+                    break;
+
+                m_size.fetch_sub(1, std::memory_order_relaxed);
+                const auto session_id = node->session_id;
+                const auto generation = node->generation;
+                std::string data(std::move(node->data));
+                delete node;
+
+                sink(session_id, generation, std::move(data));
+                ++count;
+            }
+            return count;
+        }
+
+        /**
+         * Marks the current drain as finished. Consumer only.
+         *
+         * Returns true if frames are still queued, in which case the
+         * consumer keeps responsibility for draining them and must
+         * schedule another drain.
+         */
+        bool finish_drain()
+        {
+            m_drain_scheduled.store(false, std::memory_order_seq_cst);
+
+            // A producer may have pushed after our last pop, but seen the
+            // drain as already scheduled. Take the drain back if so.
+            if (m_size.load(std::memory_order_seq_cst) == 0)
+                return false;
+            return !m_drain_scheduled.exchange(true, std::memory_order_acq_rel);
+        }
+
+    private:
+        struct Node
+        {
+            Node() : session_id(0), generation(0) {}
+            Node(const uint16_t session_id, const uint32_t generation, std::string &&data)
+                : session_id(session_id), generation(generation), data(std::move(data)) {}
+
+            std::atomic<Node *> next;
+            uint16_t session_id;
+            uint32_t generation;
+            std::string data;
+        };
+
+        std::atomic<Node *> m_head;
+        Node *m_tail;
+        Node m_stub;
+
+        size_t m_capacity;
+        std::atomic<size_t> m_size;
+        std::atomic<bool> m_drain_scheduled;
+
+        void push(Node *node)
+        {
+            node->next.store(nullptr, std::memory_order_relaxed);
+            auto *previous = m_head.exchange(node, std::memory_order_acq_rel);
+            previous->next.store(node, std::memory_order_release);
+        }
+
+        /**
+         * Returns the oldest node, or nullptr if the queue is empty, or
+         * a producer is midway through a push (the frame will be picked
+         * up by the next drain).
+         */
+        Node *pop()
+        {
+            auto *tail = m_tail;
+            auto *next = tail->next.load(std::memory_order_acquire);
+            if (tail == &m_stub)
+            {
+                if (!next)
+                    return nullptr;
+                m_tail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next)
+            {
+                m_tail = next;
+                return tail;
+            }
+
+            if (tail != m_head.load(std::memory_order_acquire))
+                return nullptr;
+
+            // The tail is the last node; put the stub behind it so that
+            // it can be taken.
+            push(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next)
+            {
+                m_tail = next;
+                return tail;
+            }
+            return nullptr;
+        }
+    };
+}
@@ -0,0 +1,453 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <ki/protocol/dml/Message.h>
+#include <ki/protocol/dml/MessageManager.h>
+
+#include "message_codec.h"
+
+namespace kipy
+{
+    /**
+     * A minimal reader/writer lock (std::shared_mutex is C++17).
+     *
+     * Writers are preferred, but a thread that already holds the lock
+     * shared may take it shared again without waiting for them (they
+     * are waiting for it); it may not take it exclusively.
+     */
+    class SharedMutex
+    {
+    public:
+        SharedMutex()
+            : m_readers(0), m_writer(false) {}
+
+        void lock_shared()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!is_held_shared())
+                m_condition.wait(lock, [this] { return !m_writer; });
+            ++m_readers;
+            get_held_shared().push_back(this);
+        }
+
+        bool try_lock_shared()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_writer && !is_held_shared())
+                return false;
+            ++m_readers;
+            get_held_shared().push_back(this);
+            return true;
+        }
+
+        void unlock_shared()
+        {
+            auto &held = get_held_shared();
+            held.erase(std::find(held.rbegin(), held.rend(), this).base() - 1);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_readers == 0)
+                m_condition.notify_all();
+        }
+
+        void lock()
+        {
+            if (is_held_shared())
+                throw std::logic_error("Definitions can not be modified while they are being read.");
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return !m_writer; });
+            m_writer = true;
+            m_condition.wait(lock, [this] { return m_readers == 0; });
+        }
+
+        void unlock()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_writer = false;
+            m_condition.notify_all();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        size_t m_readers;
+        bool m_writer;
+
+        // The mutexes that the calling thread holds shared, once per lock.
+        static std::vector<const SharedMutex *> &get_held_shared()
+        {
+            static thread_local std::vector<const SharedMutex *> held;
+            return held;
+        }
+
+        bool is_held_shared() const
+        {
+            const auto &held = get_held_shared();
+            return std::find(held.begin(), held.end(), this) != held.end();
+        }
+    };
+
+    class SharedLockGuard
+    {
+    public:
+        explicit SharedLockGuard(SharedMutex &mutex)
+            : m_mutex(mutex) { m_mutex.lock_shared(); }
+        ~SharedLockGuard() { m_mutex.unlock_shared(); }
+
+        SharedLockGuard(const SharedLockGuard &) = delete;
+        SharedLockGuard &operator=(const SharedLockGuard &) = delete;
+
+    private:
+        SharedMutex &m_mutex;
+    };
+
+    namespace detail
+    {
+        struct DefinitionsMutexTable
+        {
+            std::mutex mutex;
+            std::unordered_map<const ki::protocol::dml::MessageManager *,
+                std::unique_ptr<SharedMutex>> mutexes;
+        };
+
+        inline DefinitionsMutexTable &get_definitions_mutex_table()
+        {
+            static DefinitionsMutexTable table;
+            return table;
+        }
+    }
+
+    /**
+     * Guards the message definitions of a MessageManager.
+     *
+     * Looking messages up (to create or decode them) is read-only, and
+     * may happen on several threads at once while this is held shared.
+     * Loading a module mutates the manager, so it must hold this
+     * exclusively.
+     */
+    inline SharedMutex &get_definitions_mutex(const ki::protocol::dml::MessageManager &manager)
+    {
+        auto &table = detail::get_definitions_mutex_table();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        auto &mutex = table.mutexes[&manager];
+        if (!mutex)
+            mutex.reset(new SharedMutex());
+        return *mutex;
+    }
+
+    /**
+     * Deletes a MessageManager along with its definitions mutex.
+     */
+    struct MessageManagerDeleter
+    {
+        void operator()(ki::protocol::dml::MessageManager *manager) const
+        {
+            auto &table = detail::get_definitions_mutex_table();
+            {
+                std::lock_guard<std::mutex> lock(table.mutex);
+                table.mutexes.erase(manager);
+            }
+            delete manager;
+        }
+    };
+
+    /**
+     * Lets a DML session hold its manager's definitions mutex shared
+     * while it decodes a message, and release it while the message is
+     * being handled (so that handlers may load modules).
+     */
+    class DefinitionsReader
+    {
+    public:
+        explicit DefinitionsReader(const ki::protocol::dml::MessageManager &manager)
+            : m_definitions_mutex(get_definitions_mutex(manager)), m_reading(false) {}
+
+    protected:
+        class ReadGuard
+        {
+        public:
+            explicit ReadGuard(DefinitionsReader &reader)
+                : m_reader(reader)
+            {
+                m_reader.m_definitions_mutex.lock_shared();
+                m_reader.m_reading = true;
+            }
+            ~ReadGuard()
+            {
+                m_reader.m_reading = false;
+                m_reader.m_definitions_mutex.unlock_shared();
+            }
+
+            ReadGuard(const ReadGuard &) = delete;
+            ReadGuard &operator=(const ReadGuard &) = delete;
+
+        private:
+            DefinitionsReader &m_reader;
+        };
+
+        class ReleaseGuard
+        {
+        public:
+            explicit ReleaseGuard(DefinitionsReader &reader)
+                : m_reader(reader), m_released(reader.m_reading)
+            {
+                if (m_released)
+                    m_reader.m_definitions_mutex.unlock_shared();
+            }
+            ~ReleaseGuard()
+            {
+                if (m_released)
+                    m_reader.m_definitions_mutex.lock_shared();
+            }
+
+            ReleaseGuard(const ReleaseGuard &) = delete;
+            ReleaseGuard &operator=(const ReleaseGuard &) = delete;
+
+        private:
+            DefinitionsReader &m_reader;
+            bool m_released;
+        };
+
+    private:
+        SharedMutex &m_definitions_mutex;
+        bool m_reading;
+    };
+
+    /**
+     * A set of worker threads, started as they are first needed and
+     * kept for the life of the module, that run batches of indexed
+     * tasks.
+     *
+     * The thread that submits a batch works on it too, so a batch always
+     * finishes, even if no worker could be started or every worker is
+     * busy with another batch.
+     */
+    class TaskPool
+    {
+    public:
+        static const size_t MAX_THREADS = 64;
+
+        static TaskPool &get_instance()
+        {
+            static TaskPool pool;
+            return pool;
+        }
+
+        TaskPool(const TaskPool &) = delete;
+        TaskPool &operator=(const TaskPool &) = delete;
+
+        ~TaskPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_condition.notify_all();
+            for (auto &thread : m_threads)
+                thread.join();
+        }
+
+        /**
+         * Calls `task(i)` for every i in [0, count), spread across the
+         * calling thread and up to `thread_count - 1` workers, and
+         * returns once every call has returned. Tasks must not throw.
+         */
+        void run(const size_t count, const unsigned int thread_count,
+            std::function<void(size_t)> task)
+        {
+            Batch batch(count, std::move(task));
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (thread_count > 1 && count > 1)
+            {
+                start_threads(std::min<size_t>(thread_count, count) - 1);
+                m_batches.push_back(&batch);
+                m_condition.notify_all();
+            }
+
+            work_on(batch, lock);
+
+            // Workers only look at batches that are queued, so once it
+            // is removed, the batch is ours again when its last task is.
+            const auto it = std::find(m_batches.begin(), m_batches.end(), &batch);
+            if (it != m_batches.end())
+                m_batches.erase(it);
+            batch.done.wait(lock, [&batch] { return batch.finished == batch.count; });
+        }
+
+    private:
+        struct Batch
+        {
+            Batch(const size_t count, std::function<void(size_t)> task)
+                : count(count), task(std::move(task)), next(0), finished(0) {}
+
+            size_t count;
+            std::function<void(size_t)> task;
+            // Both guarded by the pool's mutex.
+            size_t next;
+            size_t finished;
+            std::condition_variable done;
+        };
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::deque<Batch *> m_batches;
+        std::vector<std::thread> m_threads;
+        bool m_stopping;
+
+        TaskPool() : m_stopping(false) {}
+
+        /**
+         * Starts workers until there are `count` of them (within
+         * MAX_THREADS), or the system refuses to start more.
+         */
+        void start_threads(size_t count)
+        {
+            count = std::min(count, static_cast<size_t>(MAX_THREADS));
+            try
+            {
+                while (m_threads.size() < count)
+                    m_threads.emplace_back(&TaskPool::work, this);
+            }
+            catch (const std::system_error &)
+            {
+                // Make do with the workers there are.
+            }
+        }
+
+        /**
+         * Runs the batch's unclaimed tasks; `lock` must hold m_mutex,
+         * and holds it again on return.
+         */
+        void work_on(Batch &batch, std::unique_lock<std::mutex> &lock)
+        {
+            while (batch.next < batch.count)
+            {
+                const auto index = batch.next++;
+                lock.unlock();
+                batch.task(index);
+                lock.lock();
+                if (++batch.finished == batch.count)
+                    batch.done.notify_all();
+            }
+        }
+
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                m_condition.wait(lock, [this] { return m_stopping || !m_batches.empty(); });
+                if (m_stopping)
+                    return;
+
+                auto *batch = m_batches.front();
+                if (batch->next == batch->count)
+                    m_batches.pop_front();
+                else
+                    work_on(*batch, lock);
+            }
+        }
+    };
+
+    /**
+     * Returns the (offset, size) of every DML message in the given
+     * buffer, by walking the message headers.
+     */
+    inline std::vector<std::pair<size_t, size_t>> split_messages(
+        const char *data, const size_t size)
+    {
+        std::vector<std::pair<size_t, size_t>> messages;
+        ByteReader reader(data, size);
+        while (!reader.is_empty())
+        {
+            const auto offset = reader.get_position();
+            const auto header = read_message_header(reader);
+            reader.seek(offset);
+            reader.read_bytes(header.size);
+            messages.emplace_back(offset, header.size);
+        }
+        return messages;
+    }
+
+    /**
+     * Decodes every DML message in the given buffer, splitting the work
+     * across up to `thread_count` threads (0 uses one per core) of the
+     * module's TaskPool.
+     *
+     * The returned messages are in the same order as they appear in
+     * the buffer; messages that the manager could not decode are
+     * returned as nullptr. The caller takes ownership of the messages.
+     */
+    inline std::vector<ki::protocol::dml::Message *> decode_messages(
+        ki::protocol::dml::MessageManager &manager,
+        const char *data, const size_t size, unsigned int thread_count)
+    {
+        const auto messages = split_messages(data, size);
+        std::vector<ki::protocol::dml::Message *> results(messages.size(), nullptr);
+        if (messages.empty())
+            return results;
+
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        thread_count = static_cast<unsigned int>(
+            std::min<size_t>(thread_count, messages.size()));
+
+        // Give each thread a contiguous range of messages covering
+        // roughly the same number of bytes.
+        std::vector<size_t> boundaries = { 0 };
+        const auto bytes_per_thread = size / thread_count;
+        for (size_t i = 0; i < messages.size() && boundaries.size() < thread_count; ++i)
+        {
+            if (messages[i].first >= bytes_per_thread * boundaries.size() && i > boundaries.back())
+                boundaries.push_back(i);
+        }
+        boundaries.push_back(messages.size());
+
+        SharedLockGuard guard(get_definitions_mutex(manager));
+        std::vector<std::exception_ptr> errors(boundaries.size() - 1);
+        const auto decode_range = [&](const size_t range)
+        {
+            try
+            {
+                for (auto i = boundaries[range]; i < boundaries[range + 1]; ++i)
+                {
+                    InputMemoryBuffer buffer(data + messages[i].first, messages[i].second);
+                    std::istream istream(&buffer);
+                    results[i] = manager.message_from_binary(istream);
+                }
+            }
+            catch (...)
+            {
+                errors[range] = std::current_exception();
+            }
+        };
+
+        TaskPool::get_instance().run(boundaries.size() - 1, thread_count, decode_range);
+
+        for (const auto &error : errors)
+        {
+            if (!error)
+                continue;
+
+            for (auto *message : results)
+                delete message;
+            std::rethrow_exception(error);
+        }
+        return results;
+    }
+}
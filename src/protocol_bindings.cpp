@@ -1,7 +1,11 @@
 #include <string>
+#include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <vector>
 
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
 #include <ki/dml/types.h>
 #include <ki/dml/Record.h>
@@ -23,6 +27,18 @@
 #include <ki/protocol/control/ClientKeepAlive.h>
 #include <ki/protocol/control/SessionAccept.h>
 
+#include "record_columns.h"
+#include "parallel_decode.h"
+#include "receive_buffer.h"
+#include "session_slab.h"
+#include "compression.h"
+#include "record_delta.h"
+#include "outbound_queue.h"
+#include "session_group.h"
+#include "zerocopy_sender.h"
+#include "rtt_estimator.h"
+#include "trace.h"
+
 // Disable inheritance via dominance warning
 #if _MSC_VER
 #pragma warning(disable: 4250)
@@ -55,7 +71,12 @@
 
 namespace py = pybind11;
 
-class PySession : public ki::protocol::net::Session
+// Server and client sessions time their own keep alive requests.
+const uint8_t KEEP_ALIVE_OPCODE = static_cast<uint8_t>(ki::protocol::control::Opcode::KEEP_ALIVE);
+const uint8_t KEEP_ALIVE_RSP_OPCODE = static_cast<uint8_t>(ki::protocol::control::Opcode::KEEP_ALIVE_RSP);
+
+class PySession : public ki::protocol::net::Session,
+    public kipy::SlabAllocated<PySession>
 {
 public:
     PySession(const uint16_t id)
@@ -68,61 +89,79 @@ public:
     }
     void on_invalid_packet() override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_PACKET, get_id(), 0);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::Session,
             on_invalid_packet, );
     }
     void on_control_message(const ki::protocol::net::PacketHeader &header) override
     {
+        kipy::trace_packet(kipy::TraceEventType::CONTROL_RECEIVED, get_id(), true, header.get_opcode());
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::Session,
             on_control_message, header);
     }
     void on_application_message(const ki::protocol::net::PacketHeader &header) override
     {
+        kipy::trace_packet(kipy::TraceEventType::APPLICATION_RECEIVED, get_id(), false, header.get_opcode());
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::Session,
             on_application_message, header);
     }
     void send_packet_data(const char *data, const size_t size) override
     {
+        kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, get_id(), data, size);
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::Session,
             send_packet_data, py::bytes(data, size), size);
     }
     void close(ki::protocol::net::SessionCloseErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::CLOSED, get_id(), static_cast<uint32_t>(error));
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::Session,
             close, error);
     }
 };
 
-class PyServerSession : public ki::protocol::net::ServerSession
+class PyServerSession : public ki::protocol::net::ServerSession,
+    public kipy::LatencyTracked, public kipy::SlabAllocated<PyServerSession>
 {
 public:
     PyServerSession(const uint16_t id)
         : Session(id), ServerSession(id) {}
     void on_invalid_packet() override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_PACKET, get_id(), 0);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ServerSession,
             on_invalid_packet, );
     }
+    void on_control_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        kipy::trace_packet(kipy::TraceEventType::CONTROL_RECEIVED, get_id(), true, header.get_opcode());
+        ki::protocol::net::ServerSession::on_control_message(header);
+        if (header.get_opcode() == KEEP_ALIVE_RSP_OPCODE)
+            on_keep_alive_response();
+    }
     void on_application_message(const ki::protocol::net::PacketHeader &header) override
     {
+        kipy::trace_packet(kipy::TraceEventType::APPLICATION_RECEIVED, get_id(), false, header.get_opcode());
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ServerSession,
             on_application_message, header);
     }
     void send_packet_data(const char *data, const size_t size) override
     {
+        kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, get_id(), data, size);
+        on_frame_sent(data, size, KEEP_ALIVE_OPCODE);
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ServerSession,
             send_packet_data, py::bytes(data, size), size);
     }
     void close(ki::protocol::net::SessionCloseErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::CLOSED, get_id(), static_cast<uint32_t>(error));
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ServerSession,
             close, error);
@@ -135,31 +174,44 @@ public:
     }
 };
 
-class PyClientSession : public ki::protocol::net::ClientSession
+class PyClientSession : public ki::protocol::net::ClientSession,
+    public kipy::LatencyTracked, public kipy::SlabAllocated<PyClientSession>
 {
 public:
     PyClientSession(const uint16_t id)
         : Session(id), ClientSession(id) {}
     void on_invalid_packet() override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_PACKET, get_id(), 0);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ClientSession,
             on_invalid_packet, );
     }
+    void on_control_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        kipy::trace_packet(kipy::TraceEventType::CONTROL_RECEIVED, get_id(), true, header.get_opcode());
+        ki::protocol::net::ClientSession::on_control_message(header);
+        if (header.get_opcode() == KEEP_ALIVE_RSP_OPCODE)
+            on_keep_alive_response();
+    }
     void on_application_message(const ki::protocol::net::PacketHeader &header) override
     {
+        kipy::trace_packet(kipy::TraceEventType::APPLICATION_RECEIVED, get_id(), false, header.get_opcode());
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ClientSession,
             on_application_message, header);
     }
     void send_packet_data(const char *data, const size_t size) override
     {
+        kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, get_id(), data, size);
+        on_frame_sent(data, size, KEEP_ALIVE_OPCODE);
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ClientSession,
             send_packet_data, py::bytes(data, size), size);
     }
     void close(ki::protocol::net::SessionCloseErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::CLOSED, get_id(), static_cast<uint32_t>(error));
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ClientSession,
             close, error);
@@ -172,11 +224,12 @@ public:
     }
 };
 
-class PyDMLSession : public ki::protocol::net::DMLSession
+class PyDMLSession : public ki::protocol::net::DMLSession,
+    public kipy::DefinitionsReader, public kipy::SlabAllocated<PyDMLSession>
 {
 public:
     PyDMLSession(const uint16_t id, const ki::protocol::dml::MessageManager &manager)
-        : Session(id), DMLSession(id, manager) {}
+        : Session(id), DMLSession(id, manager), DefinitionsReader(manager) {}
     bool is_alive() const override
     {
         PYBIND11_OVERLOAD_PURE(
@@ -185,61 +238,88 @@ public:
     }
     void on_invalid_packet() override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_PACKET, get_id(), 0);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::DMLSession,
             on_invalid_packet, );
     }
     void on_control_message(const ki::protocol::net::PacketHeader &header) override
     {
+        kipy::trace_packet(kipy::TraceEventType::CONTROL_RECEIVED, get_id(), true, header.get_opcode());
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::DMLSession,
             on_control_message, header);
     }
     void send_packet_data(const char *data, const size_t size) override
     {
+        kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, get_id(), data, size);
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::DMLSession,
             send_packet_data, py::bytes(data, size), size);
     }
     void close(ki::protocol::net::SessionCloseErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::CLOSED, get_id(), static_cast<uint32_t>(error));
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::DMLSession,
             close, error);
     }
+    void on_application_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        // Decoding looks the message's template up.
+        ReadGuard guard(*this);
+        ki::protocol::net::DMLSession::on_application_message(header);
+    }
     void on_message(const ki::protocol::dml::Message *message) override
     {
+        kipy::trace_message(get_id(), message->get_service_id(), message->get_type());
+        ReleaseGuard release(*this);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::DMLSession,
             on_message, message);
     }
     void on_invalid_message(ki::protocol::net::InvalidDMLMessageErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_MESSAGE, get_id(), static_cast<uint32_t>(error));
+        ReleaseGuard release(*this);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::DMLSession,
             on_invalid_message, error);
     }
 };
 
-class PyServerDMLSession : public ki::protocol::net::ServerDMLSession
+class PyServerDMLSession : public ki::protocol::net::ServerDMLSession,
+    public kipy::LatencyTracked, public kipy::DefinitionsReader,
+    public kipy::SlabAllocated<PyServerDMLSession>
 {
 public:
     PyServerDMLSession(const uint16_t id, const ki::protocol::dml::MessageManager &manager)
-        : Session(id), ServerDMLSession(id, manager) {}
+        : Session(id), ServerDMLSession(id, manager), DefinitionsReader(manager) {}
     void on_invalid_packet() override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_PACKET, get_id(), 0);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ServerDMLSession,
             on_invalid_packet, );
     }
+    void on_control_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        kipy::trace_packet(kipy::TraceEventType::CONTROL_RECEIVED, get_id(), true, header.get_opcode());
+        ki::protocol::net::ServerDMLSession::on_control_message(header);
+        if (header.get_opcode() == KEEP_ALIVE_RSP_OPCODE)
+            on_keep_alive_response();
+    }
     void send_packet_data(const char *data, const size_t size) override
     {
+        kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, get_id(), data, size);
+        on_frame_sent(data, size, KEEP_ALIVE_OPCODE);
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ServerDMLSession,
             send_packet_data, py::bytes(data, size), size);
     }
     void close(ki::protocol::net::SessionCloseErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::CLOSED, get_id(), static_cast<uint32_t>(error));
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ServerDMLSession,
             close, error);
@@ -250,39 +330,62 @@ public:
             void, ki::protocol::net::ServerDMLSession,
             on_established, );
     }
+    void on_application_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        // Decoding looks the message's template up.
+        ReadGuard guard(*this);
+        ki::protocol::net::ServerDMLSession::on_application_message(header);
+    }
     void on_message(const ki::protocol::dml::Message *message) override
     {
+        kipy::trace_message(get_id(), message->get_service_id(), message->get_type());
+        ReleaseGuard release(*this);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ServerDMLSession,
             on_message, message);
     }
     void on_invalid_message(ki::protocol::net::InvalidDMLMessageErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_MESSAGE, get_id(), static_cast<uint32_t>(error));
+        ReleaseGuard release(*this);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ServerDMLSession,
             on_invalid_message, error);
     }
 };
 
-class PyClientDMLSession : public ki::protocol::net::ClientDMLSession
+class PyClientDMLSession : public ki::protocol::net::ClientDMLSession,
+    public kipy::LatencyTracked, public kipy::DefinitionsReader,
+    public kipy::SlabAllocated<PyClientDMLSession>
 {
 public:
     PyClientDMLSession(const uint16_t id, const ki::protocol::dml::MessageManager &manager)
-        : Session(id), ClientDMLSession(id, manager) {}
+        : Session(id), ClientDMLSession(id, manager), DefinitionsReader(manager) {}
     void on_invalid_packet() override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_PACKET, get_id(), 0);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ClientDMLSession,
             on_invalid_packet, );
     }
+    void on_control_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        kipy::trace_packet(kipy::TraceEventType::CONTROL_RECEIVED, get_id(), true, header.get_opcode());
+        ki::protocol::net::ClientDMLSession::on_control_message(header);
+        if (header.get_opcode() == KEEP_ALIVE_RSP_OPCODE)
+            on_keep_alive_response();
+    }
     void send_packet_data(const char *data, const size_t size) override
     {
+        kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, get_id(), data, size);
+        on_frame_sent(data, size, KEEP_ALIVE_OPCODE);
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ClientDMLSession,
             send_packet_data, py::bytes(data, size), size);
     }
     void close(ki::protocol::net::SessionCloseErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::CLOSED, get_id(), static_cast<uint32_t>(error));
         PYBIND11_OVERLOAD_PURE(
             void, ki::protocol::net::ClientDMLSession,
             close, error);
@@ -293,14 +396,24 @@ public:
             void, ki::protocol::net::ClientDMLSession,
             on_established, );
     }
+    void on_application_message(const ki::protocol::net::PacketHeader &header) override
+    {
+        // Decoding looks the message's template up.
+        ReadGuard guard(*this);
+        ki::protocol::net::ClientDMLSession::on_application_message(header);
+    }
     void on_message(const ki::protocol::dml::Message *message) override
     {
+        kipy::trace_message(get_id(), message->get_service_id(), message->get_type());
+        ReleaseGuard release(*this);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ClientDMLSession,
             on_message, message);
     }
     void on_invalid_message(ki::protocol::net::InvalidDMLMessageErrorCode error) override
     {
+        kipy::trace_error(kipy::TraceEventType::INVALID_MESSAGE, get_id(), static_cast<uint32_t>(error));
+        ReleaseGuard release(*this);
         PYBIND11_OVERLOAD(
             void, ki::protocol::net::ClientDMLSession,
             on_invalid_message, error);
@@ -339,6 +452,144 @@ public:
     using ki::protocol::net::DMLSession::on_invalid_message;
 };
 
+kipy::LatencyTracked &get_latency_tracked(ki::protocol::net::Session &session)
+{
+    auto *tracked = dynamic_cast<kipy::LatencyTracked *>(&session);
+    if (!tracked)
+        throw py::type_error("Session does not track its round-trip time.");
+    return *tracked;
+}
+
+double to_milliseconds(const double microseconds)
+{
+    return microseconds / 1000.0;
+}
+
+/**
+ * Sends a complete frame to every member of a group that is still
+ * registered, and returns the number of sessions it was sent to.
+ *
+ * Members with a writer are all handed the same bytes object (and traced
+ * here, as their frames skip the session); the rest go through
+ * Session::send_packet_data(). A member that fails to send does not stop
+ * the others: it is closed with APPLICATION_ERROR once every member has
+ * been sent to, and is left out of the count.
+ */
+size_t send_to_group(const kipy::SessionGroup &group, const std::string &frame)
+{
+    const auto *registry = group.get_registry();
+    if (!registry)
+        throw ki::protocol::runtime_error("Session group has no registry to send through.");
+
+    py::object frame_bytes;
+    std::vector<uint16_t> failed;
+    size_t sent = 0;
+    group.for_each([&](const uint16_t session_id)
+        {
+            auto *session = registry->get(session_id);
+            if (!session)
+                return;
+
+            try
+            {
+                const auto &writer = registry->get_writer(session_id);
+                if (writer)
+                {
+                    if (!frame_bytes)
+                        frame_bytes = py::bytes(frame);
+                    kipy::trace_frame(kipy::TraceEventType::FRAME_SENT,
+                        session_id, frame.data(), frame.size());
+                    writer(frame_bytes);
+                }
+                else
+                    (session->*&PublicistSession::send_packet_data)(frame.data(), frame.size());
+                ++sent;
+            }
+            catch (const py::error_already_set &)
+            {
+                failed.push_back(session_id);
+            }
+        });
+
+    // Closing a session takes it out of its groups, so this waits until
+    // the group is no longer being walked.
+    for (const auto session_id : failed)
+    {
+        auto *session = registry->get(session_id);
+        if (session)
+            session->close(ki::protocol::net::SessionCloseErrorCode::APPLICATION_ERROR);
+    }
+    return sent;
+}
+
+/**
+ * Returns a complete frame for a DML message, as DMLSession::send_message()
+ * would send it.
+ */
+std::string build_message_frame(const ki::protocol::dml::Message &message)
+{
+    std::ostringstream oss;
+    ki::protocol::net::PacketHeader(false, 0).write_to(oss);
+    message.write_to(oss);
+    const auto packet = oss.str();
+    if (packet.size() > kipy::ReceiveBuffer::MAX_PACKET_SIZE)
+        throw ki::protocol::value_error("Message is too large to be sent in a single frame.");
+
+    std::string frame;
+    frame.reserve(kipy::ReceiveBuffer::FRAME_HEADER_SIZE + packet.size());
+    frame.push_back(static_cast<char>(kipy::ReceiveBuffer::START_SIGNAL & 0xFF));
+    frame.push_back(static_cast<char>(kipy::ReceiveBuffer::START_SIGNAL >> 8));
+    frame.push_back(static_cast<char>(packet.size() & 0xFF));
+    frame.push_back(static_cast<char>(packet.size() >> 8));
+    frame += packet;
+    return frame;
+}
+
+/**
+ * Holds a MessageManager's definitions mutex shared, releasing the GIL
+ * while waiting for another thread to finish loading a module.
+ */
+class DefinitionsLockGuard
+{
+public:
+    explicit DefinitionsLockGuard(const ki::protocol::dml::MessageManager &manager)
+        : m_mutex(kipy::get_definitions_mutex(manager))
+    {
+        if (m_mutex.try_lock_shared())
+            return;
+
+        py::gil_scoped_release release;
+        m_mutex.lock_shared();
+    }
+    ~DefinitionsLockGuard()
+    {
+        m_mutex.unlock_shared();
+    }
+
+    DefinitionsLockGuard(const DefinitionsLockGuard &) = delete;
+    DefinitionsLockGuard &operator=(const DefinitionsLockGuard &) = delete;
+
+private:
+    kipy::SharedMutex &m_mutex;
+};
+
+/**
+ * Takes ownership of decoded messages as a list, keeping their manager
+ * alive for as long as any of them are.
+ */
+py::list to_message_list(py::handle manager,
+    const std::vector<ki::protocol::dml::Message *> &messages)
+{
+    py::list results;
+    for (auto *message : messages)
+    {
+        py::object result = py::cast(message, py::return_value_policy::take_ownership);
+        py::detail::keep_alive_impl(result, manager);
+        results.append(result);
+    }
+    return results;
+}
+
 PYBIND11_MODULE(protocol, m)
 {
     using namespace ki::protocol;
@@ -441,7 +692,65 @@ PYBIND11_MODULE(protocol, m)
 
         // Method: create_message()
         .def("create_message", &MessageTemplate::create_message,
-            py::return_value_policy::take_ownership);
+            py::return_value_policy::take_ownership, py::keep_alive<0, 1>())
+
+        // Extension: frames_to_columns()
+        .def("frames_to_columns",
+            [](const MessageTemplate &self, std::string data)
+            {
+                std::unique_ptr<Message> message(self.create_message());
+                std::unique_ptr<kipy::ColumnBatch> batch(
+                    new kipy::ColumnBatch(*message->get_record()));
+                {
+                    py::gil_scoped_release release;
+                    kipy::ByteReader reader(data.data(), data.size());
+                    batch->read_frames_from(reader, self.get_service_id(), self.get_type());
+                }
+                return batch.release();
+            },
+            py::arg("data"), py::return_value_policy::take_ownership)
+        // Extension: frames_to_columns() (appending)
+        .def("frames_to_columns",
+            [](const MessageTemplate &self, std::string data, kipy::ColumnBatch &batch)
+            {
+                if (batch.is_locked())
+                {
+                    PyErr_SetString(PyExc_BufferError, "ColumnBatch is being modified");
+                    throw py::error_already_set();
+                }
+                if (batch.is_exported())
+                {
+                    PyErr_SetString(PyExc_BufferError,
+                        "ColumnBatch can not be resized while its buffer is exported");
+                    throw py::error_already_set();
+                }
+
+                kipy::ColumnBatchLock lock(batch);
+                py::gil_scoped_release release;
+                kipy::ByteReader reader(data.data(), data.size());
+                return batch.read_frames_from(reader, self.get_service_id(), self.get_type());
+            },
+            py::arg("data"), py::arg("batch"))
+        // Extension: columns_to_frames()
+        .def("columns_to_frames",
+            [](const MessageTemplate &self, kipy::ColumnBatch &batch)
+            {
+                if (batch.is_locked())
+                {
+                    PyErr_SetString(PyExc_BufferError, "ColumnBatch is being modified");
+                    throw py::error_already_set();
+                }
+
+                std::string buffer;
+                {
+                    kipy::ColumnBatchLock lock(batch);
+                    py::gil_scoped_release release;
+                    kipy::ByteWriter writer(buffer);
+                    batch.write_frames_to(writer, self.get_service_id(), self.get_type());
+                }
+                return py::bytes(buffer);
+            },
+            py::arg("batch"), py::return_value_policy::copy);
 
     // Class: MessageModule
     py::class_<MessageModule>(m_dml, "MessageModule")
@@ -460,7 +769,7 @@ PYBIND11_MODULE(protocol, m)
                     return message_template;
                 throw py::key_error("MessageTemplate with type " + std::to_string(key) + " does not exist");
             },
-            py::arg("key"), py::return_value_policy::reference)
+            py::arg("key"), py::return_value_policy::reference, py::keep_alive<0, 1>())
         // Descriptor: __getitem__
         .def("__getitem__",
             [](const MessageModule &self, std::string key)
@@ -470,7 +779,7 @@ PYBIND11_MODULE(protocol, m)
                     return message_template;
                 throw py::key_error("MessageTemplate with name '" + key + "' does not exist");
             },
-            py::arg("key"), py::return_value_policy::reference)
+            py::arg("key"), py::return_value_policy::reference, py::keep_alive<0, 1>())
 
         // Property: service_id
         .def_property("service_id",
@@ -494,15 +803,35 @@ PYBIND11_MODULE(protocol, m)
         .def("create_message",
             static_cast<Message *(MessageModule::*)(uint8_t) const>(
                 &MessageModule::create_message),
-            py::arg("message_type"), py::return_value_policy::take_ownership)
+            py::arg("message_type"), py::return_value_policy::take_ownership,
+            py::keep_alive<0, 1>())
         // Method: create_message()
         .def("create_message",
             static_cast<Message *(MessageModule::*)(std::string) const>(
                 &MessageModule::create_message),
-            py::arg("message_name"), py::return_value_policy::take_ownership);
+            py::arg("message_name"), py::return_value_policy::take_ownership,
+            py::keep_alive<0, 1>())
+
+        // Extension: message_templates()
+        .def("message_templates",
+            [](const MessageModule &self)
+            {
+                py::list message_templates;
+                for (int type = 0; type <= UINT8_MAX; ++type)
+                {
+                    auto *message_template = self.get_message_template(
+                        static_cast<uint8_t>(type));
+                    if (message_template)
+                        message_templates.append(py::cast(message_template,
+                            py::return_value_policy::reference));
+                }
+                return message_templates;
+            },
+            py::keep_alive<0, 1>());
 
     // Class: MessageManager
-    py::class_<MessageManager>(m_dml, "MessageManager")
+    py::class_<MessageManager, std::unique_ptr<MessageManager, kipy::MessageManagerDeleter>>(
+        m_dml, "MessageManager")
 
         // Initializer
         .def(py::init<>())
@@ -511,59 +840,153 @@ PYBIND11_MODULE(protocol, m)
         .def("__getitem__",
             [](const MessageManager &self, uint8_t key)
             {
+                DefinitionsLockGuard guard(self);
                 auto *module = self.get_module(key);
                 if (module)
                     return module;
                 throw py::key_error("MessageModule with service ID " + std::to_string(key) + " does not exist");
             },
-            py::arg("key"), py::return_value_policy::reference)
+            py::arg("key"), py::return_value_policy::reference, py::keep_alive<0, 1>())
         // Descriptor: __getitem__
         .def("__getitem__",
             [](const MessageManager &self, const std::string &key)
             {
+                DefinitionsLockGuard guard(self);
                 auto *module = self.get_module(key);
                 if (module)
                     return module;
                 throw py::key_error("MessageModule with protocol type '" + key + "' does not exist");
             },
-            py::arg("key"), py::return_value_policy::reference)
+            py::arg("key"), py::return_value_policy::reference, py::keep_alive<0, 1>())
 
         // Method: load_module()
-        .def("load_module", &MessageManager::load_module,
-            py::arg("filepath"), py::return_value_policy::reference)
+        .def("load_module",
+            [](MessageManager &self, std::string filepath)
+            {
+                // Wait for any in-flight decodes to finish first.
+                py::gil_scoped_release release;
+                std::lock_guard<kipy::SharedMutex> lock(kipy::get_definitions_mutex(self));
+                return self.load_module(filepath);
+            },
+            py::arg("filepath"), py::return_value_policy::reference, py::keep_alive<0, 1>())
         // Method: create_message()
         .def("create_message",
-            static_cast<Message *(MessageManager::*)(uint8_t, uint8_t) const>(
-                &MessageManager::create_message),
+            [](const MessageManager &self, uint8_t service_id, uint8_t message_type)
+            {
+                DefinitionsLockGuard guard(self);
+                return self.create_message(service_id, message_type);
+            },
             py::arg("service_id"),
-            py::arg("message_type"), py::return_value_policy::take_ownership)
+            py::arg("message_type"), py::return_value_policy::take_ownership,
+            py::keep_alive<0, 1>())
         // Method: create_message()
         .def("create_message",
-            static_cast<Message *(MessageManager::*)(uint8_t, const std::string &) const>(
-                &MessageManager::create_message),
+            [](const MessageManager &self, uint8_t service_id, const std::string &message_name)
+            {
+                DefinitionsLockGuard guard(self);
+                return self.create_message(service_id, message_name);
+            },
             py::arg("service_id"),
-            py::arg("message_name"), py::return_value_policy::take_ownership)
+            py::arg("message_name"), py::return_value_policy::take_ownership,
+            py::keep_alive<0, 1>())
         // Method: create_message()
         .def("create_message",
-            static_cast<Message *(MessageManager::*)(const std::string &, uint8_t) const>(
-                &MessageManager::create_message),
+            [](const MessageManager &self, const std::string &protocol_type, uint8_t message_type)
+            {
+                DefinitionsLockGuard guard(self);
+                return self.create_message(protocol_type, message_type);
+            },
             py::arg("protocol_type"),
-            py::arg("message_type"), py::return_value_policy::take_ownership)
+            py::arg("message_type"), py::return_value_policy::take_ownership,
+            py::keep_alive<0, 1>())
         // Method: create_message()
         .def("create_message",
-            static_cast<Message *(MessageManager::*)(const std::string &, const std::string &) const>(
-                &MessageManager::create_message),
+            [](const MessageManager &self, const std::string &protocol_type,
+                const std::string &message_name)
+            {
+                DefinitionsLockGuard guard(self);
+                return self.create_message(protocol_type, message_name);
+            },
             py::arg("protocol_type"),
-            py::arg("message_name"), py::return_value_policy::take_ownership)
+            py::arg("message_name"), py::return_value_policy::take_ownership,
+            py::keep_alive<0, 1>())
 
         // Extension: message_from_bytes()
         .def("message_from_bytes",
             [](MessageManager &self, std::string data)
             {
+                DefinitionsLockGuard guard(self);
                 std::istringstream iss(data);
                 return self.message_from_binary(iss);
             },
-            py::arg("data"));
+            py::arg("data"), py::return_value_policy::take_ownership, py::keep_alive<0, 1>())
+        // Extension: messages_from_bytes()
+        .def("messages_from_bytes",
+            [](MessageManager &self, std::string data, unsigned int threads)
+            {
+                std::vector<Message *> messages;
+                {
+                    py::gil_scoped_release release;
+                    messages = kipy::decode_messages(self, data.data(), data.size(), threads);
+                }
+                return to_message_list(
+                    py::cast(&self, py::return_value_policy::reference), messages);
+            },
+            py::arg("data"),
+            py::arg("threads") = 0)
+        // Extension: messages_from_file()
+        .def("messages_from_file",
+            [](MessageManager &self, std::string filepath, unsigned int threads)
+            {
+                std::vector<Message *> messages;
+                {
+                    py::gil_scoped_release release;
+                    std::ifstream ifs(filepath, std::ios::binary);
+                    if (!ifs)
+                        throw ki::protocol::runtime_error("Failed to open file: " + filepath);
+                    const std::string data(
+                        (std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+                    messages = kipy::decode_messages(self, data.data(), data.size(), threads);
+                }
+                return to_message_list(
+                    py::cast(&self, py::return_value_policy::reference), messages);
+            },
+            py::arg("filepath"),
+            py::arg("threads") = 0);
+
+    // Class: RecordDeltaEncoder
+    py::class_<kipy::RecordDeltaEncoder>(m_dml, "RecordDeltaEncoder")
+
+        // Initializer
+        .def(py::init<>())
+
+        // Method: encode()
+        .def("encode",
+            [](kipy::RecordDeltaEncoder &self, const Message &message)
+            {
+                return py::bytes(self.encode(message));
+            },
+            py::arg("message"))
+        // Method: reset()
+        .def("reset", &kipy::RecordDeltaEncoder::reset);
+
+    // Class: RecordDeltaDecoder
+    py::class_<kipy::RecordDeltaDecoder>(m_dml, "RecordDeltaDecoder")
+
+        // Initializer
+        .def(py::init<const MessageManager &>(),
+            py::arg("manager"), py::keep_alive<1, 2>())
+
+        // Method: apply()
+        .def("apply",
+            [](kipy::RecordDeltaDecoder &self, std::string data) -> const Message &
+            {
+                DefinitionsLockGuard guard(self.get_manager());
+                return self.apply(data.data(), data.size());
+            },
+            py::arg("data"), py::return_value_policy::reference_internal)
+        // Method: reset()
+        .def("reset", &kipy::RecordDeltaDecoder::reset);
 
     // Submodule: dml (end)
 
@@ -673,6 +1096,49 @@ PYBIND11_MODULE(protocol, m)
         .def("close", &PublicistSession::close,
             py::arg("error"));
 
+    // Class: RttEstimator
+    // (Times are in milliseconds.)
+    py::class_<kipy::RttEstimator>(m_net, "RttEstimator")
+
+        // Initializer
+        .def(py::init<>())
+
+        // Property: sample_count (read-only)
+        .def_property_readonly("sample_count", &kipy::RttEstimator::get_sample_count,
+            py::return_value_policy::copy)
+        // Property: last (read-only)
+        .def_property_readonly("last",
+            [](const kipy::RttEstimator &self) { return to_milliseconds(self.get_last()); })
+        // Property: min (read-only)
+        .def_property_readonly("min",
+            [](const kipy::RttEstimator &self) { return to_milliseconds(self.get_min()); })
+        // Property: max (read-only)
+        .def_property_readonly("max",
+            [](const kipy::RttEstimator &self) { return to_milliseconds(self.get_max()); })
+        // Property: srtt (read-only)
+        .def_property_readonly("srtt",
+            [](const kipy::RttEstimator &self) { return to_milliseconds(self.get_srtt()); })
+        // Property: rttvar (read-only)
+        .def_property_readonly("rttvar",
+            [](const kipy::RttEstimator &self) { return to_milliseconds(self.get_rttvar()); })
+
+        // Method: add_sample()
+        .def("add_sample",
+            [](kipy::RttEstimator &self, double milliseconds)
+            {
+                self.add_sample(static_cast<uint32_t>(std::max(0.0, milliseconds * 1000.0)));
+            },
+            py::arg("milliseconds"))
+        // Method: percentile()
+        .def("percentile",
+            [](const kipy::RttEstimator &self, double quantile)
+            {
+                return to_milliseconds(self.get_percentile(quantile));
+            },
+            py::arg("quantile"))
+        // Method: reset()
+        .def("reset", &kipy::RttEstimator::reset);
+
     // Class: ServerSession
     py::class_<ServerSession, Session, PyServerSession>(
         m_net, "ServerSession", py::multiple_inheritance())
@@ -681,6 +1147,14 @@ PYBIND11_MODULE(protocol, m)
         .def(py::init<uint16_t>(),
             py::arg("id"))
 
+        // Property: rtt (read-only)
+        .def_property_readonly("rtt",
+            [](ServerSession &self) -> kipy::RttEstimator &
+            {
+                return get_latency_tracked(self).get_rtt();
+            },
+            py::return_value_policy::reference_internal)
+
         // Method: send_keep_alive()
         .def("send_keep_alive", &ServerSession::send_keep_alive,
             py::arg("milliseconds_since_startup"))
@@ -699,6 +1173,14 @@ PYBIND11_MODULE(protocol, m)
         .def(py::init<uint16_t>(),
             py::arg("id"))
 
+        // Property: rtt (read-only)
+        .def_property_readonly("rtt",
+            [](ClientSession &self) -> kipy::RttEstimator &
+            {
+                return get_latency_tracked(self).get_rtt();
+            },
+            py::return_value_policy::reference_internal)
+
         // Method: send_keep_alive()
         .def("send_keep_alive", &ClientSession::send_keep_alive)
 
@@ -723,9 +1205,10 @@ PYBIND11_MODULE(protocol, m)
         m_net, "DMLSession", py::multiple_inheritance())
 
         // Initializer
+        // (the session refers to its manager for its entire lifetime)
         .def(py::init<uint16_t, const ki::protocol::dml::MessageManager &>(),
             py::arg("id"),
-            py::arg("manager"))
+            py::arg("manager"), py::keep_alive<1, 3>())
 
         // Property: manager (read-only)
         .def_property_readonly("manager", &DMLSession::get_manager,
@@ -749,7 +1232,7 @@ PYBIND11_MODULE(protocol, m)
         // Initializer
         .def(py::init<uint16_t, const ki::protocol::dml::MessageManager &>(),
             py::arg("id"),
-            py::arg("manager"));
+            py::arg("manager"), py::keep_alive<1, 3>());
 
     // Class: ClientDMLSession
     py::class_<ClientDMLSession, ClientSession, DMLSession, PyClientDMLSession>(
@@ -758,10 +1241,615 @@ PYBIND11_MODULE(protocol, m)
         // Initializer
         .def(py::init<uint16_t, const ki::protocol::dml::MessageManager &>(),
             py::arg("id"),
-            py::arg("manager"));
+            py::arg("manager"), py::keep_alive<1, 3>());
+
+    // Class: ReceiveBuffer
+    py::class_<kipy::ReceiveBuffer>(m_net, "ReceiveBuffer", py::buffer_protocol())
+
+        // Initializer
+        .def(py::init<size_t>(),
+            py::arg("capacity") = static_cast<size_t>(kipy::ReceiveBuffer::MINIMUM_CAPACITY))
+
+        // Buffer (the free region following any pending data)
+        .def_buffer([](kipy::ReceiveBuffer &self)
+            {
+                size_t size;
+                auto *region = self.get_write_region(size);
+                return py::buffer_info(region, 1,
+                    py::format_descriptor<uint8_t>::format(), size);
+            })
+
+        // Property: capacity (read-only)
+        .def_property_readonly("capacity", &kipy::ReceiveBuffer::get_capacity,
+            py::return_value_policy::copy)
+        // Property: allocated (read-only)
+        .def_property_readonly("allocated", &kipy::ReceiveBuffer::get_allocated,
+            py::return_value_policy::copy)
+        // Property: pending (read-only)
+        .def_property_readonly("pending", &kipy::ReceiveBuffer::get_pending,
+            py::return_value_policy::copy)
+        // Property: framing (read-only)
+        .def_property_readonly("framing", &kipy::ReceiveBuffer::is_framing,
+            py::return_value_policy::copy)
+        // Property: high_water (read-only)
+        .def_property_readonly("high_water", &kipy::ReceiveBuffer::get_high_water,
+            py::return_value_policy::copy)
+        // Property: bytes_received (read-only)
+        .def_property_readonly("bytes_received", &kipy::ReceiveBuffer::get_bytes_received,
+            py::return_value_policy::copy)
+        // Property: frames_processed (read-only)
+        .def_property_readonly("frames_processed", &kipy::ReceiveBuffer::get_frames_processed,
+            py::return_value_policy::copy)
+        // Property: wrapped_frames (read-only)
+        .def_property_readonly("wrapped_frames", &kipy::ReceiveBuffer::get_wrapped_frames,
+            py::return_value_policy::copy)
+
+        // Method: get_buffer()
+        .def("get_buffer",
+            [](py::object self, int)
+            {
+                // A memoryview of the free region, which readers (e.g.
+                // socket.recv_into()) fill, and which keeps the buffer
+                // alive in the meantime.
+                auto *view = PyMemoryView_FromObject(self.ptr());
+                if (!view)
+                    throw py::error_already_set();
+                return py::reinterpret_steal<py::object>(view);
+            },
+            py::arg("sizehint") = -1)
+        // Method: buffer_updated()
+        .def("buffer_updated", &kipy::ReceiveBuffer::commit,
+            py::arg("nbytes"))
+        // Method: trim()
+        .def("trim", &kipy::ReceiveBuffer::trim)
+        // Method: write()
+        .def("write",
+            [](kipy::ReceiveBuffer &self, std::string data)
+            {
+                return self.write(data.data(), data.size());
+            },
+            py::arg("data"))
+        // Method: get_pending_data()
+        .def("get_pending_data",
+            [](const kipy::ReceiveBuffer &self)
+            {
+                const auto data = self.get_pending_data();
+                return py::bytes(data.data(), data.size());
+            })
+        // Method: process()
+        .def("process",
+            [](kipy::ReceiveBuffer &self, Session &session, py::object extension_handler)
+            {
+                const auto process_data = &PublicistSession::process_data;
+                const auto sink = [&session, process_data](const char *data, const size_t size)
+                {
+                    (session.*process_data)(data, size);
+                };
+                if (extension_handler.is_none())
+                    return self.process(sink);
+
+                // Extension frames go through Python, which may hand back
+                // a regular frame to process in their place.
+                return self.process(sink,
+                    [&session, process_data, &extension_handler](const char *data, const size_t size)
+                    {
+                        const auto result = extension_handler(py::bytes(data, size));
+                        if (result.is_none())
+                            return;
+
+                        const auto frame = result.cast<std::string>();
+                        (session.*process_data)(frame.data(), frame.size());
+                    });
+            },
+            py::arg("session"),
+            py::arg("extension_handler") = py::none());
+
+    // Class: OutboundQueue
+    py::class_<kipy::OutboundQueue> outbound_queue(m_net, "OutboundQueue");
+
+    // Enum: OutboundQueue.PushResult
+    py::enum_<kipy::OutboundQueue::PushResult>(outbound_queue, "PushResult")
+        .value("QUEUED", kipy::OutboundQueue::PushResult::QUEUED)
+        .value("SCHEDULE_DRAIN", kipy::OutboundQueue::PushResult::SCHEDULE_DRAIN)
+        .value("FULL", kipy::OutboundQueue::PushResult::FULL);
+
+    outbound_queue
+
+        // Initializer
+        .def(py::init<size_t>(),
+            py::arg("capacity"))
+
+        // Property: capacity (read-only)
+        .def_property_readonly("capacity", &kipy::OutboundQueue::get_capacity,
+            py::return_value_policy::copy)
+        // Property: size (read-only)
+        .def_property_readonly("size", &kipy::OutboundQueue::get_size,
+            py::return_value_policy::copy)
+
+        // Method: push()
+        .def("push",
+            [](kipy::OutboundQueue &self, uint16_t session_id, uint32_t generation,
+                std::string data)
+            {
+                // Producers only contend on the queue itself.
+                py::gil_scoped_release release;
+                return self.push(session_id, generation, std::move(data));
+            },
+            py::arg("session_id"),
+            py::arg("generation"),
+            py::arg("data"))
+        // Method: drain()
+        .def("drain",
+            [](kipy::OutboundQueue &self, size_t max_count)
+            {
+                py::list frames;
+                self.drain([&frames](const uint16_t session_id, const uint32_t generation,
+                    std::string &&data)
+                    {
+                        frames.append(py::make_tuple(session_id, generation, py::bytes(data)));
+                    }, max_count);
+                return frames;
+            },
+            py::arg("max_count") = 1024)
+        // Method: finish_drain()
+        .def("finish_drain", &kipy::OutboundQueue::finish_drain);
+
+    // Class: SessionRegistry
+    py::class_<kipy::SessionRegistry>(m_net, "SessionRegistry")
+
+        // Initializer
+        .def(py::init<>())
+
+        // Method: get()
+        .def("get", &kipy::SessionRegistry::get,
+            py::arg("session_id"),
+            py::return_value_policy::reference)
+        // Method: get_writer()
+        .def("get_writer",
+            [](const kipy::SessionRegistry &self, const uint16_t session_id) -> py::object
+            {
+                const auto &writer = self.get_writer(session_id);
+                if (writer)
+                    return writer;
+                return py::none();
+            },
+            py::arg("session_id"))
+        // Method: add()
+        // (the session must be removed before it is destroyed)
+        .def("add", &kipy::SessionRegistry::add,
+            py::arg("session"), py::arg("writer") = py::none())
+        // Method: remove()
+        .def("remove", &kipy::SessionRegistry::remove,
+            py::arg("session_id"));
+
+    // Class: SessionGroup
+    py::class_<kipy::SessionGroup>(m_net, "SessionGroup")
+
+        // Initializer
+        .def(py::init<kipy::SessionRegistry *>(),
+            py::arg("registry") = nullptr, py::keep_alive<1, 2>())
+
+        // Descriptor: __len__
+        .def("__len__", &kipy::SessionGroup::get_size)
+        // Descriptor: __bool__
+        .def("__bool__",
+            [](const kipy::SessionGroup &self)
+            {
+                return !self.is_empty();
+            })
+        // Descriptor: __contains__
+        .def("__contains__", &kipy::SessionGroup::contains,
+            py::arg("session_id"))
+        // Descriptor: __iter__
+        .def("__iter__",
+            [](const kipy::SessionGroup &self)
+            {
+                return py::iter(py::cast(self.get_members()));
+            })
+        // Descriptor: __eq__
+        .def("__eq__",
+            [](const kipy::SessionGroup &self, const kipy::SessionGroup &other)
+            {
+                return self == other;
+            },
+            py::is_operator())
+
+        // Descriptors: __or__, __and__, __sub__, __xor__
+        // (the result sends through the left-hand group's registry)
+        .def("__or__",
+            [](const kipy::SessionGroup &self, const kipy::SessionGroup &other)
+            {
+                kipy::SessionGroup result(self);
+                return result |= other;
+            },
+            py::is_operator(), py::keep_alive<0, 1>())
+        .def("__and__",
+            [](const kipy::SessionGroup &self, const kipy::SessionGroup &other)
+            {
+                kipy::SessionGroup result(self);
+                return result &= other;
+            },
+            py::is_operator(), py::keep_alive<0, 1>())
+        .def("__sub__",
+            [](const kipy::SessionGroup &self, const kipy::SessionGroup &other)
+            {
+                kipy::SessionGroup result(self);
+                return result -= other;
+            },
+            py::is_operator(), py::keep_alive<0, 1>())
+        .def("__xor__",
+            [](const kipy::SessionGroup &self, const kipy::SessionGroup &other)
+            {
+                kipy::SessionGroup result(self);
+                return result ^= other;
+            },
+            py::is_operator(), py::keep_alive<0, 1>())
+
+        // Descriptors: __ior__, __iand__, __isub__, __ixor__
+        .def("__ior__",
+            [](kipy::SessionGroup &self, const kipy::SessionGroup &other) -> kipy::SessionGroup &
+            {
+                return self |= other;
+            },
+            py::is_operator(), py::return_value_policy::reference)
+        .def("__iand__",
+            [](kipy::SessionGroup &self, const kipy::SessionGroup &other) -> kipy::SessionGroup &
+            {
+                return self &= other;
+            },
+            py::is_operator(), py::return_value_policy::reference)
+        .def("__isub__",
+            [](kipy::SessionGroup &self, const kipy::SessionGroup &other) -> kipy::SessionGroup &
+            {
+                return self -= other;
+            },
+            py::is_operator(), py::return_value_policy::reference)
+        .def("__ixor__",
+            [](kipy::SessionGroup &self, const kipy::SessionGroup &other) -> kipy::SessionGroup &
+            {
+                return self ^= other;
+            },
+            py::is_operator(), py::return_value_policy::reference)
+
+        // Method: add()
+        .def("add", &kipy::SessionGroup::add,
+            py::arg("session_id"))
+        // Method: remove()
+        .def("remove", &kipy::SessionGroup::remove,
+            py::arg("session_id"))
+        // Method: update()
+        .def("update",
+            [](kipy::SessionGroup &self, py::iterable session_ids)
+            {
+                for (auto session_id : session_ids)
+                    self.add(session_id.cast<uint16_t>());
+            },
+            py::arg("session_ids"))
+        // Method: clear()
+        .def("clear", &kipy::SessionGroup::clear)
+        // Method: copy()
+        .def("copy",
+            [](const kipy::SessionGroup &self)
+            {
+                return kipy::SessionGroup(self);
+            },
+            py::keep_alive<0, 1>())
+
+        // Method: send()
+        .def("send",
+            [](const kipy::SessionGroup &self, const Message &message)
+            {
+                return send_to_group(self, build_message_frame(message));
+            },
+            py::arg("message"))
+        // Method: send_frame()
+        .def("send_frame",
+            [](const kipy::SessionGroup &self, std::string frame)
+            {
+                return send_to_group(self, frame);
+            },
+            py::arg("frame"));
+
+    // Class: BufferPool
+    py::class_<kipy::BufferPool, std::shared_ptr<kipy::BufferPool>>(m_net, "BufferPool")
+
+        // Initializer
+        .def(py::init<size_t, size_t, double>(),
+            py::arg("buffer_size") = static_cast<size_t>(kipy::BufferPool::DEFAULT_BUFFER_SIZE),
+            py::arg("buffer_count") = static_cast<size_t>(kipy::BufferPool::DEFAULT_BUFFER_COUNT),
+            py::arg("deferred_timeout") = static_cast<double>(kipy::BufferPool::DEFAULT_DEFERRED_TIMEOUT))
+
+        // Property: buffer_size (read-only)
+        .def_property_readonly("buffer_size", &kipy::BufferPool::get_buffer_size,
+            py::return_value_policy::copy)
+        // Property: buffer_count (read-only)
+        .def_property_readonly("buffer_count", &kipy::BufferPool::get_buffer_count,
+            py::return_value_policy::copy)
+        // Property: available (read-only)
+        .def_property_readonly("available", &kipy::BufferPool::get_available,
+            py::return_value_policy::copy)
+        // Property: deferred (read-only)
+        .def_property_readonly("deferred", &kipy::BufferPool::get_deferred,
+            py::return_value_policy::copy)
+        // Property: deferred_timeout (read-only)
+        .def_property_readonly("deferred_timeout", &kipy::BufferPool::get_deferred_timeout,
+            py::return_value_policy::copy)
+
+        // Method: reclaim()
+        .def("reclaim", &kipy::BufferPool::reclaim);
+
+    // Class: ZeroCopySender
+    py::class_<kipy::ZeroCopySender>(m_net, "ZeroCopySender")
+
+        // Initializer
+        .def(py::init<int, std::shared_ptr<kipy::BufferPool>, uint16_t, size_t>(),
+            py::arg("fd"),
+            py::arg("pool"),
+            py::arg("session_id") = 0,
+            py::arg("threshold") = static_cast<size_t>(kipy::ZeroCopySender::DEFAULT_THRESHOLD))
+
+        // Property: enabled (read-only)
+        .def_property_readonly("enabled", &kipy::ZeroCopySender::is_enabled,
+            py::return_value_policy::copy)
+        // Property: threshold (read-only)
+        .def_property_readonly("threshold", &kipy::ZeroCopySender::get_threshold,
+            py::return_value_policy::copy)
+        // Property: pending (read-only)
+        .def_property_readonly("pending", &kipy::ZeroCopySender::get_pending,
+            py::return_value_policy::copy)
+        // Property: zerocopy_sends (read-only)
+        .def_property_readonly("zerocopy_sends", &kipy::ZeroCopySender::get_zerocopy_sends,
+            py::return_value_policy::copy)
+        // Property: copied_sends (read-only)
+        .def_property_readonly("copied_sends", &kipy::ZeroCopySender::get_copied_sends,
+            py::return_value_policy::copy)
+        // Property: bytes_sent (read-only)
+        .def_property_readonly("bytes_sent", &kipy::ZeroCopySender::get_bytes_sent,
+            py::return_value_policy::copy)
+
+        // Method: send_message()
+        // (returns the unsent remainder, or None if nothing was sent)
+        .def("send_message",
+            [](kipy::ZeroCopySender &self, const Message &message) -> py::object
+            {
+                std::string remainder;
+                const auto write = [&message](std::ostream &stream)
+                {
+                    ki::protocol::net::PacketHeader(false, 0).write_to(stream);
+                    message.write_to(stream);
+                };
+                if (!self.send(write, remainder))
+                    return py::none();
+                return py::bytes(remainder);
+            },
+            py::arg("message"))
+        // Method: send_frame()
+        .def("send_frame",
+            [](kipy::ZeroCopySender &self, std::string frame) -> py::object
+            {
+                std::string remainder;
+                if (!self.send_frame(frame.data(), frame.size(), remainder))
+                    return py::none();
+                return py::bytes(remainder);
+            },
+            py::arg("frame"))
+        // Method: poll_completions()
+        .def("poll_completions", &kipy::ZeroCopySender::poll_completions);
+
+    // Enum: TraceEventType
+    py::enum_<kipy::TraceEventType>(m_net, "TraceEventType")
+        .value("FRAME_SENT", kipy::TraceEventType::FRAME_SENT)
+        .value("CONTROL_RECEIVED", kipy::TraceEventType::CONTROL_RECEIVED)
+        .value("APPLICATION_RECEIVED", kipy::TraceEventType::APPLICATION_RECEIVED)
+        .value("MESSAGE_RECEIVED", kipy::TraceEventType::MESSAGE_RECEIVED)
+        .value("INVALID_PACKET", kipy::TraceEventType::INVALID_PACKET)
+        .value("INVALID_MESSAGE", kipy::TraceEventType::INVALID_MESSAGE)
+        .value("CLOSED", kipy::TraceEventType::CLOSED);
+
+    // Class: Tracer
+    py::class_<kipy::Tracer>(m_net, "Tracer")
+
+        // Property: capacity
+        .def_property("capacity",
+            &kipy::Tracer::get_capacity,
+            &kipy::Tracer::set_capacity, py::return_value_policy::copy)
+        // Property: sample_rate
+        .def_property("sample_rate",
+            &kipy::Tracer::get_sample_rate,
+            &kipy::Tracer::set_sample_rate, py::return_value_policy::copy)
+
+        // Property: events_recorded (read-only)
+        .def_property_readonly("events_recorded", &kipy::Tracer::get_events_recorded,
+            py::return_value_policy::copy)
+
+        // Method: trace_session()
+        .def("trace_session", &kipy::Tracer::set_session_traced,
+            py::arg("session_id"),
+            py::arg("traced") = true)
+        // Method: is_session_traced()
+        .def("is_session_traced", &kipy::Tracer::is_session_traced,
+            py::arg("session_id"))
+        // Method: dump()
+        .def("dump",
+            [](const kipy::Tracer &self, std::string filepath)
+            {
+                py::gil_scoped_release release;
+                return self.dump(filepath);
+            },
+            py::arg("filepath"))
+        // Method: dumps()
+        .def("dumps",
+            [](const kipy::Tracer &self)
+            {
+                return py::bytes(self.dump());
+            });
+
+    // Attribute: tracer
+    m_net.attr("tracer") = py::cast(&kipy::get_tracer(), py::return_value_policy::reference);
+
+    // Function: trace_frame()
+    // (For frames that are built and sent from Python, and so never
+    // reach a session's native send path.)
+    m_net.def("trace_frame",
+        [](uint16_t session_id, py::buffer frame)
+        {
+            if (!kipy::get_tracer().should_trace(session_id))
+                return;
+
+            const auto info = frame.request();
+            kipy::trace_frame(kipy::TraceEventType::FRAME_SENT, session_id,
+                static_cast<const char *>(info.ptr), static_cast<size_t>(info.size * info.itemsize));
+        },
+        py::arg("session_id"),
+        py::arg("frame"));
+
+    // Function: session_slab_stats()
+    m_net.def("session_slab_stats",
+        []()
+        {
+            py::dict stats;
+            const auto add_stats = [&stats](const char *name, const kipy::SlabAllocator &slab)
+            {
+                py::dict slab_stats;
+                slab_stats["block_size"] = slab.get_block_size();
+                slab_stats["blocks_in_use"] = slab.get_blocks_in_use();
+                slab_stats["blocks_reserved"] = slab.get_blocks_reserved();
+                slab_stats["chunks"] = slab.get_chunk_count();
+                stats[name] = slab_stats;
+            };
+            add_stats("Session", kipy::get_session_slab<PySession>());
+            add_stats("ServerSession", kipy::get_session_slab<PyServerSession>());
+            add_stats("ClientSession", kipy::get_session_slab<PyClientSession>());
+            add_stats("DMLSession", kipy::get_session_slab<PyDMLSession>());
+            add_stats("ServerDMLSession", kipy::get_session_slab<PyServerDMLSession>());
+            add_stats("ClientDMLSession", kipy::get_session_slab<PyClientDMLSession>());
+            return stats;
+        });
+
+    // Function: rtt_stats()
+    m_net.def("rtt_stats",
+        [](py::iterable sessions, std::vector<double> quantiles)
+        {
+            // Gathered column by column, for cheap filtering and sorting
+            // across thousands of sessions.
+            std::vector<uint16_t> ids;
+            std::vector<uint64_t> sample_counts;
+            std::vector<double> srtt, rttvar, min, max;
+            std::vector<std::vector<double>> percentiles(quantiles.size());
+            for (auto item : sessions)
+            {
+                auto &session = item.cast<Session &>();
+                const auto &rtt = get_latency_tracked(session).get_rtt();
+                ids.push_back(session.get_id());
+                sample_counts.push_back(rtt.get_sample_count());
+                srtt.push_back(to_milliseconds(rtt.get_srtt()));
+                rttvar.push_back(to_milliseconds(rtt.get_rttvar()));
+                min.push_back(to_milliseconds(rtt.get_min()));
+                max.push_back(to_milliseconds(rtt.get_max()));
+                for (size_t i = 0; i < quantiles.size(); ++i)
+                    percentiles[i].push_back(to_milliseconds(rtt.get_percentile(quantiles[i])));
+            }
+
+            py::dict stats;
+            stats["id"] = ids;
+            stats["sample_count"] = sample_counts;
+            stats["srtt"] = srtt;
+            stats["rttvar"] = rttvar;
+            stats["min"] = min;
+            stats["max"] = max;
+            py::dict percentile_stats;
+            for (size_t i = 0; i < quantiles.size(); ++i)
+                percentile_stats[py::float_(quantiles[i])] = percentiles[i];
+            stats["percentiles"] = percentile_stats;
+            return stats;
+        },
+        py::arg("sessions"),
+        py::arg("quantiles") = std::vector<double>{ 0.5, 0.9, 0.99 });
 
     // Submodule: net (end)
 
+    // Submodule: compression
+    py::module m_compression = m.def_submodule("compression");
+
+#ifdef KIPY_WITH_ZSTD
+    m_compression.attr("ZSTD_AVAILABLE") = true;
+
+    // Class: ZstdDictionary
+    py::class_<kipy::ZstdDictionary, std::shared_ptr<kipy::ZstdDictionary>>(
+        m_compression, "ZstdDictionary")
+
+        // Initializer
+        .def(py::init<std::string, int>(),
+            py::arg("dictionary"),
+            py::arg("level") = 3)
+
+        // Property: level (read-only)
+        .def_property_readonly("level", &kipy::ZstdDictionary::get_level,
+            py::return_value_policy::copy)
+        // Property: id (read-only)
+        .def_property_readonly("id", &kipy::ZstdDictionary::get_id,
+            py::return_value_policy::copy);
+
+    // Class: ZstdCodec
+    py::class_<kipy::ZstdCodec>(m_compression, "ZstdCodec")
+
+        // Initializer
+        .def(py::init<int, std::shared_ptr<kipy::ZstdDictionary>>(),
+            py::arg("level") = 3,
+            py::arg("dictionary") = nullptr)
+
+        // Property: level (read-only)
+        .def_property_readonly("level", &kipy::ZstdCodec::get_level,
+            py::return_value_policy::copy)
+        // Property: dictionary_id (read-only)
+        .def_property_readonly("dictionary_id", &kipy::ZstdCodec::get_dictionary_id,
+            py::return_value_policy::copy)
+
+        // Method: compress()
+        .def("compress",
+            [](kipy::ZstdCodec &self, std::string data)
+            {
+                std::string result;
+                {
+                    py::gil_scoped_release release;
+                    result = self.compress(data.data(), data.size());
+                }
+                return py::bytes(result);
+            },
+            py::arg("data"))
+        // Method: decompress()
+        .def("decompress",
+            [](kipy::ZstdCodec &self, std::string data, size_t decompressed_size)
+            {
+                std::string result;
+                {
+                    py::gil_scoped_release release;
+                    result = self.decompress(data.data(), data.size(), decompressed_size);
+                }
+                return py::bytes(result);
+            },
+            py::arg("data"),
+            py::arg("decompressed_size"))
+
+        // Static Method: train_dictionary()
+        .def_static("train_dictionary",
+            [](const std::vector<std::string> &samples, size_t size)
+            {
+                std::string dictionary;
+                {
+                    py::gil_scoped_release release;
+                    dictionary = kipy::ZstdCodec::train_dictionary(samples, size);
+                }
+                return py::bytes(dictionary);
+            },
+            py::arg("samples"),
+            py::arg("size") = 0x4000);
+#else
+    m_compression.attr("ZSTD_AVAILABLE") = false;
+#endif
+
+    // Submodule: compression (end)
+
     using namespace ki::protocol::control;
 
     // Submodule: control
@@ -0,0 +1,280 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace kipy
+{
+    /**
+     * A ring buffer that reassembles framed packets from a stream.
+     *
+     * Incoming data is written directly into the ring (see
+     * get_write_region() and commit()), and complete frames are handed
+     * to a sink straight out of the ring. A frame that wraps around the
+     * end of the ring is handed over in two pieces, so data is never
+     * moved once it has been received.
+     *
+     * That only holds up to the sink: a libki Session's process_data()
+     * still copies every frame into its own buffer before parsing it,
+     * as libki has no way to parse a packet from memory it does not
+     * own.
+     *
+     * Storage is only allocated once data arrives, starts out small,
+     * and grows (up to the capacity) as frames or reads require it.
+     * Idle connections can hand it back with trim().
+     *
+     * Frames are laid out as a 0xF00D start signal, followed by a
+     * 16-bit packet length, and then the packet itself. If the stream
+     * stops looking like that (an invalid start signal, or an extended
+     * length), the buffer falls back to forwarding data as it arrives,
+     * and leaves framing errors for the session to handle.
+     */
+    class ReceiveBuffer
+    {
+    public:
+        static const size_t FRAME_HEADER_SIZE = 4;
+        static const uint16_t START_SIGNAL = 0xF00D;
+        // Lengths above this mark the extended-length form, which is
+        // never sent.
+        static const uint16_t MAX_PACKET_SIZE = 0x7FFF;
+
+        // Opcodes from here on are reserved for kipy's own extensions,
+        // and are never used by the KI protocol itself.
+        static const uint8_t EXTENSION_OPCODE = 0xC0;
+
+        // Large enough to hold any frame with a 16-bit length.
+        static const size_t MINIMUM_CAPACITY = 0x10000;
+        static const size_t INITIAL_SIZE = 0x1000;
+
+        explicit ReceiveBuffer(const size_t capacity = MINIMUM_CAPACITY)
+            : m_capacity(std::max(capacity, static_cast<size_t>(MINIMUM_CAPACITY))),
+              m_read_position(0), m_pending(0), m_framing(true),
+              m_saturated(false), m_last_region_size(0),
+              m_high_water(0), m_bytes_received(0), m_frames_processed(0),
+              m_wrapped_frames(0) {}
+
+        size_t get_capacity() const { return m_capacity; }
+        size_t get_allocated() const { return m_buffer.capacity(); }
+        size_t get_pending() const { return m_pending; }
+        bool is_framing() const { return m_framing; }
+        size_t get_high_water() const { return m_high_water; }
+        uint64_t get_bytes_received() const { return m_bytes_received; }
+        uint64_t get_frames_processed() const { return m_frames_processed; }
+        uint64_t get_wrapped_frames() const { return m_wrapped_frames; }
+
+        /**
+         * Returns the largest contiguous free region of the ring that
+         * directly follows the pending data.
+         */
+        char *get_write_region(size_t &size)
+        {
+            if (m_pending == 0)
+            {
+                // Nothing is pending, so start writing from the beginning
+                // to offer the largest region possible. If the last read
+                // filled everything we offered, offer more this time (but
+                // only once, should the region be asked for again).
+                m_read_position = 0;
+                if (m_buffer.empty())
+                    resize(INITIAL_SIZE);
+                else if (m_saturated)
+                    resize(m_buffer.size() * 2);
+                m_saturated = false;
+            }
+            else if (m_pending == m_buffer.size())
+                resize(m_buffer.size() * 2);
+
+            m_last_region_size = 0;
+            const auto write_position = (m_read_position + m_pending) % m_buffer.size();
+            size = std::min(m_buffer.size() - m_pending, m_buffer.size() - write_position);
+            m_last_region_size = size;
+            return m_buffer.data() + write_position;
+        }
+
+        /**
+         * Marks `size` bytes of the region returned by
+         * get_write_region() as received.
+         */
+        void commit(const size_t size)
+        {
+            m_saturated = size > 0 && size == m_last_region_size;
+            m_pending += size;
+            m_bytes_received += size;
+            m_high_water = std::max(m_high_water, m_pending);
+        }
+
+        /**
+         * Copies the given data into the ring.
+         * Returns the number of bytes that fit.
+         */
+        size_t write(const char *data, const size_t size)
+        {
+            size_t written = 0;
+            while (written < size)
+            {
+                size_t region_size;
+                auto *region = get_write_region(region_size);
+                if (region_size == 0)
+                    break;
+
+                region_size = std::min(region_size, size - written);
+                std::memcpy(region, data + written, region_size);
+                commit(region_size);
+                written += region_size;
+            }
+            return written;
+        }
+
+        /**
+         * Hands every complete frame to `sink(const char *data, size_t size)`.
+         * Returns the number of frames that were processed.
+         */
+        template <typename SinkT>
+        size_t process(SinkT &&sink)
+        {
+            return process(sink, sink, false);
+        }
+
+        /**
+         * Same as process(sink), except that extension frames (those with
+         * an opcode of EXTENSION_OPCODE or above) are handed, in one
+         * contiguous piece, to `extension_sink` instead.
+         */
+        template <typename SinkT, typename ExtensionSinkT>
+        size_t process(SinkT &&sink, ExtensionSinkT &&extension_sink,
+            const bool extensions = true)
+        {
+            size_t frames = 0;
+            while (m_pending > 0)
+            {
+                if (!m_framing)
+                {
+                    consume(m_pending, sink);
+                    break;
+                }
+                if (m_pending < FRAME_HEADER_SIZE)
+                    break;
+
+                const auto start_signal = static_cast<uint16_t>(peek(0) | (peek(1) << 8));
+                const auto length = static_cast<uint16_t>(peek(2) | (peek(3) << 8));
+                if (start_signal != START_SIGNAL || length > MAX_PACKET_SIZE)
+                {
+                    m_framing = false;
+                    continue;
+                }
+
+                const size_t frame_size = FRAME_HEADER_SIZE + length;
+                if (m_pending < frame_size)
+                {
+                    if (frame_size > m_buffer.size())
+                        resize(frame_size);
+                    break;
+                }
+
+                if (extensions && length >= 2 && peek(FRAME_HEADER_SIZE + 1) >= EXTENSION_OPCODE)
+                    consume_contiguous(frame_size, extension_sink);
+                else
+                    consume(frame_size, sink);
+                ++m_frames_processed;
+                ++frames;
+            }
+            return frames;
+        }
+
+        /**
+         * Releases the storage if nothing is pending.
+         */
+        void trim()
+        {
+            if (m_pending > 0)
+                return;
+
+            std::vector<char>().swap(m_buffer);
+            m_read_position = 0;
+            m_saturated = false;
+        }
+
+        /**
+         * Copies out the pending (not yet processed) data.
+         */
+        std::vector<char> get_pending_data() const
+        {
+            std::vector<char> data(m_pending);
+            for (size_t i = 0; i < m_pending; ++i)
+                data[i] = m_buffer[(m_read_position + i) % m_buffer.size()];
+            return data;
+        }
+
+    private:
+        size_t m_capacity;
+        std::vector<char> m_buffer;
+        size_t m_read_position;
+        size_t m_pending;
+        bool m_framing;
+        bool m_saturated;
+        size_t m_last_region_size;
+
+        size_t m_high_water;
+        uint64_t m_bytes_received;
+        uint64_t m_frames_processed;
+        uint64_t m_wrapped_frames;
+
+        /**
+         * Resizes the storage (within the capacity), moving any pending
+         * data to the front. This is the only time data is moved.
+         */
+        void resize(size_t size)
+        {
+            size = std::min(std::max(size, static_cast<size_t>(INITIAL_SIZE)), m_capacity);
+            if (size <= m_buffer.size() && !m_buffer.empty())
+                return;
+
+            std::vector<char> buffer(size);
+            for (size_t i = 0; i < m_pending; ++i)
+                buffer[i] = m_buffer[(m_read_position + i) % m_buffer.size()];
+            m_buffer.swap(buffer);
+            m_read_position = 0;
+        }
+
+        uint8_t peek(const size_t offset) const
+        {
+            return static_cast<uint8_t>(m_buffer[(m_read_position + offset) % m_buffer.size()]);
+        }
+
+        template <typename SinkT>
+        void consume(const size_t size, SinkT &sink)
+        {
+            const auto contiguous = std::min(size, m_buffer.size() - m_read_position);
+            const auto *data = m_buffer.data() + m_read_position;
+
+            // Advance first, as the sink may end up closing the session.
+            m_read_position = (m_read_position + size) % m_buffer.size();
+            m_pending -= size;
+
+            sink(data, contiguous);
+            if (contiguous < size)
+            {
+                sink(m_buffer.data(), size - contiguous);
+                ++m_wrapped_frames;
+            }
+        }
+
+        template <typename SinkT>
+        void consume_contiguous(const size_t size, SinkT &sink)
+        {
+            if (size <= m_buffer.size() - m_read_position)
+            {
+                consume(size, sink);
+                return;
+            }
+
+            std::vector<char> data(size);
+            for (size_t i = 0; i < size; ++i)
+                data[i] = m_buffer[(m_read_position + i) % m_buffer.size()];
+            m_read_position = (m_read_position + size) % m_buffer.size();
+            m_pending -= size;
+            sink(data.data(), size);
+        }
+    };
+}
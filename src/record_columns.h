@@ -0,0 +1,517 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ki/dml/Record.h>
+#include <ki/dml/exception.h>
+
+#include "message_codec.h"
+#include "field_types.h"
+
+namespace kipy
+{
+    /**
+     * A single column of a ColumnBatch.
+     *
+     * Rows are appended by decoding them straight out of serialized
+     * record data, and written back the same way, so no intermediate
+     * ki::dml::Record is needed per row.
+     *
+     * Columns keep count of the buffer exports (such as Python
+     * memoryviews) of their storage, which must not be resized while
+     * there are any, and can be locked while being modified without
+     * the GIL, so that no exports are made in the meantime.
+     */
+    class Column
+    {
+    public:
+        Column(std::string name, const FieldType type)
+            : m_name(std::move(name)), m_type(type), m_exports(0), m_locked(false) {}
+        virtual ~Column() = default;
+
+        const std::string &get_name() const { return m_name; }
+        FieldType get_type() const { return m_type; }
+
+        virtual size_t get_row_count() const = 0;
+        virtual void reserve(size_t row_count) = 0;
+        virtual void truncate(size_t row_count) = 0;
+
+        /**
+         * Removes the first `row_count` rows.
+         */
+        virtual void erase_front(size_t row_count) = 0;
+
+        void add_export() { ++m_exports; }
+        void release_export() { --m_exports; }
+        virtual bool is_exported() const { return m_exports > 0; }
+
+        bool is_locked() const { return m_locked; }
+        virtual void set_locked(const bool locked) { m_locked = locked; }
+
+        virtual void read_row(ByteReader &reader) = 0;
+        virtual void write_row(ByteWriter &writer, size_t row) const = 0;
+        virtual size_t get_row_size(size_t row) const = 0;
+
+    private:
+        std::string m_name;
+        FieldType m_type;
+        size_t m_exports;
+        bool m_locked;
+    };
+
+    /**
+     * A column of fixed-size values, stored contiguously.
+     */
+    template <typename ValueT>
+    class ValueColumn : public Column
+    {
+    public:
+        ValueColumn(std::string name, const FieldType type)
+            : Column(std::move(name), type) {}
+
+        std::vector<ValueT> &get_values() { return m_values; }
+        const std::vector<ValueT> &get_values() const { return m_values; }
+
+        size_t get_row_count() const override { return m_values.size(); }
+        void reserve(const size_t row_count) override { m_values.reserve(row_count); }
+        void truncate(const size_t row_count) override
+        {
+            if (row_count < m_values.size())
+                m_values.resize(row_count);
+        }
+        void erase_front(const size_t row_count) override
+        {
+            m_values.erase(m_values.begin(),
+                m_values.begin() + std::min(row_count, m_values.size()));
+        }
+
+        void read_row(ByteReader &reader) override
+        {
+            ValueT value;
+            read_value(reader, value);
+            m_values.push_back(value);
+        }
+
+        void write_row(ByteWriter &writer, const size_t row) const override
+        {
+            write_value(writer, m_values[row]);
+        }
+
+        size_t get_row_size(size_t) const override
+        {
+            return sizeof(ValueT);
+        }
+
+    private:
+        std::vector<ValueT> m_values;
+    };
+
+    /**
+     * A column of variable-length strings, stored Arrow-style as an
+     * offsets buffer (row count + 1 entries) and a data buffer of
+     * code units.
+     */
+    template <typename StringT>
+    class StringColumn : public Column
+    {
+    public:
+        typedef typename std::conditional<
+            sizeof(typename StringT::value_type) == 1, uint8_t, uint16_t>::type CodeUnitT;
+
+        StringColumn(std::string name, const FieldType type)
+            : Column(name, type),
+              m_offsets(name + ".offsets", FieldType::UINT),
+              m_data(name + ".data", sizeof(CodeUnitT) == 1 ? FieldType::UBYT : FieldType::USHRT)
+        {
+            m_offsets.get_values().push_back(0);
+        }
+
+        ValueColumn<uint32_t> &get_offsets() { return m_offsets; }
+        const ValueColumn<uint32_t> &get_offsets() const { return m_offsets; }
+        ValueColumn<CodeUnitT> &get_data() { return m_data; }
+        const ValueColumn<CodeUnitT> &get_data() const { return m_data; }
+
+        StringT get_value(const size_t row) const
+        {
+            const auto &offsets = m_offsets.get_values();
+            const auto &data = m_data.get_values();
+            StringT value;
+            value.reserve(offsets[row + 1] - offsets[row]);
+            for (auto i = offsets[row]; i < offsets[row + 1]; ++i)
+                value.push_back(static_cast<typename StringT::value_type>(data[i]));
+            return value;
+        }
+
+        size_t get_row_count() const override { return m_offsets.get_row_count() - 1; }
+        void reserve(const size_t row_count) override { m_offsets.reserve(row_count + 1); }
+        void truncate(const size_t row_count) override
+        {
+            if (row_count >= get_row_count())
+                return;
+            m_offsets.truncate(row_count + 1);
+            m_data.truncate(m_offsets.get_values().back());
+        }
+        void erase_front(size_t row_count) override
+        {
+            row_count = std::min(row_count, get_row_count());
+            auto &offsets = m_offsets.get_values();
+            const auto data_size = offsets[row_count];
+            m_offsets.erase_front(row_count);
+            for (auto &offset : offsets)
+                offset -= data_size;
+            m_data.erase_front(data_size);
+        }
+
+        bool is_exported() const override
+        {
+            return Column::is_exported() || m_offsets.is_exported() || m_data.is_exported();
+        }
+        void set_locked(const bool locked) override
+        {
+            Column::set_locked(locked);
+            m_offsets.set_locked(locked);
+            m_data.set_locked(locked);
+        }
+
+        void read_row(ByteReader &reader) override
+        {
+            uint16_t length;
+            read_value(reader, length);
+            const char *data = reader.read_bytes(length * sizeof(CodeUnitT));
+
+            auto &values = m_data.get_values();
+            for (uint16_t i = 0; i < length; ++i)
+                values.push_back(load_le<CodeUnitT>(data + i * sizeof(CodeUnitT)));
+            m_offsets.get_values().push_back(static_cast<uint32_t>(values.size()));
+        }
+
+        void write_row(ByteWriter &writer, const size_t row) const override
+        {
+            const auto &offsets = m_offsets.get_values();
+            const auto length = offsets[row + 1] - offsets[row];
+            if (length > UINT16_MAX)
+                throw ki::dml::value_error("String in column '" + get_name() + "' is too long.");
+
+            write_value(writer, static_cast<uint16_t>(length));
+            const auto &data = m_data.get_values();
+            for (auto i = offsets[row]; i < offsets[row + 1]; ++i)
+                write_value(writer, data[i]);
+        }
+
+        size_t get_row_size(const size_t row) const override
+        {
+            const auto &offsets = m_offsets.get_values();
+            return sizeof(uint16_t) + (offsets[row + 1] - offsets[row]) * sizeof(CodeUnitT);
+        }
+
+        /**
+         * Checks that the offsets describe the data buffer.
+         */
+        void validate() const
+        {
+            const auto &offsets = m_offsets.get_values();
+            if (offsets.empty() || offsets.front() != 0 ||
+                offsets.back() != m_data.get_row_count())
+                throw ki::dml::value_error("Offsets of column '" + get_name() +
+                    "' do not match its data.");
+            for (size_t i = 1; i < offsets.size(); ++i)
+                if (offsets[i] < offsets[i - 1])
+                    throw ki::dml::value_error("Offsets of column '" + get_name() +
+                        "' are not in ascending order.");
+        }
+
+    private:
+        ValueColumn<uint32_t> m_offsets;
+        ValueColumn<CodeUnitT> m_data;
+    };
+
+    namespace detail
+    {
+        struct ColumnFactory
+        {
+            std::string name;
+            FieldType type;
+
+            template <typename ValueT>
+            typename std::enable_if<std::is_arithmetic<ValueT>::value, Column *>::type
+                visit() const
+            {
+                return new ValueColumn<ValueT>(name, type);
+            }
+
+            template <typename ValueT>
+            typename std::enable_if<!std::is_arithmetic<ValueT>::value, Column *>::type
+                visit() const
+            {
+                return new StringColumn<ValueT>(name, type);
+            }
+        };
+    }
+
+    /**
+     * A batch of records that share a template, stored as one column
+     * per transferable field of that template.
+     */
+    class ColumnBatch
+    {
+    public:
+        explicit ColumnBatch(const ki::dml::Record &record)
+            : m_row_count(0), m_locked(false)
+        {
+            for (auto it = record.fields_begin(); it != record.fields_end(); ++it)
+            {
+                const ki::dml::FieldBase *field = *it;
+                if (!field->is_transferable())
+                    continue;
+
+                const detail::ColumnFactory factory = { field->get_name(), get_field_type(*field) };
+                m_column_lookup[field->get_name()] = m_columns.size();
+                m_columns.emplace_back(visit_field_type(factory.type, factory));
+            }
+        }
+
+        size_t get_column_count() const { return m_columns.size(); }
+        Column *get_column(const size_t index) const { return m_columns[index].get(); }
+        Column *get_column(const std::string &name) const
+        {
+            const auto it = m_column_lookup.find(name);
+            if (it == m_column_lookup.end())
+                return nullptr;
+            return m_columns[it->second].get();
+        }
+
+        size_t get_row_count() const
+        {
+            if (m_columns.empty())
+                return m_row_count;
+            return m_columns.front()->get_row_count();
+        }
+
+        void reserve(const size_t row_count)
+        {
+            for (auto &column : m_columns)
+                column->reserve(row_count);
+        }
+
+        void clear()
+        {
+            truncate(0);
+        }
+
+        /**
+         * Removes every row past the first `row_count`.
+         */
+        void truncate(const size_t row_count)
+        {
+            for (auto &column : m_columns)
+                column->truncate(row_count);
+            m_row_count = std::min(m_row_count, row_count);
+        }
+
+        /**
+         * Removes the first `row_count` rows.
+         */
+        void erase_front(const size_t row_count)
+        {
+            for (auto &column : m_columns)
+                column->erase_front(row_count);
+            m_row_count -= std::min(m_row_count, row_count);
+        }
+
+        bool is_exported() const
+        {
+            for (const auto &column : m_columns)
+                if (column->is_exported())
+                    return true;
+            return false;
+        }
+
+        bool is_locked() const { return m_locked; }
+        void set_locked(const bool locked)
+        {
+            m_locked = locked;
+            for (auto &column : m_columns)
+                column->set_locked(locked);
+        }
+
+        /**
+         * Appends a row by decoding a serialized record.
+         * If decoding fails, the batch is left unchanged.
+         */
+        void read_row(ByteReader &reader)
+        {
+            const auto row_count = get_row_count();
+            try
+            {
+                for (auto &column : m_columns)
+                    column->read_row(reader);
+            }
+            catch (...)
+            {
+                for (auto &column : m_columns)
+                    column->truncate(row_count);
+                throw;
+            }
+            m_row_count = row_count + 1;
+        }
+
+        void write_row(ByteWriter &writer, const size_t row) const
+        {
+            for (const auto &column : m_columns)
+                column->write_row(writer, row);
+        }
+
+        size_t get_row_size(const size_t row) const
+        {
+            size_t size = 0;
+            for (const auto &column : m_columns)
+                size += column->get_row_size(row);
+            return size;
+        }
+
+        /**
+         * Checks that every column holds the same number of rows.
+         * Columns can be resized independently from Python before
+         * being encoded.
+         */
+        void validate() const
+        {
+            const auto row_count = get_row_count();
+            for (const auto &column : m_columns)
+            {
+                if (column->get_row_count() != row_count)
+                    throw ki::dml::value_error("Column '" + column->get_name() +
+                        "' does not have the same number of rows as the batch.");
+
+                if (column->get_type() == FieldType::STR)
+                    static_cast<const StringColumn<ki::dml::STR> &>(*column).validate();
+                else if (column->get_type() == FieldType::WSTR)
+                    static_cast<const StringColumn<ki::dml::WSTR> &>(*column).validate();
+            }
+        }
+
+        /**
+         * Decodes consecutive serialized records until the reader is
+         * exhausted, and returns the number of rows that were added.
+         * If decoding fails, the batch is left unchanged.
+         */
+        size_t read_from(ByteReader &reader)
+        {
+            if (m_columns.empty() && !reader.is_empty())
+                throw ki::dml::parse_error("Records without transferable fields have no data.");
+
+            const auto row_count = get_row_count();
+            try
+            {
+                while (!reader.is_empty())
+                    read_row(reader);
+            }
+            catch (...)
+            {
+                truncate(row_count);
+                throw;
+            }
+            return get_row_count() - row_count;
+        }
+
+        /**
+         * Replaces the rows of the batch with the serialized records
+         * of the reader. If decoding fails, the batch is left unchanged.
+         */
+        void replace_from(ByteReader &reader)
+        {
+            const auto row_count = get_row_count();
+            read_from(reader);
+            erase_front(row_count);
+        }
+
+        void write_to(ByteWriter &writer) const
+        {
+            validate();
+
+            const auto row_count = get_row_count();
+            for (size_t row = 0; row < row_count; ++row)
+                write_row(writer, row);
+        }
+
+        /**
+         * Decodes consecutive DML messages (header included) until the
+         * reader is exhausted. Every message must match the given
+         * service ID and message type, and its record must fill it
+         * exactly. If decoding fails, the batch is left unchanged.
+         */
+        size_t read_frames_from(ByteReader &reader,
+            const uint8_t service_id, const uint8_t type)
+        {
+            const auto row_count = get_row_count();
+            try
+            {
+                while (!reader.is_empty())
+                {
+                    const auto header = read_message_header(reader);
+                    if (header.service_id != service_id || header.type != type)
+                        throw ki::dml::parse_error("DML message does not match the batch template.");
+
+                    const size_t record_size = header.size - DMLMessageHeader::SIZE;
+                    ByteReader record_reader(reader.read_bytes(record_size), record_size);
+                    read_row(record_reader);
+                    if (!record_reader.is_empty())
+                        throw ki::dml::parse_error("DML message has trailing data.");
+                }
+            }
+            catch (...)
+            {
+                truncate(row_count);
+                throw;
+            }
+            return get_row_count() - row_count;
+        }
+
+        void write_frames_to(ByteWriter &writer,
+            const uint8_t service_id, const uint8_t type) const
+        {
+            validate();
+
+            const auto row_count = get_row_count();
+            for (size_t row = 0; row < row_count; ++row)
+            {
+                write_message_header(writer, service_id, type, get_row_size(row));
+                write_row(writer, row);
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<Column>> m_columns;
+        std::unordered_map<std::string, size_t> m_column_lookup;
+        size_t m_row_count;
+        bool m_locked;
+    };
+
+    /**
+     * Locks the columns of a batch for as long as it is in scope, while
+     * the batch is read or modified without the GIL.
+     */
+    class ColumnBatchLock
+    {
+    public:
+        explicit ColumnBatchLock(ColumnBatch &batch)
+            : m_batch(batch)
+        {
+            m_batch.set_locked(true);
+        }
+        ~ColumnBatchLock()
+        {
+            m_batch.set_locked(false);
+        }
+
+        ColumnBatchLock(const ColumnBatchLock &) = delete;
+        ColumnBatchLock &operator=(const ColumnBatchLock &) = delete;
+
+    private:
+        ColumnBatch &m_batch;
+    };
+}
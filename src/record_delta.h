@@ -0,0 +1,214 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ki/dml/Record.h>
+#include <ki/dml/Field.h>
+#include <ki/dml/exception.h>
+#include <ki/protocol/dml/Message.h>
+#include <ki/protocol/dml/MessageManager.h>
+#include <ki/protocol/dml/MessageModule.h>
+#include <ki/protocol/dml/MessageTemplate.h>
+
+#include "message_codec.h"
+#include "field_types.h"
+
+namespace kipy
+{
+    namespace detail
+    {
+        struct FieldValueWriter
+        {
+            const ki::dml::FieldBase &field;
+            ByteWriter &writer;
+
+            template <typename ValueT>
+            void visit() const
+            {
+                write_value(writer,
+                    static_cast<const ki::dml::Field<ValueT> &>(field).get_value());
+            }
+        };
+
+        struct FieldValueReader
+        {
+            ki::dml::FieldBase &field;
+            ByteReader &reader;
+
+            template <typename ValueT>
+            void visit() const
+            {
+                ValueT value;
+                read_value(reader, value);
+                static_cast<ki::dml::Field<ValueT> &>(field).set_value(value);
+            }
+        };
+
+        inline uint16_t get_message_key(const uint8_t service_id, const uint8_t type)
+        {
+            return static_cast<uint16_t>((service_id << 8) | type);
+        }
+    }
+
+    /**
+     * Field-level deltas between consecutive records of the same message.
+     *
+     * A delta is laid out as the service ID (UBYT), message type (UBYT),
+     * field count (USHRT), a bitmask with one bit per transferable field
+     * (set if the field changed), and finally the values of the changed
+     * fields, in field order.
+     */
+    class RecordDeltaEncoder
+    {
+    public:
+        /**
+         * Returns the delta between the given message and the last one
+         * of the same type that was encoded, and remembers it as the
+         * new baseline. The first message of each type sets every bit.
+         */
+        std::string encode(const ki::protocol::dml::Message &message)
+        {
+            auto &message_ref = const_cast<ki::protocol::dml::Message &>(message);
+            const auto &record = *message_ref.get_record();
+            auto &baseline = m_baselines[detail::get_message_key(
+                message.get_service_id(), message.get_type())];
+
+            // Serialize each field on its own, so it can be compared
+            // against the baseline.
+            std::vector<std::string> values;
+            for (auto it = record.fields_begin(); it != record.fields_end(); ++it)
+            {
+                const ki::dml::FieldBase *field = *it;
+                if (!field->is_transferable())
+                    continue;
+
+                values.emplace_back();
+                ByteWriter writer(values.back());
+                const detail::FieldValueWriter visitor = { *field, writer };
+                visit_field_type(get_field_type(*field), visitor);
+            }
+            if (values.size() > UINT16_MAX)
+                throw ki::dml::value_error("Record has too many fields to delta encode.");
+
+            const bool full = baseline.size() != values.size();
+            std::string delta;
+            ByteWriter writer(delta);
+            write_value(writer, message.get_service_id());
+            write_value(writer, message.get_type());
+            write_value(writer, static_cast<uint16_t>(values.size()));
+
+            const auto mask_offset = delta.size();
+            delta.append((values.size() + 7) / 8, '\0');
+            for (size_t i = 0; i < values.size(); ++i)
+            {
+                if (!full && values[i] == baseline[i])
+                    continue;
+
+                delta[mask_offset + i / 8] |= static_cast<char>(1 << (i % 8));
+                writer.write_bytes(values[i].data(), values[i].size());
+            }
+
+            baseline.swap(values);
+            return delta;
+        }
+
+        /**
+         * Forgets every baseline, so that the next message of each type
+         * is encoded in full.
+         */
+        void reset() { m_baselines.clear(); }
+
+    private:
+        std::unordered_map<uint16_t, std::vector<std::string>> m_baselines;
+    };
+
+    /**
+     * Applies deltas produced by a RecordDeltaEncoder onto cached
+     * messages, one per message type.
+     */
+    class RecordDeltaDecoder
+    {
+    public:
+        explicit RecordDeltaDecoder(const ki::protocol::dml::MessageManager &manager)
+            : m_manager(manager) {}
+
+        const ki::protocol::dml::MessageManager &get_manager() const { return m_manager; }
+
+        /**
+         * Patches the cached message of the delta's type, and returns it.
+         */
+        const ki::protocol::dml::Message &apply(const char *data, const size_t size)
+        {
+            ByteReader reader(data, size);
+            uint8_t service_id, type;
+            uint16_t field_count;
+            read_value(reader, service_id);
+            read_value(reader, type);
+            read_value(reader, field_count);
+
+            auto &message = get_message(service_id, type);
+            auto &fields = get_transferable_fields(service_id, type, message);
+            if (fields.size() != field_count)
+                throw ki::dml::parse_error("Delta field count does not match the message template.");
+
+            const auto *mask = reader.read_bytes((field_count + 7) / 8);
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (!(static_cast<uint8_t>(mask[i / 8]) & (1 << (i % 8))))
+                    continue;
+
+                const detail::FieldValueReader visitor = { *fields[i], reader };
+                visit_field_type(get_field_type(*fields[i]), visitor);
+            }
+            if (!reader.is_empty())
+                throw ki::dml::parse_error("Delta has trailing data.");
+            return message;
+        }
+
+        void reset()
+        {
+            m_messages.clear();
+            m_fields.clear();
+        }
+
+    private:
+        const ki::protocol::dml::MessageManager &m_manager;
+        std::unordered_map<uint16_t, std::unique_ptr<ki::protocol::dml::Message>> m_messages;
+        std::unordered_map<uint16_t, std::vector<ki::dml::FieldBase *>> m_fields;
+
+        ki::protocol::dml::Message &get_message(const uint8_t service_id, const uint8_t type)
+        {
+            auto &message = m_messages[detail::get_message_key(service_id, type)];
+            if (!message)
+            {
+                const auto *module = m_manager.get_module(service_id);
+                const auto *message_template = module ? module->get_message_template(type) : nullptr;
+                if (!message_template)
+                    throw ki::dml::parse_error("Delta refers to an unknown message type.");
+                message.reset(message_template->create_message());
+            }
+            return *message;
+        }
+
+        std::vector<ki::dml::FieldBase *> &get_transferable_fields(
+            const uint8_t service_id, const uint8_t type, ki::protocol::dml::Message &message)
+        {
+            const auto key = detail::get_message_key(service_id, type);
+            auto it = m_fields.find(key);
+            if (it != m_fields.end())
+                return it->second;
+
+            auto &fields = m_fields[key];
+            const auto &record = *message.get_record();
+            for (auto field_it = record.fields_begin(); field_it != record.fields_end(); ++field_it)
+            {
+                if ((*field_it)->is_transferable())
+                    fields.push_back(*field_it);
+            }
+            return fields;
+        }
+    };
+}
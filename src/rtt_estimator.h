@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace kipy
+{
+    /**
+     * Tracks the round-trip time of a session.
+     *
+     * The smoothed RTT and its variation follow RFC 6298 (gains of 1/8
+     * and 1/4). Percentiles come from a log-scale histogram with two
+     * buckets per power of two (so they overestimate by less than
+     * half). Whenever the histogram reaches HISTOGRAM_LIMIT samples,
+     * every bucket is halved, so a sample loses half its weight with
+     * every HISTOGRAM_LIMIT / 2 or so that follow it; at a 10 second
+     * keep alive interval, percentiles mostly reflect the last ten to
+     * twenty minutes.
+     *
+     * Times are kept in microseconds.
+     */
+    class RttEstimator
+    {
+    public:
+        static const size_t BUCKETS_PER_OCTAVE = 2;
+        static const size_t OCTAVES = 26;
+        static const size_t BUCKET_COUNT = BUCKETS_PER_OCTAVE * OCTAVES;
+        static const uint32_t HISTOGRAM_LIMIT = 128;
+
+        RttEstimator()
+            : m_sample_count(0), m_last(0), m_min(0), m_max(0),
+              m_srtt(0), m_rttvar(0), m_histogram(), m_histogram_total(0) {}
+
+        uint64_t get_sample_count() const { return m_sample_count; }
+        uint32_t get_last() const { return m_last; }
+        uint32_t get_min() const { return m_min; }
+        uint32_t get_max() const { return m_max; }
+        double get_srtt() const { return m_srtt; }
+        double get_rttvar() const { return m_rttvar; }
+
+        void add_sample(const uint32_t rtt)
+        {
+            if (m_sample_count == 0)
+            {
+                m_min = m_max = rtt;
+                m_srtt = rtt;
+                m_rttvar = rtt / 2.0;
+            }
+            else
+            {
+                m_min = std::min(m_min, rtt);
+                m_max = std::max(m_max, rtt);
+                m_rttvar += (std::abs(m_srtt - rtt) - m_rttvar) / 4.0;
+                m_srtt += (rtt - m_srtt) / 8.0;
+            }
+            m_last = rtt;
+            ++m_sample_count;
+
+            ++m_histogram[get_bucket(rtt)];
+            if (++m_histogram_total < HISTOGRAM_LIMIT)
+                return;
+
+            m_histogram_total = 0;
+            for (auto &count : m_histogram)
+            {
+                count /= 2;
+                m_histogram_total += count;
+            }
+        }
+
+        /**
+         * Returns the estimated RTT at the given quantile (0.0 to 1.0),
+         * or 0 if there are no samples.
+         */
+        uint32_t get_percentile(const double quantile) const
+        {
+            if (m_histogram_total == 0)
+                return 0;
+
+            const auto rank = static_cast<uint32_t>(
+                std::ceil(std::max(0.0, std::min(quantile, 1.0)) * m_histogram_total));
+            uint32_t seen = 0;
+            for (size_t i = 0; i < BUCKET_COUNT; ++i)
+            {
+                seen += m_histogram[i];
+                if (seen < rank || m_histogram[i] == 0)
+                    continue;
+
+                // The last bucket also holds everything above it.
+                if (i == BUCKET_COUNT - 1)
+                    return m_max;
+                return std::max(m_min, std::min(m_max, get_bucket_upper_bound(i)));
+            }
+            return m_max;
+        }
+
+        void reset() { *this = RttEstimator(); }
+
+    private:
+        uint64_t m_sample_count;
+        uint32_t m_last;
+        uint32_t m_min;
+        uint32_t m_max;
+        double m_srtt;
+        double m_rttvar;
+        uint16_t m_histogram[BUCKET_COUNT];
+        uint32_t m_histogram_total;
+
+        static size_t get_bucket(const uint32_t rtt)
+        {
+            if (rtt < 2)
+                return 0;
+
+            // The octave is the position of the highest set bit; the bit
+            // below it picks the lower or upper half of the octave.
+            size_t octave = 1;
+            while (octave < 31 && (rtt >> (octave + 1)) != 0)
+                ++octave;
+            const size_t half = (rtt >> (octave - 1)) & 1;
+            return std::min(octave * BUCKETS_PER_OCTAVE + half, BUCKET_COUNT - 1);
+        }
+
+        static uint32_t get_bucket_upper_bound(const size_t bucket)
+        {
+            const auto octave = bucket / BUCKETS_PER_OCTAVE;
+            if (octave == 0)
+                return 1;
+            const uint64_t base = uint64_t(1) << octave;
+            const uint64_t bound = bucket % BUCKETS_PER_OCTAVE
+                ? base * 2 - 1 : base + base / 2 - 1;
+            return static_cast<uint32_t>(std::min<uint64_t>(
+                bound, std::numeric_limits<uint32_t>::max()));
+        }
+    };
+
+    /**
+     * Gives a session class an RttEstimator, fed by timing its own keep
+     * alive requests against the peer's responses on a monotonic clock.
+     */
+    class LatencyTracked
+    {
+    public:
+        LatencyTracked() : m_keep_alive_pending(false) {}
+        virtual ~LatencyTracked() {}
+
+        const RttEstimator &get_rtt() const { return m_rtt; }
+        RttEstimator &get_rtt() { return m_rtt; }
+
+    protected:
+        /**
+         * To be called with every outgoing frame.
+         */
+        void on_frame_sent(const char *data, const size_t size, const uint8_t keep_alive_opcode)
+        {
+            // Frame header (4 bytes), then the control flag and opcode.
+            if (size >= 6 && data[4] != 0 && static_cast<uint8_t>(data[5]) == keep_alive_opcode)
+            {
+                m_keep_alive_sent = std::chrono::steady_clock::now();
+                m_keep_alive_pending = true;
+            }
+        }
+
+        /**
+         * To be called when a keep alive response arrives.
+         */
+        void on_keep_alive_response()
+        {
+            if (!m_keep_alive_pending)
+                return;
+
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_keep_alive_sent).count();
+            m_rtt.add_sample(static_cast<uint32_t>(std::min<int64_t>(
+                elapsed, std::numeric_limits<uint32_t>::max())));
+            m_keep_alive_pending = false;
+        }
+
+    private:
+        RttEstimator m_rtt;
+        std::chrono::steady_clock::time_point m_keep_alive_sent;
+        bool m_keep_alive_pending;
+    };
+}
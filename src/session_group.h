@@ -0,0 +1,314 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <pybind11/pybind11.h>
+
+#include <ki/protocol/net/Session.h>
+
+namespace kipy
+{
+    namespace py = pybind11;
+
+    class SessionRegistry;
+
+    /**
+     * A set of session IDs, stored as a bitset over the whole 16-bit ID
+     * space, so that membership changes are a single bit flip and set
+     * operations work a word (64 sessions) at a time.
+     *
+     * Groups created from a SessionRegistry are told when its sessions
+     * go away, so that a closed session (and whichever session reuses
+     * its ID) is never a member by accident.
+     */
+    class SessionGroup
+    {
+    public:
+        static const size_t MAX_SESSIONS = 0x10000;
+        static const size_t WORD_COUNT = MAX_SESSIONS / 64;
+
+        explicit SessionGroup(SessionRegistry *registry = nullptr)
+            : m_registry(nullptr), m_previous(nullptr), m_next(nullptr),
+              m_words(), m_size(0)
+        {
+            attach(registry);
+        }
+
+        SessionGroup(const SessionGroup &other)
+            : m_registry(nullptr), m_previous(nullptr), m_next(nullptr),
+              m_size(other.m_size)
+        {
+            std::memcpy(m_words, other.m_words, sizeof(m_words));
+            attach(other.m_registry);
+        }
+
+        SessionGroup &operator=(const SessionGroup &other)
+        {
+            if (this != &other)
+            {
+                std::memcpy(m_words, other.m_words, sizeof(m_words));
+                m_size = other.m_size;
+                if (m_registry != other.m_registry)
+                {
+                    detach();
+                    attach(other.m_registry);
+                }
+            }
+            return *this;
+        }
+
+        ~SessionGroup()
+        {
+            detach();
+        }
+
+        SessionRegistry *get_registry() const { return m_registry; }
+        size_t get_size() const { return m_size; }
+        bool is_empty() const { return m_size == 0; }
+
+        bool contains(const uint16_t session_id) const
+        {
+            return (m_words[session_id / 64] >> (session_id % 64)) & 1;
+        }
+
+        /**
+         * Returns false if the session was already a member.
+         */
+        bool add(const uint16_t session_id)
+        {
+            const uint64_t bit = uint64_t(1) << (session_id % 64);
+            auto &word = m_words[session_id / 64];
+            if (word & bit)
+                return false;
+            word |= bit;
+            ++m_size;
+            return true;
+        }
+
+        /**
+         * Returns false if the session was not a member.
+         */
+        bool remove(const uint16_t session_id)
+        {
+            const uint64_t bit = uint64_t(1) << (session_id % 64);
+            auto &word = m_words[session_id / 64];
+            if (!(word & bit))
+                return false;
+            word &= ~bit;
+            --m_size;
+            return true;
+        }
+
+        void clear()
+        {
+            std::memset(m_words, 0, sizeof(m_words));
+            m_size = 0;
+        }
+
+        SessionGroup &operator|=(const SessionGroup &other)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] |= other.m_words[i];
+            recount();
+            return *this;
+        }
+
+        SessionGroup &operator&=(const SessionGroup &other)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] &= other.m_words[i];
+            recount();
+            return *this;
+        }
+
+        SessionGroup &operator-=(const SessionGroup &other)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] &= ~other.m_words[i];
+            recount();
+            return *this;
+        }
+
+        SessionGroup &operator^=(const SessionGroup &other)
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+                m_words[i] ^= other.m_words[i];
+            recount();
+            return *this;
+        }
+
+        bool operator==(const SessionGroup &other) const
+        {
+            return m_size == other.m_size &&
+                std::memcmp(m_words, other.m_words, sizeof(m_words)) == 0;
+        }
+
+        bool operator!=(const SessionGroup &other) const
+        {
+            return !(*this == other);
+        }
+
+        /**
+         * Calls `func(uint16_t session_id)` for every member, in
+         * ascending order of ID. Empty words are skipped, so sparse
+         * groups are cheap to walk.
+         */
+        template <typename FuncT>
+        void for_each(FuncT &&func) const
+        {
+            for (size_t i = 0; i < WORD_COUNT; ++i)
+            {
+                auto word = m_words[i];
+                while (word)
+                {
+                    func(static_cast<uint16_t>(i * 64 + count_trailing_zeros(word)));
+                    word &= word - 1;
+                }
+            }
+        }
+
+        std::vector<uint16_t> get_members() const
+        {
+            std::vector<uint16_t> members;
+            members.reserve(m_size);
+            for_each([&members](const uint16_t session_id) { members.push_back(session_id); });
+            return members;
+        }
+
+    private:
+        friend class SessionRegistry;
+
+        SessionRegistry *m_registry;
+        SessionGroup *m_previous;
+        SessionGroup *m_next;
+
+        uint64_t m_words[WORD_COUNT];
+        size_t m_size;
+
+        inline void attach(SessionRegistry *registry);
+        inline void detach();
+
+        void recount()
+        {
+            m_size = 0;
+            for (const auto word : m_words)
+                m_size += count_bits(word);
+        }
+
+        static size_t count_bits(const uint64_t word)
+        {
+#if _MSC_VER
+            return static_cast<size_t>(__popcnt64(word));
+#else
+            return static_cast<size_t>(__builtin_popcountll(word));
+#endif
+        }
+
+        static size_t count_trailing_zeros(const uint64_t word)
+        {
+#if _MSC_VER
+            unsigned long index;
+            _BitScanForward64(&index, word);
+            return index;
+#else
+            return static_cast<size_t>(__builtin_ctzll(word));
+#endif
+        }
+    };
+
+    /**
+     * Maps session IDs to their sessions, for groups to send through.
+     *
+     * Sessions are not owned; they must be removed before they are
+     * destroyed. Removing a session also removes it from every group
+     * created from the registry.
+     *
+     * A session may also be given a writer: a callable that takes a
+     * complete frame as bytes and writes it straight to the session's
+     * transport. Groups send through the writer when there is one, so
+     * that a frame is shared by every member instead of being copied
+     * into each session's Session::send_packet_data().
+     */
+    class SessionRegistry
+    {
+    public:
+        SessionRegistry()
+            : m_sessions(SessionGroup::MAX_SESSIONS, nullptr),
+              m_writers(SessionGroup::MAX_SESSIONS), m_groups(nullptr) {}
+
+        SessionRegistry(const SessionRegistry &) = delete;
+        SessionRegistry &operator=(const SessionRegistry &) = delete;
+
+        ~SessionRegistry()
+        {
+            while (m_groups)
+                m_groups->detach();
+        }
+
+        ki::protocol::net::Session *get(const uint16_t session_id) const
+        {
+            return m_sessions[session_id];
+        }
+
+        const py::object &get_writer(const uint16_t session_id) const
+        {
+            return m_writers[session_id];
+        }
+
+        void add(ki::protocol::net::Session &session, py::object writer = py::object())
+        {
+            m_sessions[session.get_id()] = &session;
+            m_writers[session.get_id()] = writer.is_none() ? py::object() : std::move(writer);
+        }
+
+        void remove(const uint16_t session_id)
+        {
+            m_sessions[session_id] = nullptr;
+            m_writers[session_id] = py::object();
+            for (auto *group = m_groups; group; group = group->m_next)
+                group->remove(session_id);
+        }
+
+    private:
+        friend class SessionGroup;
+
+        std::vector<ki::protocol::net::Session *> m_sessions;
+        std::vector<py::object> m_writers;
+        SessionGroup *m_groups;
+    };
+
+    void SessionGroup::attach(SessionRegistry *registry)
+    {
+        m_registry = registry;
+        if (!registry)
+            return;
+
+        m_previous = nullptr;
+        m_next = registry->m_groups;
+        if (m_next)
+            m_next->m_previous = this;
+        registry->m_groups = this;
+    }
+
+    void SessionGroup::detach()
+    {
+        if (!m_registry)
+            return;
+
+        if (m_previous)
+            m_previous->m_next = m_next;
+        else
+            m_registry->m_groups = m_next;
+        if (m_next)
+            m_next->m_previous = m_previous;
+
+        m_registry = nullptr;
+        m_previous = m_next = nullptr;
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace kipy
+{
+    /**
+     * Hands out fixed-size blocks carved from large chunks.
+     *
+     * Servers keep tens of thousands of sessions alive at once, and
+     * allocating each one separately costs an allocator header per
+     * session and scatters them across the heap. Freed blocks are
+     * kept on a free list and reused; chunks are never returned.
+     */
+    class SlabAllocator
+    {
+    public:
+        static const size_t BLOCKS_PER_CHUNK = 256;
+
+        explicit SlabAllocator(const size_t block_size)
+            : m_block_size(align(block_size)), m_free_list(nullptr),
+              m_blocks_in_use(0) {}
+
+        SlabAllocator(const SlabAllocator &) = delete;
+        SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+        size_t get_block_size() const { return m_block_size; }
+        size_t get_chunk_count() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_chunks.size();
+        }
+        size_t get_blocks_in_use() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_blocks_in_use;
+        }
+        size_t get_blocks_reserved() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_chunks.size() * BLOCKS_PER_CHUNK;
+        }
+
+        void *allocate(const size_t size)
+        {
+            // Anything larger (a further derived type) takes the
+            // regular route.
+            if (size > m_block_size)
+                return ::operator new(size);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_free_list)
+                add_chunk();
+
+            auto *block = m_free_list;
+            m_free_list = block->next;
+            ++m_blocks_in_use;
+            return block;
+        }
+
+        void deallocate(void *pointer, const size_t size)
+        {
+            if (!pointer)
+                return;
+            if (size > m_block_size)
+            {
+                ::operator delete(pointer);
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto *block = static_cast<FreeBlock *>(pointer);
+            block->next = m_free_list;
+            m_free_list = block;
+            --m_blocks_in_use;
+        }
+
+    private:
+        struct FreeBlock
+        {
+            FreeBlock *next;
+        };
+
+        typedef std::aligned_storage<
+            sizeof(std::max_align_t), alignof(std::max_align_t)>::type AlignedT;
+
+        size_t m_block_size;
+        FreeBlock *m_free_list;
+        size_t m_blocks_in_use;
+        std::vector<std::unique_ptr<AlignedT[]>> m_chunks;
+        mutable std::mutex m_mutex;
+
+        static size_t align(const size_t size)
+        {
+            const auto alignment = sizeof(AlignedT);
+            const auto aligned = (size + alignment - 1) / alignment * alignment;
+            return aligned < sizeof(FreeBlock) ? sizeof(FreeBlock) : aligned;
+        }
+
+        void add_chunk()
+        {
+            const auto units = m_block_size / sizeof(AlignedT);
+            std::unique_ptr<AlignedT[]> chunk(new AlignedT[units * BLOCKS_PER_CHUNK]);
+
+            // Thread every block of the new chunk onto the free list.
+            for (auto i = BLOCKS_PER_CHUNK; i > 0; --i)
+            {
+                auto *block = reinterpret_cast<FreeBlock *>(&chunk[(i - 1) * units]);
+                block->next = m_free_list;
+                m_free_list = block;
+            }
+            m_chunks.push_back(std::move(chunk));
+        }
+    };
+
+    template <typename SessionT>
+    SlabAllocator &get_session_slab()
+    {
+        // Never destroyed, as sessions may outlive static destruction.
+        static auto *slab = new SlabAllocator(sizeof(SessionT));
+        return *slab;
+    }
+
+    /**
+     * Gives a session class slab-backed operator new/delete.
+     */
+    template <typename SessionT>
+    class SlabAllocated
+    {
+    public:
+        static void *operator new(const size_t size)
+        {
+            return get_session_slab<SessionT>().allocate(size);
+        }
+
+        static void operator delete(void *pointer, const size_t size)
+        {
+            get_session_slab<SessionT>().deallocate(pointer, size);
+        }
+    };
+}
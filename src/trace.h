@@ -0,0 +1,374 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <ki/protocol/exception.h>
+
+namespace kipy
+{
+    enum class TraceEventType : uint8_t
+    {
+        FRAME_SENT = 1,
+        CONTROL_RECEIVED = 2,
+        APPLICATION_RECEIVED = 3,
+        MESSAGE_RECEIVED = 4,
+        INVALID_PACKET = 5,
+        INVALID_MESSAGE = 6,
+        CLOSED = 7
+    };
+
+    /**
+     * A single trace point hit. Fields that do not apply to the event
+     * type are left as zero.
+     */
+    struct TraceEvent
+    {
+        // Nanoseconds, from std::chrono::steady_clock.
+        uint64_t timestamp;
+        uint32_t size;
+        // An error code, where one applies.
+        uint32_t detail;
+        uint16_t session_id;
+        TraceEventType type;
+        bool control;
+        uint8_t opcode;
+        uint8_t service_id;
+        uint8_t message_type;
+    };
+
+    /**
+     * Records trace events into a lock-free, fixed-size ring, where the
+     * newest events overwrite the oldest.
+     *
+     * Nothing is recorded unless a sample rate is set (every Nth event
+     * is recorded), or specific sessions are traced (every one of their
+     * events is recorded). When neither is the case, a trace point costs
+     * two relaxed atomic loads.
+     *
+     * Writers claim a slot with a single fetch_add, and publish it with
+     * a sequence number, so that dump() can run alongside them and skip
+     * slots that are mid-write.
+     */
+    class Tracer
+    {
+    public:
+        static const size_t DEFAULT_CAPACITY = 0x10000;
+        static const size_t MAX_SESSIONS = 0x10000;
+
+        // Dump file layout: magic ("KITRACE\0"), version, event size,
+        // event count, then the steady and system clocks at the time of
+        // the dump (in nanoseconds), so that timestamps can be placed in
+        // time. The events follow.
+        static const uint16_t DUMP_VERSION = 1;
+        static const size_t DUMP_HEADER_SIZE = 8 + 2 + 2 + 4 + 8 + 8;
+        static const size_t DUMP_EVENT_SIZE = 24;
+
+        Tracer()
+            : m_capacity(DEFAULT_CAPACITY), m_slots(nullptr), m_head(0), m_sample_rate(0),
+              m_traced_session_count(0), m_sessions() {}
+
+        Tracer(const Tracer &) = delete;
+        Tracer &operator=(const Tracer &) = delete;
+
+        size_t get_capacity() const { return m_capacity; }
+        uint64_t get_events_recorded() const { return m_head.load(std::memory_order_relaxed); }
+        uint32_t get_sample_rate() const { return m_sample_rate.load(std::memory_order_relaxed); }
+
+        /**
+         * Sets the ring's capacity (rounded up to a power of two). Only
+         * possible before tracing is first enabled.
+         */
+        void set_capacity(const size_t capacity)
+        {
+            if (m_slots.load(std::memory_order_acquire))
+                throw ki::protocol::runtime_error(
+                    "The trace buffer's capacity can not be changed once tracing has been enabled.");
+            size_t rounded = 1;
+            while (rounded < capacity)
+                rounded <<= 1;
+            m_capacity = rounded;
+        }
+
+        /**
+         * Records one in every `rate` events, across all sessions.
+         * A rate of 0 disables sampling.
+         */
+        void set_sample_rate(const uint32_t rate)
+        {
+            if (rate > 0)
+                allocate();
+            m_sample_rate.store(rate, std::memory_order_relaxed);
+        }
+
+        /**
+         * Records every event of the given session, regardless of the
+         * sample rate.
+         */
+        void set_session_traced(const uint16_t session_id, const bool traced)
+        {
+            if (traced)
+                allocate();
+
+            const uint64_t bit = uint64_t(1) << (session_id % 64);
+            auto &word = m_sessions[session_id / 64];
+            const auto previous = traced
+                ? word.fetch_or(bit, std::memory_order_relaxed)
+                : word.fetch_and(~bit, std::memory_order_relaxed);
+            if (traced && !(previous & bit))
+                m_traced_session_count.fetch_add(1, std::memory_order_relaxed);
+            else if (!traced && (previous & bit))
+                m_traced_session_count.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        bool is_session_traced(const uint16_t session_id) const
+        {
+            return (m_sessions[session_id / 64].load(std::memory_order_relaxed) >>
+                (session_id % 64)) & 1;
+        }
+
+        /**
+         * Returns whether or not an event for the given session should
+         * be recorded.
+         */
+        bool should_trace(const uint16_t session_id)
+        {
+            const auto rate = m_sample_rate.load(std::memory_order_relaxed);
+            if (m_traced_session_count.load(std::memory_order_relaxed) > 0 &&
+                is_session_traced(session_id))
+                return true;
+            if (rate == 0)
+                return false;
+
+            thread_local uint32_t counter = 0;
+            if (++counter < rate)
+                return false;
+            counter = 0;
+            return true;
+        }
+
+        void record(const TraceEvent &event)
+        {
+            const auto index = m_head.fetch_add(1, std::memory_order_relaxed);
+            auto &slot = m_slots.load(std::memory_order_acquire)[index & (m_capacity - 1)];
+
+            uint64_t words[WORDS_PER_EVENT];
+            pack(event, words);
+
+            // Odd while being written, then 2 * (index + 1).
+            slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < WORDS_PER_EVENT; ++i)
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+            slot.sequence.store(index * 2 + 2, std::memory_order_release);
+        }
+
+        /**
+         * Returns the recorded events, oldest first, in the dump file
+         * format.
+         */
+        std::string dump() const
+        {
+            std::string events;
+            uint32_t count = 0;
+            const auto *slots = m_slots.load(std::memory_order_acquire);
+            if (slots)
+            {
+                const auto head = m_head.load(std::memory_order_acquire);
+                const auto first = head > m_capacity ? head - m_capacity : 0;
+                for (auto index = first; index < head; ++index)
+                {
+                    const auto &slot = slots[index & (m_capacity - 1)];
+                    const auto expected = index * 2 + 2;
+                    if (slot.sequence.load(std::memory_order_acquire) != expected)
+                        continue;
+
+                    uint64_t words[WORDS_PER_EVENT];
+                    for (size_t i = 0; i < WORDS_PER_EVENT; ++i)
+                        words[i] = slot.words[i].load(std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.sequence.load(std::memory_order_relaxed) != expected)
+                        continue;
+
+                    // Words are packed little-endian; see pack().
+                    for (size_t i = 0; i < WORDS_PER_EVENT; ++i)
+                        for (size_t byte = 0; byte < 8; ++byte)
+                            events.push_back(static_cast<char>(words[i] >> (byte * 8)));
+                    ++count;
+                }
+            }
+
+            std::string data("KITRACE\0", 8);
+            append_le(data, DUMP_VERSION, 2);
+            append_le(data, DUMP_EVENT_SIZE, 2);
+            append_le(data, count, 4);
+            append_le(data, static_cast<uint64_t>(get_steady_time()), 8);
+            append_le(data, static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count()), 8);
+            data += events;
+            return data;
+        }
+
+        /**
+         * Writes dump() to a file. Returns the number of events written.
+         */
+        size_t dump(const std::string &filepath) const
+        {
+            const auto data = dump();
+            std::ofstream ofs(filepath, std::ios::binary);
+            if (!ofs.write(data.data(), data.size()))
+                throw ki::protocol::runtime_error("Failed to write trace file: " + filepath);
+            return (data.size() - DUMP_HEADER_SIZE) / DUMP_EVENT_SIZE;
+        }
+
+        static int64_t get_steady_time()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    private:
+        static const size_t WORDS_PER_EVENT = DUMP_EVENT_SIZE / 8;
+
+        struct Slot
+        {
+            std::atomic<uint64_t> sequence;
+            std::atomic<uint64_t> words[WORDS_PER_EVENT];
+        };
+
+        size_t m_capacity;
+        std::atomic<Slot *> m_slots;
+        std::atomic<uint64_t> m_head;
+        std::atomic<uint32_t> m_sample_rate;
+        std::atomic<uint32_t> m_traced_session_count;
+        std::atomic<uint64_t> m_sessions[MAX_SESSIONS / 64];
+
+        void allocate()
+        {
+            // Slots are never freed or moved, as writers on other threads
+            // may be using them at any time.
+            if (m_slots.load(std::memory_order_acquire))
+                return;
+
+            auto *slots = new Slot[m_capacity];
+            for (size_t i = 0; i < m_capacity; ++i)
+                slots[i].sequence.store(0, std::memory_order_relaxed);
+            Slot *expected = nullptr;
+            if (!m_slots.compare_exchange_strong(expected, slots, std::memory_order_acq_rel))
+                delete[] slots;
+        }
+
+        /**
+         * Lays an event out as the dump file does: timestamp (8 bytes),
+         * size, detail (4 bytes each), session ID (2 bytes), and then
+         * the type, control flag, opcode, service ID, and message type
+         * (1 byte each), followed by one byte of padding.
+         */
+        static void pack(const TraceEvent &event, uint64_t (&words)[WORDS_PER_EVENT])
+        {
+            words[0] = event.timestamp;
+            words[1] = event.size | (uint64_t(event.detail) << 32);
+            words[2] = event.session_id
+                | (uint64_t(event.type) << 16)
+                | (uint64_t(event.control) << 24)
+                | (uint64_t(event.opcode) << 32)
+                | (uint64_t(event.service_id) << 40)
+                | (uint64_t(event.message_type) << 48);
+        }
+
+        template <typename IntegerT>
+        static void append_le(std::string &data, const IntegerT value, const size_t size)
+        {
+            for (size_t byte = 0; byte < size; ++byte)
+                data.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (byte * 8)));
+        }
+    };
+
+    inline Tracer &get_tracer()
+    {
+        // Never destroyed, as sessions may outlive static destruction.
+        static auto *tracer = new Tracer();
+        return *tracer;
+    }
+
+    /**
+     * Trace points.
+     */
+    inline void trace_frame(const TraceEventType type, const uint16_t session_id,
+        const char *data, const size_t size)
+    {
+        auto &tracer = get_tracer();
+        if (!tracer.should_trace(session_id))
+            return;
+
+        // Frame header (4 bytes), packet header (4 bytes), and for DML
+        // application packets, the service ID and message type.
+        TraceEvent event = {};
+        event.timestamp = Tracer::get_steady_time();
+        event.size = static_cast<uint32_t>(size);
+        event.session_id = session_id;
+        event.type = type;
+        if (size >= 6)
+        {
+            event.control = data[4] != 0;
+            event.opcode = static_cast<uint8_t>(data[5]);
+        }
+        if (size >= 10 && !event.control && event.opcode == 0)
+        {
+            event.service_id = static_cast<uint8_t>(data[8]);
+            event.message_type = static_cast<uint8_t>(data[9]);
+        }
+        tracer.record(event);
+    }
+
+    inline void trace_packet(const TraceEventType type, const uint16_t session_id,
+        const bool control, const uint8_t opcode)
+    {
+        auto &tracer = get_tracer();
+        if (!tracer.should_trace(session_id))
+            return;
+
+        TraceEvent event = {};
+        event.timestamp = Tracer::get_steady_time();
+        event.session_id = session_id;
+        event.type = type;
+        event.control = control;
+        event.opcode = opcode;
+        tracer.record(event);
+    }
+
+    inline void trace_message(const uint16_t session_id,
+        const uint8_t service_id, const uint8_t message_type)
+    {
+        auto &tracer = get_tracer();
+        if (!tracer.should_trace(session_id))
+            return;
+
+        TraceEvent event = {};
+        event.timestamp = Tracer::get_steady_time();
+        event.session_id = session_id;
+        event.type = TraceEventType::MESSAGE_RECEIVED;
+        event.service_id = service_id;
+        event.message_type = message_type;
+        tracer.record(event);
+    }
+
+    inline void trace_error(const TraceEventType type, const uint16_t session_id,
+        const uint32_t error)
+    {
+        auto &tracer = get_tracer();
+        if (!tracer.should_trace(session_id))
+            return;
+
+        TraceEvent event = {};
+        event.timestamp = Tracer::get_steady_time();
+        event.session_id = session_id;
+        event.type = type;
+        event.detail = error;
+        tracer.record(event);
+    }
+}
@@ -0,0 +1,533 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define KIPY_HAS_ZEROCOPY 1
+#endif
+#endif
+
+#include "receive_buffer.h"
+#include "trace.h"
+
+namespace kipy
+{
+    class BufferPool;
+
+    /**
+     * The zero-copy sends on a single socket that the kernel may still
+     * be reading from, and the buffers they were sent from.
+     */
+    class ZeroCopyCompletions
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        explicit ZeroCopyCompletions(const int fd)
+            : m_fd(fd), m_next_send_id(0), m_copied_sends(0) {}
+
+        int get_fd() const { return m_fd; }
+        size_t get_pending() const { return m_pending.size(); }
+        uint64_t get_copied_sends() const { return m_copied_sends; }
+
+        void add(char *buffer)
+        {
+            m_pending.push_back({ m_next_send_id++, buffer });
+        }
+
+        /**
+         * Reads the completions that the kernel has reported through
+         * the socket's error queue, and returns their buffers to the
+         * pool. Returns the number of buffers recycled.
+         */
+        inline size_t poll(BufferPool &pool);
+
+        /**
+         * Makes these sends outlive the socket's original descriptor,
+         * by moving them to a duplicate of it, and ends the connection's
+         * outgoing half so that the peer still sees it close. The sends
+         * should complete by `deadline`, or be aborted.
+         */
+        ZeroCopyCompletions detach(const Clock::time_point deadline)
+        {
+            ZeroCopyCompletions completions(-1);
+#ifdef KIPY_HAS_ZEROCOPY
+            completions.m_fd = dup(m_fd);
+            if (completions.m_fd >= 0)
+                shutdown(completions.m_fd, SHUT_WR);
+#endif
+            completions.m_deadline = deadline;
+            completions.m_next_send_id = m_next_send_id;
+            completions.m_pending.swap(m_pending);
+            return completions;
+        }
+
+        bool is_expired(const Clock::time_point now) const
+        {
+            return now >= m_deadline;
+        }
+
+        /**
+         * Resets the connection, which makes the kernel drop whatever it
+         * has not sent yet, and returns every buffer to the pool.
+         * Returns the number of buffers recycled.
+         */
+        inline size_t abort(BufferPool &pool);
+
+        /**
+         * Closes the descriptor that detach() made.
+         */
+        void close_fd()
+        {
+#ifdef KIPY_HAS_ZEROCOPY
+            close(m_fd);
+#endif
+            m_fd = -1;
+        }
+
+    private:
+        struct PendingSend
+        {
+            uint32_t id;
+            char *buffer;
+        };
+
+        int m_fd;
+        Clock::time_point m_deadline;
+        // The kernel numbers zero-copy sends on each socket from 0.
+        uint32_t m_next_send_id;
+        std::deque<PendingSend> m_pending;
+        uint64_t m_copied_sends;
+
+        /**
+         * Recycles the buffers of the sends numbered `first` to `last`
+         * (inclusive, and possibly wrapping around).
+         */
+        inline size_t complete(BufferPool &pool, uint32_t first, uint32_t last);
+    };
+
+    /**
+     * A fixed set of equally sized send buffers, carved from a single
+     * allocation and recycled once the kernel is done with them.
+     *
+     * The pool knows every socket with sends in flight from it. When it
+     * runs out of buffers it collects their completions itself, so that
+     * buffers come back even while their session is not being read
+     * from. Sends still in flight when a session goes away are kept by
+     * the pool until they complete, for up to `deferred_timeout`
+     * seconds; after that, their connection is reset so that a peer
+     * that stopped reading can not hold on to buffers indefinitely.
+     */
+    class BufferPool
+    {
+    public:
+        // Large enough to hold any frame without an extended length.
+        static const size_t DEFAULT_BUFFER_SIZE =
+            ReceiveBuffer::FRAME_HEADER_SIZE + ReceiveBuffer::MAX_PACKET_SIZE;
+        static const size_t DEFAULT_BUFFER_COUNT = 256;
+        static constexpr double DEFAULT_DEFERRED_TIMEOUT = 30.0;
+
+        BufferPool(const size_t buffer_size, const size_t buffer_count,
+            const double deferred_timeout = DEFAULT_DEFERRED_TIMEOUT)
+            : m_buffer_size(buffer_size), m_buffer_count(buffer_count),
+              m_deferred_timeout(std::chrono::duration_cast<ZeroCopyCompletions::Clock::duration>(
+                  std::chrono::duration<double>(deferred_timeout))),
+              m_storage(buffer_size * buffer_count)
+        {
+            m_free.reserve(buffer_count);
+            for (size_t i = buffer_count; i > 0; --i)
+                m_free.push_back(m_storage.data() + (i - 1) * buffer_size);
+        }
+
+        BufferPool(const BufferPool &) = delete;
+        BufferPool &operator=(const BufferPool &) = delete;
+
+        ~BufferPool()
+        {
+            // The storage is about to be freed, so nothing may still be
+            // sent from it.
+            for (auto &completions : m_deferred)
+                completions.abort(*this);
+        }
+
+        size_t get_buffer_size() const { return m_buffer_size; }
+        size_t get_buffer_count() const { return m_buffer_count; }
+        double get_deferred_timeout() const
+        {
+            return std::chrono::duration<double>(m_deferred_timeout).count();
+        }
+        size_t get_available() const { return m_free.size(); }
+
+        /**
+         * Returns the number of buffers still in flight on sockets whose
+         * sender is gone.
+         */
+        size_t get_deferred() const
+        {
+            size_t deferred = 0;
+            for (const auto &completions : m_deferred)
+                deferred += completions.get_pending();
+            return deferred;
+        }
+
+        /**
+         * Returns a free buffer, or nullptr if every buffer is in use.
+         */
+        char *acquire()
+        {
+            if (m_free.empty())
+                reclaim();
+            if (m_free.empty())
+                return nullptr;
+            auto *buffer = m_free.back();
+            m_free.pop_back();
+            return buffer;
+        }
+
+        void release(char *buffer)
+        {
+            m_free.push_back(buffer);
+        }
+
+        /**
+         * Collects the completions of every socket with sends in flight
+         * from this pool, and aborts the deferred sends that are past
+         * their deadline. Returns the number of buffers recycled.
+         */
+        size_t reclaim()
+        {
+            size_t recycled = 0;
+            for (auto *completions : m_sources)
+                recycled += completions->poll(*this);
+
+            const auto now = ZeroCopyCompletions::Clock::now();
+            for (auto it = m_deferred.begin(); it != m_deferred.end();)
+            {
+                recycled += it->poll(*this);
+                if (it->get_pending() != 0 && it->is_expired(now))
+                    recycled += it->abort(*this);
+                else if (it->get_pending() == 0)
+                    it->close_fd();
+                else
+                {
+                    ++it;
+                    continue;
+                }
+                it = m_deferred.erase(it);
+            }
+            return recycled;
+        }
+
+    private:
+        friend class ZeroCopySender;
+
+        size_t m_buffer_size;
+        size_t m_buffer_count;
+        ZeroCopyCompletions::Clock::duration m_deferred_timeout;
+        std::vector<char> m_storage;
+        std::vector<char *> m_free;
+
+        // The sends of live senders, and of those that went away before
+        // their sends completed.
+        std::vector<ZeroCopyCompletions *> m_sources;
+        std::vector<ZeroCopyCompletions> m_deferred;
+
+        void add_source(ZeroCopyCompletions &completions)
+        {
+            m_sources.push_back(&completions);
+        }
+
+        void remove_source(ZeroCopyCompletions &completions)
+        {
+            m_sources.erase(std::remove(m_sources.begin(), m_sources.end(), &completions),
+                m_sources.end());
+            if (completions.get_pending() == 0)
+                return;
+
+            auto deferred = completions.detach(
+                ZeroCopyCompletions::Clock::now() + m_deferred_timeout);
+            if (deferred.get_fd() >= 0)
+                m_deferred.push_back(std::move(deferred));
+        }
+    };
+
+    size_t ZeroCopyCompletions::poll(BufferPool &pool)
+    {
+        size_t recycled = 0;
+#ifdef KIPY_HAS_ZEROCOPY
+        while (!m_pending.empty())
+        {
+            char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+            msghdr message = {};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if (recvmsg(m_fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                break;
+
+            for (auto *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+            {
+                if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                    continue;
+
+                sock_extended_err error;
+                std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+                if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    m_copied_sends += error.ee_data - error.ee_info + 1;
+                recycled += complete(pool, error.ee_info, error.ee_data);
+            }
+        }
+#else
+        static_cast<void>(pool);
+#endif
+        return recycled;
+    }
+
+    size_t ZeroCopyCompletions::abort(BufferPool &pool)
+    {
+#ifdef KIPY_HAS_ZEROCOPY
+        const linger reset = { 1, 0 };
+        setsockopt(m_fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+#endif
+        close_fd();
+
+        const auto recycled = m_pending.size();
+        for (const auto &send : m_pending)
+            pool.release(send.buffer);
+        m_pending.clear();
+        return recycled;
+    }
+
+    size_t ZeroCopyCompletions::complete(BufferPool &pool, const uint32_t first, const uint32_t last)
+    {
+        size_t recycled = 0;
+        for (auto it = m_pending.begin(); it != m_pending.end();)
+        {
+            if (it->id - first <= last - first)
+            {
+                pool.release(it->buffer);
+                it = m_pending.erase(it);
+                ++recycled;
+            }
+            else
+                ++it;
+        }
+        return recycled;
+    }
+
+    /**
+     * Lets a std::ostream write straight into a fixed buffer, failing
+     * (rather than growing) once it is full.
+     */
+    class FixedBufferStreambuf : public std::streambuf
+    {
+    public:
+        FixedBufferStreambuf(char *data, const size_t size)
+        {
+            setp(data, data + size);
+        }
+
+        size_t get_size() const { return pptr() - pbase(); }
+    };
+
+    /**
+     * Sends frames on a single socket straight from pooled buffers,
+     * using MSG_ZEROCOPY for those of at least `threshold` bytes, so
+     * that they are serialized once and never copied in user space.
+     *
+     * A zero-copy buffer stays in use until the kernel reports that it
+     * is done with it, through the socket's error queue; those reports
+     * are collected by poll_completions(), or by the pool when it runs
+     * out of buffers.
+     *
+     * Only available on Linux (4.14 and later); elsewhere, or if the
+     * socket does not support it, the sender is disabled, and callers
+     * use their regular send path.
+     */
+    class ZeroCopySender
+    {
+    public:
+        static const size_t DEFAULT_THRESHOLD = 0x4000;
+
+        ZeroCopySender(const int fd, std::shared_ptr<BufferPool> pool,
+            const uint16_t session_id, const size_t threshold = DEFAULT_THRESHOLD)
+            : m_fd(fd), m_pool(std::move(pool)), m_session_id(session_id),
+              m_threshold(threshold), m_enabled(false), m_completions(fd),
+              m_zerocopy_sends(0), m_bytes_sent(0)
+        {
+#ifdef KIPY_HAS_ZEROCOPY
+            const int one = 1;
+            m_enabled = setsockopt(m_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+            if (m_enabled)
+                m_pool->add_source(m_completions);
+        }
+
+        ZeroCopySender(const ZeroCopySender &) = delete;
+        ZeroCopySender &operator=(const ZeroCopySender &) = delete;
+
+        ~ZeroCopySender()
+        {
+            // The pool takes over whatever is still in flight, as the
+            // session's socket may be closed before it completes.
+            poll_completions();
+            if (m_enabled)
+                m_pool->remove_source(m_completions);
+        }
+
+        bool is_enabled() const { return m_enabled; }
+        size_t get_threshold() const { return m_threshold; }
+        size_t get_pending() const { return m_completions.get_pending(); }
+        uint64_t get_zerocopy_sends() const { return m_zerocopy_sends; }
+        uint64_t get_copied_sends() const { return m_completions.get_copied_sends(); }
+        uint64_t get_bytes_sent() const { return m_bytes_sent; }
+
+        /**
+         * Serializes a packet with `write(std::ostream &)` straight into
+         * a pooled buffer, frames it, and sends it.
+         *
+         * Returns false if nothing was sent, and the packet should go
+         * through the regular send path instead (the sender is disabled,
+         * every buffer is in use, or the packet does not fit). Otherwise,
+         * `remainder` is set to whatever the socket did not accept, to
+         * be sent after it.
+         *
+         * Callers must only send this way when nothing else is waiting
+         * to be written to the socket, so that frames stay in order.
+         * Frames are traced as FRAME_SENT unless `trace` is false.
+         */
+        template <typename WriterT>
+        bool send(WriterT &&write, std::string &remainder, const bool trace = true)
+        {
+            remainder.clear();
+            if (!m_enabled)
+                return false;
+
+            poll_completions();
+            auto *buffer = m_pool->acquire();
+            if (!buffer)
+                return false;
+
+            const auto header_size = ReceiveBuffer::FRAME_HEADER_SIZE;
+            FixedBufferStreambuf streambuf(buffer + header_size,
+                std::min(m_pool->get_buffer_size() - header_size,
+                    static_cast<size_t>(ReceiveBuffer::MAX_PACKET_SIZE)));
+            std::ostream stream(&streambuf);
+            write(stream);
+            if (!stream)
+            {
+                m_pool->release(buffer);
+                return false;
+            }
+
+            const auto packet_size = streambuf.get_size();
+            buffer[0] = static_cast<char>(ReceiveBuffer::START_SIGNAL & 0xFF);
+            buffer[1] = static_cast<char>(ReceiveBuffer::START_SIGNAL >> 8);
+            buffer[2] = static_cast<char>(packet_size & 0xFF);
+            buffer[3] = static_cast<char>(packet_size >> 8);
+            const auto size = header_size + packet_size;
+            if (trace)
+                trace_frame(TraceEventType::FRAME_SENT, m_session_id, buffer, size);
+
+            bool in_flight = false;
+            const auto sent = send_buffer(buffer, size, in_flight);
+            if (sent < size)
+                remainder.assign(buffer + sent, size - sent);
+            if (!in_flight)
+                m_pool->release(buffer);
+            m_bytes_sent += sent;
+            return true;
+        }
+
+        /**
+         * Copies a complete frame into a pooled buffer and sends it,
+         * as send() does. The frame is not traced again, as it comes
+         * from a session's send_packet_data(), which already has.
+         */
+        bool send_frame(const char *data, const size_t size, std::string &remainder)
+        {
+            remainder.clear();
+            const auto header_size = ReceiveBuffer::FRAME_HEADER_SIZE;
+            if (size < header_size)
+                return false;
+
+            const auto write = [data, size, header_size](std::ostream &stream)
+            {
+                stream.write(data + header_size, size - header_size);
+            };
+            return send(write, remainder, false);
+        }
+
+        /**
+         * Recycles the buffers that the kernel has finished sending.
+         * Returns the number of buffers recycled.
+         */
+        size_t poll_completions()
+        {
+            return m_completions.poll(*m_pool);
+        }
+
+    private:
+        int m_fd;
+        std::shared_ptr<BufferPool> m_pool;
+        uint16_t m_session_id;
+        size_t m_threshold;
+        bool m_enabled;
+        ZeroCopyCompletions m_completions;
+
+        uint64_t m_zerocopy_sends;
+        uint64_t m_bytes_sent;
+
+        /**
+         * Sends as much of the buffer as the socket accepts, and returns
+         * the number of bytes sent. `in_flight` is set if the kernel
+         * still needs the buffer, until its completion is reported.
+         */
+        size_t send_buffer(char *buffer, const size_t size, bool &in_flight)
+        {
+            in_flight = false;
+#ifdef KIPY_HAS_ZEROCOPY
+            if (size >= m_threshold)
+            {
+                const auto sent = ::send(m_fd, buffer, size, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY);
+                if (sent >= 0)
+                {
+                    m_completions.add(buffer);
+                    ++m_zerocopy_sends;
+                    in_flight = true;
+                    return static_cast<size_t>(sent);
+                }
+
+                // ENOBUFS means the socket's pinned page allowance is used
+                // up; try again with a regular send.
+                if (errno != ENOBUFS)
+                    return 0;
+            }
+
+            // Small frames are copied into the kernel right away.
+            const auto sent = ::send(m_fd, buffer, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+            return sent < 0 ? 0 : static_cast<size_t>(sent);
+#else
+            static_cast<void>(buffer);
+            static_cast<void>(size);
+            return 0;
+#endif
+        }
+    };
+}
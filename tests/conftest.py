@@ -0,0 +1,126 @@
+import asyncio
+
+import pytest
+
+from ki.net import DMLServer, DMLClient
+from ki.protocol.dml import MessageManager
+from ki.services import Service, msghandler
+
+MESSAGES_FILEPATH = 'tests/samples/TestMessages.xml'
+
+
+class SampleService(Service):
+    def __init__(self, message_mgr):
+        super().__init__(message_mgr)
+        self.received = []
+
+    @msghandler('MSG_SAMPLE')
+    def handle_sample(self, sender, message):
+        self.received.append((sender.id, message['TestInt'].value, message['TestStr'].value))
+
+
+class ReadingTransport(object):
+    def __init__(self):
+        self.reading = True
+
+    def pause_reading(self):
+        self.reading = False
+
+    def resume_reading(self):
+        self.reading = True
+
+
+class SampleSender(object):
+    """Stands in for the session that a message came from."""
+
+    def __init__(self, session_id, manager=None):
+        self.id = session_id
+        self.manager = manager
+        self.transport = ReadingTransport()
+        self.sent = []
+        self.close_handlers = []
+
+    def send_message(self, message):
+        self.sent.append(message['TestInt'].value)
+
+    def add_close_handler(self, func):
+        self.close_handlers.append(func)
+
+    def remove_close_handler(self, func):
+        self.close_handlers.remove(func)
+
+    def close(self):
+        for close_handler in list(self.close_handlers):
+            close_handler()
+
+
+@pytest.fixture
+def loop():
+    loop = asyncio.new_event_loop()
+    asyncio.set_event_loop(loop)
+    yield loop
+    loop.close()
+    asyncio.set_event_loop(None)
+
+
+@pytest.fixture
+def manager():
+    manager = MessageManager()
+    assert manager.load_module(MESSAGES_FILEPATH) is not None
+    return manager
+
+
+def run(coro):
+    loop = asyncio.new_event_loop()
+    try:
+        loop.run_until_complete(coro)
+    finally:
+        loop.close()
+
+
+def run_until(loop, condition, timeout=5.0):
+    async def wait():
+        while not condition():
+            await asyncio.sleep(0.01)
+    loop.run_until_complete(asyncio.wait_for(wait(), timeout))
+
+
+def create_sample(manager, value, text='TEST'):
+    message = manager.create_message(1, 'MSG_SAMPLE')
+    message['TestInt'].value = value
+    message['TestStr'].value = text
+    return message
+
+
+def create_server(**options):
+    """Returns a DML server with a `SampleService`, that is not yet
+    running.
+    """
+    server = DMLServer(0)
+    for name, value in options.items():
+        setattr(server, name, value)
+    server.load_message_module(MESSAGES_FILEPATH)
+    server.service = SampleService(server.message_mgr)
+    server.register_service(server.service)
+    return server
+
+
+def start_server(loop, **options):
+    server = create_server(**options)
+    server.run(loop)
+    return server
+
+
+def connect_client(loop, server, **options):
+    """Returns a client connected to the given server, once both ends
+    of its session are established.
+    """
+    port = server.listeners[0].sockets[0].getsockname()[1]
+    client = DMLClient('127.0.0.1', port)
+    for name, value in options.items():
+        setattr(client, name, value)
+    client.load_message_module(MESSAGES_FILEPATH)
+    client.run(loop)
+    run_until(loop, lambda: client.session is not None and client.session.established and
+              any(session.established for session in server.sessions.values()))
+    return client
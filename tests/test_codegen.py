@@ -0,0 +1,99 @@
+import pytest
+
+from ki.codegen import load_definitions, generate_source, generate_stub, \
+    to_identifier, to_cpp_string, MESSAGE_ATTRIBUTES
+
+MESSAGES_TEMPLATE = '''<?xml version="1.0" ?>
+<Messages>
+  <_ProtocolInfo>
+    <RECORD>
+      <ServiceID TYPE="UBYT">%(service_id)d</ServiceID>
+      <ProtocolType TYPE="STR">%(protocol_type)s</ProtocolType>
+      <ProtocolVersion TYPE="INT">1</ProtocolVersion>
+      <ProtocolDescription TYPE="STR">Code Generation Messages</ProtocolDescription>
+    </RECORD>
+  </_ProtocolInfo>
+  <%(message_name)s>
+    <RECORD>
+      <_MsgName TYPE="STR" NOXFER="TRUE">%(message_name)s</_MsgName>
+      <_MsgDescription TYPE="STR" NOXFER="TRUE">Has oddly named fields.</_MsgDescription>
+      <_MsgHandler TYPE="STR" NOXFER="TRUE">%(message_name)s</_MsgHandler>
+      <_MsgAccessLvl TYPE="UBYT" NOXFER="TRUE">0</_MsgAccessLvl>
+      <_MsgOrder TYPE="UBYT" NOXFER="TRUE">1</_MsgOrder>
+%(fields)s
+    </RECORD>
+  </%(message_name)s>
+</Messages>
+'''
+
+
+def write_messages(path, fields, protocol_type='CODEGEN', service_id=1,
+                   message_name='MSG_FIELDS'):
+    path.write_text(MESSAGES_TEMPLATE % {
+        'service_id': service_id,
+        'protocol_type': protocol_type,
+        'message_name': message_name,
+        'fields': '\n'.join('      <%s TYPE="INT"></%s>' % (name, name) for name in fields),
+    })
+    return str(path)
+
+
+def test_identifiers():
+    assert to_identifier('Test.Field') == 'Test_Field'
+    assert to_identifier('1st') == '_1st'
+    assert to_identifier('class') == '_class'
+    assert to_identifier('__init__') == '__init___'
+    for name in MESSAGE_ATTRIBUTES:
+        assert to_identifier(name, MESSAGE_ATTRIBUTES) == name + '_'
+
+
+def test_string_escaping():
+    assert to_cpp_string('MSG_TEST') == '"MSG_TEST"'
+    assert to_cpp_string('a"b\\c??=') == r'"a\"b\\c\?\?="'
+    assert to_cpp_string('\xe9\n') == r'"\303\251\012"'
+
+
+def test_generation():
+    definitions = load_definitions(['tests/samples/TestMessages.xml'])
+    source = generate_source(definitions, 'messages')
+    assert 'struct TEST_MSG_SAMPLE' in source
+    assert 'static constexpr const char *NAME = "MSG_SAMPLE";' in source
+    assert '.def_readwrite("TestInt", &TEST_MSG_SAMPLE::m_TestInt)' in source
+    assert 'TestNOXFER' not in source
+
+    stub = generate_stub(definitions)
+    assert '        TestWStr: str' in stub
+
+
+def test_reserved_field_names(tmp_path):
+    filepath = write_messages(tmp_path / 'Messages.xml', ['NAME', 'size', 'Test__Field'])
+    definitions = load_definitions([filepath])
+    fields = definitions[0].messages[0].fields
+    assert [field.attribute for field in fields] == ['NAME_', 'size_', 'Test__Field']
+    assert [field.member for field in fields] == ['m_NAME_', 'm_size_', 'm_Test_Field']
+
+
+def test_duplicate_field_names(tmp_path):
+    filepath = write_messages(tmp_path / 'Messages.xml', ['Test.Field', 'Test_Field'])
+    with pytest.raises(ValueError):
+        load_definitions([filepath])
+
+    # Distinct in Python, but not once underscores are collapsed in C++.
+    filepath = write_messages(tmp_path / 'Messages.xml', ['Test_Field', 'Test__Field'])
+    with pytest.raises(ValueError):
+        load_definitions([filepath])
+
+
+def test_duplicate_modules(tmp_path):
+    first = write_messages(tmp_path / 'First.xml', ['TestField'])
+    second = write_messages(tmp_path / 'Second.xml', ['TestField'], service_id=2)
+    with pytest.raises(ValueError):
+        load_definitions([first, second])
+
+    # Both messages become the CODEGEN_A_MSG_FIELDS struct.
+    first = write_messages(tmp_path / 'First.xml', ['TestField'], protocol_type='CODEGEN_A',
+                           message_name='MSG_FIELDS')
+    second = write_messages(tmp_path / 'Second.xml', ['TestField'], protocol_type='CODEGEN',
+                            message_name='A_MSG_FIELDS', service_id=2)
+    with pytest.raises(ValueError):
+        load_definitions([first, second])
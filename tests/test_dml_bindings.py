@@ -1,6 +1,11 @@
+import struct
+
 import pytest
 
-from ki.dml import Record
+from ki.dml import Record, ColumnBatch
+from ki.protocol.dml import RecordDeltaEncoder, RecordDeltaDecoder
+
+from .conftest import create_sample
 
 
 @pytest.fixture
@@ -278,3 +283,175 @@ def test_record_deserialization(record):
     assert dbl_field.value == pytest.approx(152.4)
     assert gid_field.value == 0x8899AABBCCDDEEFF
     assert noxfer_field.value == 0x0
+
+
+def test_bulk_values(record):
+    record.add_byt_field('TestByt')
+    record.add_uint_field('TestUInt')
+    record.add_str_field('TestStr')
+    record.add_wstr_field('TestWStr')
+    record.add_dbl_field('TestDbl')
+    record.add_gid_field('TestGid')
+
+    record.set_values({
+        'TestByt': -127,
+        'TestUInt': 4294967295,
+        'TestStr': 'TEST',
+        'TestWStr': 'TEST',
+        'TestDbl': 152.4,
+        'TestGid': 0x8899AABBCCDDEEFF,
+    })
+    assert record['TestByt'].value == -127
+    assert record.get_values(['TestGid', 'TestStr']) == [0x8899AABBCCDDEEFF, 'TEST']
+
+    # Precompiled indices should resolve to the same fields.
+    indices = record.field_indices(['TestGid', 'TestStr'])
+    assert indices == [5, 2]
+    assert record.get_values(indices) == [0x8899AABBCCDDEEFF, 'TEST']
+    record.set_values({indices[1]: 'ABCD'})
+    assert record['TestStr'].value == 'ABCD'
+
+    # to_dict() and from_dict() should round trip every field.
+    values = record.to_dict()
+    assert list(values) == ['TestByt', 'TestUInt', 'TestStr', 'TestWStr', 'TestDbl', 'TestGid']
+    assert values['TestDbl'] == pytest.approx(152.4)
+    other = Record()
+    other.add_byt_field('TestByt')
+    other.add_uint_field('TestUInt')
+    other.add_str_field('TestStr')
+    other.add_wstr_field('TestWStr')
+    other.add_dbl_field('TestDbl')
+    other.add_gid_field('TestGid')
+    other.from_dict(values)
+    assert other.to_bytes() == record.to_bytes()
+
+    # Unknown fields and mistyped values should be rejected.
+    with pytest.raises(KeyError):
+        record.get_values(['TestMissing'])
+    with pytest.raises(IndexError):
+        record.get_values([6])
+    with pytest.raises(TypeError):
+        record.set_values({'TestUInt': 'TEST'})
+    with pytest.raises(TypeError):
+        record.from_dict({0: -127})
+
+    # A bad value leaves every field untouched, including earlier ones.
+    data = record.to_bytes()
+    with pytest.raises(TypeError):
+        record.set_values({'TestByt': 1, 'TestStr': 'X', 'TestUInt': 'TEST'})
+    with pytest.raises(KeyError):
+        record.from_dict({'TestByt': 1, 'TestMissing': 1})
+    with pytest.raises(TypeError):
+        record.from_dict({'TestByt': 1, 0: -127})
+    assert record.to_bytes() == data
+
+
+def test_column_batch_deserialization(record):
+    record.add_byt_field('TestByt')
+    record.add_ubyt_field('TestUByt')
+    record.add_shrt_field('TestShrt')
+    record.add_ushrt_field('TestUShrt')
+    record.add_int_field('TestInt')
+    record.add_uint_field('TestUInt')
+    record.add_str_field('TestStr')
+    record.add_wstr_field('TestWStr')
+    record.add_flt_field('TestFlt')
+    record.add_dbl_field('TestDbl')
+    record.add_gid_field('TestGid')
+    record.add_byt_field('TestNOXFER', False)
+
+    with open('tests/samples/dml.bin', 'rb') as f:
+        data = f.read()
+
+    batch = ColumnBatch(record)
+    batch.from_bytes(data * 3)
+
+    # Non-transferable fields should not have a column.
+    assert 'TestNOXFER' not in batch
+    assert len(batch.column_names) == 11
+    assert batch.row_count == 3
+
+    # Numeric columns should be exposed through the buffer protocol.
+    assert memoryview(batch['TestByt']).tolist() == [-127] * 3
+    assert memoryview(batch['TestUInt']).tolist() == [4294967295] * 3
+    assert memoryview(batch['TestGid']).tolist() == [0x8899AABBCCDDEEFF] * 3
+    assert batch['TestFlt'][2] == pytest.approx(152.4)
+
+    # String columns should be exposed as offset and data buffers.
+    assert memoryview(batch['TestStr'].offsets).tolist() == [0, 4, 8, 12]
+    assert bytes(memoryview(batch['TestStr'].data)) == b'TEST' * 3
+    assert batch['TestStr'][1] == 'TEST'
+    assert batch['TestWStr'][1] == 'TEST'
+
+    # Truncated data should be rejected, leaving the batch unchanged.
+    with pytest.raises(Exception):
+        batch.from_bytes(data * 2 + data[:-1])
+    assert batch.row_count == 3
+    assert batch.to_bytes() == data * 3
+
+    # Columns should not be resized while their buffers are exported.
+    view = memoryview(batch['TestStr'].offsets)
+    with pytest.raises(BufferError):
+        batch.from_bytes(data)
+    with pytest.raises(BufferError):
+        batch.clear()
+    with pytest.raises(BufferError):
+        batch['TestStr'].offsets.assign(view)
+    assert batch.to_bytes() == data * 3
+    view.release()
+
+    batch.from_bytes(data)
+    assert batch.row_count == 1
+
+
+def test_column_batch_serialization(record):
+    record.add_int_field('TestInt')
+    record.add_str_field('TestStr')
+
+    batch = ColumnBatch(record)
+    batch['TestInt'].assign(memoryview(bytes(8)).cast('i'))
+    batch['TestStr'].offsets.assign(memoryview(b'\x00\x00\x00\x00\x02\x00\x00\x00\x04\x00\x00\x00').cast('I'))
+    batch['TestStr'].data.assign(memoryview(b'ABCD').cast('B'))
+
+    assert batch.row_count == 2
+    assert batch.to_bytes() == b'\x00\x00\x00\x00\x02\x00AB\x00\x00\x00\x00\x02\x00CD'
+
+    # Columns with mismatching row counts should be rejected.
+    batch['TestInt'].assign(memoryview(bytes(4)).cast('i'))
+    with pytest.raises(Exception):
+        batch.to_bytes()
+
+
+def test_record_delta(manager):
+    encoder = RecordDeltaEncoder()
+    decoder = RecordDeltaDecoder(manager)
+    message = create_sample(manager, 1)
+
+    # The first message of a type is sent in full; one bit per
+    # transferable field.
+    delta = encoder.encode(message)
+    assert delta[:6] == b'\x01\x01\x0B\x00\xFF\x07'
+    assert decoder.apply(delta).to_bytes() == message.to_bytes()
+
+    # Only TestInt changed.
+    message['TestInt'].value = 2
+    delta = encoder.encode(message)
+    assert delta == b'\x01\x01\x0B\x00\x10\x00' + struct.pack('<i', 2)
+    assert decoder.apply(delta).to_bytes() == message.to_bytes()
+
+    # Nothing changed.
+    delta = encoder.encode(message)
+    assert delta == b'\x01\x01\x0B\x00\x00\x00'
+    assert decoder.apply(delta).to_bytes() == message.to_bytes()
+
+    # After a reset, the next message is sent in full again.
+    encoder.reset()
+    assert encoder.encode(message)[4:6] == b'\xFF\x07'
+
+    # The field count must match the decoder's message template.
+    with pytest.raises(Exception):
+        decoder.apply(b'\x01\x01\x0C\x00\x00\x00')
+    with pytest.raises(Exception):
+        decoder.apply(b'\x01\x01\x0B\x00\x00\x00\x00')
+    with pytest.raises(Exception):
+        decoder.apply(b'\x01\x01\x0B\x00\x10\x00\x02')
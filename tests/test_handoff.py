@@ -0,0 +1,149 @@
+import asyncio
+import os
+import socket
+import threading
+
+import pytest
+
+from ki.compression import Codec, CompressionPolicy, SessionCompression
+from ki.extensions import build_frame
+from ki.handoff import SessionState, HandoffError, encode_snapshot, decode_snapshot, \
+    send_fds, receive_fds, can_hand_off, hand_off, take_over
+from ki.util import IDAllocator, AllocationError
+
+from .conftest import connect_client, create_sample, create_server, run_until, \
+    start_server
+
+
+class SampleSession(object):
+    def __init__(self):
+        self.transport = object()
+        self.compression = None
+        self.delta = None
+
+
+def test_snapshot():
+    states = [
+        SessionState(1, True, 2, 2, b'\x0D\xF0\x10\x00\x00'),
+        SessionState(0xFFFF, False, 0, 0, b''),
+    ]
+    data = encode_snapshot(1234.5, 2, states)
+    assert decode_snapshot(data) == (1234.5, 2, states)
+
+    with pytest.raises(HandoffError):
+        decode_snapshot(data[:-1])
+    with pytest.raises(HandoffError):
+        decode_snapshot(b'XXXX' + data[4:])
+
+
+def test_fd_passing():
+    left, right = socket.socketpair(socket.AF_UNIX, socket.SOCK_STREAM)
+    pipes = [os.pipe() for i in range(260)]
+    try:
+        # More descriptors than fit in a single message.
+        send_fds(left, [write_fd for read_fd, write_fd in pipes])
+        fds = receive_fds(right, len(pipes))
+        assert len(fds) == len(pipes)
+
+        os.write(fds[-1], b'TEST')
+        assert os.read(pipes[-1][0], 4) == b'TEST'
+        for fd in fds:
+            os.close(fd)
+    finally:
+        for read_fd, write_fd in pipes:
+            os.close(read_fd)
+            os.close(write_fd)
+        left.close()
+        right.close()
+
+
+def test_id_reservation():
+    allocator = IDAllocator(1, 10)
+    assert allocator.reserve(5) == 5
+    with pytest.raises(AllocationError):
+        allocator.reserve(5)
+    with pytest.raises(AllocationError):
+        allocator.reserve(11)
+
+    # IDs skipped by a reservation are still handed out.
+    allocated = {allocator.allocate() for i in range(9)}
+    assert allocated == {1, 2, 3, 4, 6, 7, 8, 9, 10}
+    with pytest.raises(AllocationError):
+        allocator.allocate()
+
+
+def test_zlib_sessions_stay():
+    session = SampleSession()
+    assert can_hand_off(session)
+
+    # zlib streams carry history from one packet to the next, in either
+    # direction.
+    session.compression = SessionCompression(session, CompressionPolicy(codecs=[Codec.ZLIB]))
+    assert can_hand_off(session)
+    session.compression.codec = session.compression.policy.create_codec(Codec.ZLIB)
+    assert not can_hand_off(session)
+
+    session.compression = SessionCompression(session, CompressionPolicy(codecs=[Codec.ZLIB]))
+    session.compression._decoders[Codec.ZLIB] = \
+        session.compression.policy.create_codec(Codec.ZLIB)
+    assert not can_hand_off(session)
+
+    # Nor could their history be restored on the other side.
+    with pytest.raises(ValueError):
+        session.compression.restore(Codec.ZLIB)
+
+
+def test_session_handoff():
+    loop = asyncio.new_event_loop()
+    new_loop = asyncio.new_event_loop()
+    asyncio.set_event_loop(loop)
+
+    old_server = start_server(loop)
+    client = connect_client(loop, old_server)
+    old_session = next(iter(old_server.sessions.values()))
+    session_id = old_session.id
+
+    # Half of a message is waiting in the old server's receive buffer.
+    frame = build_frame(False, 0, create_sample(client.message_mgr, 1).to_bytes())
+    client.session.transport.write(frame[:6])
+    protocol = old_session.transport.get_protocol()
+    run_until(loop, lambda: protocol.receive_buffer.pending == 6)
+
+    new_server = create_server()
+    new_server.event_loop = new_loop
+    left, right = socket.socketpair(socket.AF_UNIX, socket.SOCK_STREAM)
+    errors = []
+
+    def resume():
+        try:
+            take_over(new_server, right)
+        except Exception as e:
+            errors.append(e)
+        else:
+            new_loop.run_forever()
+
+    thread = threading.Thread(target=resume)
+    thread.start()
+    try:
+        loop.run_until_complete(hand_off(old_server, left))
+        assert not old_server.sessions
+
+        # The new server finishes the message, and carries on with the
+        # same established session.
+        client.session.transport.write(frame[6:])
+        client.session.send_message(create_sample(client.message_mgr, 2))
+        run_until(loop, lambda: errors or len(new_server.service.received) == 2)
+        assert not errors
+        assert new_server.service.received == [(session_id, 1, 'TEST'), (session_id, 2, 'TEST')]
+        assert new_server.sessions[session_id].established
+    finally:
+        if client.session is not None:
+            client.close()
+        loop.run_until_complete(asyncio.sleep(0.05))
+
+        new_loop.call_soon_threadsafe(new_server.close)
+        new_loop.call_soon_threadsafe(new_loop.stop)
+        thread.join()
+        new_loop.close()
+        loop.close()
+        asyncio.set_event_loop(None)
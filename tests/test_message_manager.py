@@ -0,0 +1,135 @@
+import gc
+import struct
+import threading
+
+import pytest
+
+from ki.protocol.dml import MessageManager
+
+from .conftest import create_sample
+
+MODULE_TEMPLATE = '''<?xml version="1.0" ?>
+<ReloadMessages>
+  <_ProtocolInfo>
+    <RECORD>
+      <ServiceID TYPE="UBYT">%(service_id)d</ServiceID>
+      <ProtocolType TYPE="STR">RELOAD%(service_id)d</ProtocolType>
+      <ProtocolVersion TYPE="INT">1</ProtocolVersion>
+      <ProtocolDescription TYPE="STR">Reload Messages</ProtocolDescription>
+    </RECORD>
+  </_ProtocolInfo>
+  <MSG_RELOAD>
+    <RECORD>
+      <_MsgName TYPE="STR" NOXFER="TRUE">MSG_RELOAD</_MsgName>
+      <_MsgDescription TYPE="STR" NOXFER="TRUE">Loaded while decoding.</_MsgDescription>
+      <_MsgHandler TYPE="STR" NOXFER="TRUE">MSG_RELOAD</_MsgHandler>
+      <_MsgAccessLvl TYPE="UBYT" NOXFER="TRUE">0</_MsgAccessLvl>
+      <_MsgOrder TYPE="UBYT" NOXFER="TRUE">1</_MsgOrder>
+      <TestInt TYPE="INT"></TestInt>
+    </RECORD>
+  </MSG_RELOAD>
+</ReloadMessages>
+'''
+
+
+def test_messages_from_bytes(manager):
+    data = b''.join(create_sample(manager, i).to_bytes() for i in range(100))
+    for threads in (1, 4):
+        messages = manager.messages_from_bytes(data, threads)
+        assert [message['TestInt'].value for message in messages] == list(range(100))
+
+    with pytest.raises(Exception):
+        manager.messages_from_bytes(data[:-1])
+
+
+def test_frames_to_columns(manager):
+    template = manager[1]['MSG_SAMPLE']
+    data = b''.join(create_sample(manager, i).to_bytes() for i in range(10))
+    batch = template.frames_to_columns(data)
+    assert batch.row_count == 10
+    assert memoryview(batch['TestInt']).tolist() == list(range(10))
+    assert batch['TestStr'][3] == 'TEST'
+    assert template.columns_to_frames(batch) == data
+
+    # Messages can also be appended to an existing batch.
+    sample = create_sample(manager, 10).to_bytes()
+    assert template.frames_to_columns(sample, batch) == 1
+    assert template.columns_to_frames(batch) == data + sample
+
+    # Messages of another type, truncated messages, and messages with
+    # bytes left over after their record are rejected, leaving the batch
+    # unchanged.
+    trailing = sample[:2] + struct.pack('<H', len(sample) + 1) + sample[4:] + b'\x00'
+    for invalid in (manager.create_message(1, 'MSG_EMPTY').to_bytes(), sample[:-1], trailing):
+        with pytest.raises(Exception):
+            template.frames_to_columns(sample + invalid, batch)
+        with pytest.raises(Exception):
+            template.frames_to_columns(sample + invalid)
+        assert batch.row_count == 11
+        assert template.columns_to_frames(batch) == data + sample
+
+
+def test_messages_outlive_manager():
+    manager = MessageManager()
+    manager.load_module('tests/samples/TestMessages.xml')
+    data = create_sample(manager, 7).to_bytes()
+
+    messages = [
+        create_sample(manager, 7),
+        manager[1].create_message('MSG_SAMPLE'),
+        manager[1]['MSG_SAMPLE'].create_message(),
+        manager.message_from_bytes(data)
+    ]
+    messages += manager.messages_from_bytes(data * 2)
+    del manager
+    gc.collect()
+
+    for message in messages:
+        assert message.handler == 'MSG_SAMPLE'
+    assert [message.to_bytes() for message in messages[3:]] == [data] * 3
+
+
+def test_concurrent_load_and_decode(manager, tmp_path):
+    filepaths = []
+    for service_id in range(2, 34):
+        filepath = tmp_path / ('ReloadMessages%d.xml' % service_id)
+        filepath.write_text(MODULE_TEMPLATE % {'service_id': service_id})
+        filepaths.append(str(filepath))
+
+    data = b''.join(create_sample(manager, i).to_bytes() for i in range(200))
+    errors = []
+    loading = threading.Event()
+    loading.set()
+
+    def load():
+        try:
+            for filepath in filepaths:
+                assert manager.load_module(filepath) is not None
+        except Exception as e:
+            errors.append(e)
+        finally:
+            loading.clear()
+
+    def decode():
+        try:
+            while loading.is_set():
+                messages = manager.messages_from_bytes(data, 2)
+                assert [message['TestInt'].value for message in messages] == list(range(200))
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=load), threading.Thread(target=decode)]
+    for thread in threads:
+        thread.start()
+
+    # Meanwhile, decode and create single messages on this thread.
+    while loading.is_set():
+        message = manager.message_from_bytes(create_sample(manager, 7).to_bytes())
+        assert message['TestInt'].value == 7
+    for thread in threads:
+        thread.join()
+
+    assert not errors
+    for service_id in range(2, 34):
+        assert manager[service_id].protocol_type == 'RELOAD%d' % service_id
+        assert manager.create_message(service_id, 'MSG_RELOAD') is not None
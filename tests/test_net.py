@@ -0,0 +1,234 @@
+import asyncio
+import os
+
+import pytest
+
+from ki.compression import COMPRESSED_HEADER, Codec, CompressionPolicy, \
+    SessionCompression, ZSTD_AVAILABLE
+from ki.extensions import COMPRESSED_OPCODE, build_frame
+from ki.net import Server
+
+from .conftest import connect_client, create_sample, run_until, start_server
+
+def close(loop, server, client):
+    if client.session is not None:
+        client.close()
+    server.close()
+    loop.run_until_complete(asyncio.sleep(0.05))
+
+
+def test_loopback(loop):
+    server = start_server(loop)
+    client = connect_client(loop, server)
+    session = next(iter(server.sessions.values()))
+    protocol = session.transport.get_protocol()
+
+    # Reads are made through a memoryview of the receive buffer.
+    assert isinstance(protocol.get_buffer(-1), memoryview)
+
+    # The second message is larger than the buffer's initial storage,
+    # so it arrives across several reads.
+    client.session.send_message(create_sample(client.message_mgr, 1))
+    client.session.send_message(create_sample(client.message_mgr, 2, 'X' * 0x8000))
+    run_until(loop, lambda: len(server.service.received) == 2)
+    assert server.service.received == [
+        (session.id, 1, 'TEST'),
+        (session.id, 2, 'X' * 0x8000),
+    ]
+    assert protocol.receive_buffer.pending == 0
+    assert protocol.receive_buffer.frames_processed >= 2
+
+    close(loop, server, client)
+
+
+def test_keep_alive_tasks(loop):
+    # The server's tasks run on its own loop, even if it isn't current.
+    asyncio.set_event_loop(None)
+    server = start_server(loop)
+    for task in (server._ensure_sessions_alive, server._keep_sessions_alive):
+        assert task.running
+        assert task.asyncio_task.get_loop() is loop
+
+    asyncio.set_event_loop(loop)
+    server.close()
+    loop.run_until_complete(asyncio.sleep(0.05))
+
+
+def test_idle_trim(loop):
+    server = start_server(loop)
+    clients = [connect_client(loop, server) for _ in range(8)]
+    for i, client in enumerate(clients):
+        client.session.send_message(create_sample(client.message_mgr, i, 'X' * 0x1000))
+    run_until(loop, lambda: len(server.service.received) == len(clients))
+
+    def footprint():
+        return sum(session.transport.get_protocol().receive_buffer.allocated
+                   for session in server.sessions.values())
+
+    # The first sweep only notes what each session has received.
+    before = footprint()
+    assert before >= len(clients) * 0x1000
+    server._ensure_sessions_alive()
+    assert footprint() == before
+
+    # Sessions that received something since are left alone.
+    clients[0].session.send_message(create_sample(clients[0].message_mgr, 0, 'X' * 0x1000))
+    run_until(loop, lambda: len(server.service.received) == len(clients) + 1)
+    server._ensure_sessions_alive()
+    busy = server.sessions[server.service.received[-1][0]]
+    assert footprint() == busy.transport.get_protocol().receive_buffer.allocated > 0
+
+    server._ensure_sessions_alive()
+    assert footprint() == 0
+
+    for client in clients[1:]:
+        client.close()
+    close(loop, server, clients[0])
+
+
+def test_compression(loop):
+    policy = CompressionPolicy(codecs=[Codec.ZLIB], threshold=0)
+    server = start_server(loop, compression_policy=policy)
+    client = connect_client(loop, server, compression_policy=policy)
+    run_until(loop, lambda: client.session.compression.active)
+
+    client.session.send_message(create_sample(client.message_mgr, 1, 'X' * 0x1000))
+    run_until(loop, lambda: len(server.service.received) == 1)
+    assert server.service.received[0][2] == 'X' * 0x1000
+    assert 0 < client.session.compression.bytes_out < 0x1000
+
+    # A codec we never offered closes the session.
+    frame = build_frame(False, COMPRESSED_OPCODE, COMPRESSED_HEADER.pack(7, 0, 0, 4) + b'TEST')
+    client.session.transport.write(frame)
+    run_until(loop, lambda: not server.sessions)
+
+    close(loop, server, client)
+
+
+def test_compression_declined(loop):
+    # A server without compression turns the client's offer down, rather
+    # than closing the session.
+    server = start_server(loop)
+    client = connect_client(loop, server,
+                            compression_policy=CompressionPolicy(threshold=0))
+
+    client.session.send_message(create_sample(client.message_mgr, 1, 'X' * 0x1000))
+    run_until(loop, lambda: len(server.service.received) == 1)
+    assert server.sessions
+    assert not client.session.compression.active
+
+    close(loop, server, client)
+
+
+@pytest.mark.skipif(not ZSTD_AVAILABLE, reason='zstd is not available')
+def test_incompressible_frames():
+    class SampleSession(object):
+        pass
+
+    session = SampleSession()
+    policy = CompressionPolicy(codecs=[Codec.ZSTD], threshold=0)
+    compression = SessionCompression(session, policy)
+    compression.codec = policy.create_codec(Codec.ZSTD)
+
+    # zstd packets stand alone, so a packet that would not shrink is
+    # sent as it is.
+    frame = build_frame(False, 0, b'\x01\x02' + os.urandom(0x400))
+    assert compression.compress_frame(frame) == frame
+    frame = build_frame(False, 0, b'\x01\x02' + b'X' * 0x400)
+    assert len(compression.compress_frame(frame)) < len(frame)
+
+
+def test_delta_encoding(loop):
+    server = start_server(loop, delta_encoding=True)
+    client = connect_client(loop, server, delta_encoding=True)
+    run_until(loop, lambda: client.session.delta.peer_supported)
+
+    message = create_sample(client.message_mgr, 1)
+    client.session.send_delta(message)
+    message['TestInt'].value = 2
+    client.session.send_delta(message)
+    run_until(loop, lambda: len(server.service.received) == 2)
+    assert [value for _, value, _ in server.service.received] == [1, 2]
+
+    close(loop, server, client)
+
+
+def test_delta_encoding_declined(loop):
+    server = start_server(loop)
+    client = connect_client(loop, server, delta_encoding=True)
+
+    client.session.send_delta(create_sample(client.message_mgr, 1))
+    run_until(loop, lambda: len(server.service.received) == 1)
+    assert server.sessions
+    assert not client.session.delta.peer_supported
+
+    close(loop, server, client)
+
+
+class SampleSession(object):
+    def __init__(self, generation):
+        self.generation = generation
+        self.frames = []
+
+    def send_frames(self, frames):
+        self.frames += frames
+
+
+def test_send_threadsafe(loop):
+    server = Server(0)
+    server.event_loop = loop
+    session = server.sessions[1] = SampleSession(1)
+    assert server.send_threadsafe(1, b'A')
+    assert not server.send_threadsafe(2, b'A')
+
+    # The session closes, and a new one takes its ID before the frame is
+    # sent.
+    new_session = server.sessions[1] = SampleSession(2)
+    assert server.send_threadsafe(1, b'B')
+    loop.run_until_complete(asyncio.sleep(0.01))
+
+    assert session.frames == []
+    assert new_session.frames == [b'B']
+    assert server.outbound_queue.size == 0
+
+
+def test_keep_alive_rtt(loop):
+    server = start_server(loop)
+    client = connect_client(loop, server)
+    session = next(iter(server.sessions.values()))
+
+    # Keep alives sent either way are timed until their response comes
+    # back.
+    sample_count = client.session.rtt.sample_count
+    client.session.send_keep_alive()
+    run_until(loop, lambda: client.session.rtt.sample_count > sample_count)
+
+    sample_count = session.rtt.sample_count
+    session.send_keep_alive(server.startup_time_delta)
+    run_until(loop, lambda: session.rtt.sample_count > sample_count)
+
+    for rtt in (client.session.rtt, session.rtt):
+        assert 0.0 <= rtt.last < 1000.0
+        assert rtt.min <= rtt.last <= rtt.max
+
+    close(loop, server, client)
+
+
+def test_rtt_stats(loop):
+    server = start_server(loop)
+    clients = [connect_client(loop, server) for _ in range(2)]
+    sessions = sorted(server.sessions.values(), key=lambda session: session.id)
+    for i, session in enumerate(sessions):
+        for milliseconds in range(1, 101):
+            session.rtt.add_sample(milliseconds * (i + 1))
+
+    stats = server.rtt_stats(quantiles=(0.5, 1.0))
+    assert stats['id'] == [session.id for session in sessions]
+    assert stats['sample_count'] == [100, 100]
+    assert stats['min'] == [1.0, 2.0]
+    assert stats['max'] == [100.0, 200.0]
+    assert stats['percentiles'][1.0] == [100.0, 200.0]
+    assert stats['percentiles'][0.5] == [session.rtt.percentile(0.5) for session in sessions]
+
+    clients[1].close()
+    close(loop, server, clients[0])
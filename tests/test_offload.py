@@ -0,0 +1,213 @@
+import asyncio
+import os
+import signal
+
+import pytest
+
+from ki.offload import OffloadError, OffloadPool
+from ki.services import Service, ServiceParticipant, msghandler
+
+from .conftest import MESSAGES_FILEPATH, SampleSender, create_sample, run
+
+DEFINITIONS = [MESSAGES_FILEPATH]
+
+
+def double_sample(session_id, message):
+    message['TestInt'].value *= 2
+    return message
+
+
+def crash_on_zero(session_id, message):
+    if message['TestInt'].value == 0:
+        os.kill(os.getpid(), signal.SIGKILL)
+    return double_sample(session_id, message)
+
+
+class SampleService(Service):
+    def __init__(self, message_mgr):
+        super().__init__(message_mgr)
+        self.handled = []
+
+    @msghandler('MSG_EMPTY')
+    def handle_empty(self, sender, message):
+        self.handled.append((sender.id, list(sender.sent)))
+
+
+class SampleParticipant(ServiceParticipant):
+    def __init__(self):
+        super().__init__()
+        self.sessions = {}
+
+    def get_session(self, session_id):
+        return self.sessions.get(session_id)
+
+
+def test_offload_reply_routing():
+    participant = SampleParticipant()
+    participant.load_message_module(DEFINITIONS[0])
+    participant.service = SampleService(participant.message_mgr)
+    participant.register_service(participant.service)
+    participant.register_offload_handler('MSG_SAMPLE', double_sample)
+    manager = participant.message_mgr
+
+    sender_a = SampleSender(1, manager)
+    sender_b = SampleSender(2, manager)
+    sender_c = SampleSender(2, manager)
+
+    async def send():
+        participant.start_offload_pool(DEFINITIONS, workers=1)
+        participant.sessions[1] = sender_a
+        participant.sessions[2] = sender_b
+
+        participant.handle_message(sender_a, create_sample(manager, 3))
+        participant.handle_message(sender_a, manager.create_message(1, 'MSG_EMPTY'))
+
+        # sender_b closes before its reply arrives, and sender_c takes
+        # its session ID.
+        participant.handle_message(sender_b, create_sample(manager, 5))
+        sender_b.close()
+        participant.sessions[2] = sender_c
+
+        for _ in range(500):
+            if participant.service.handled:
+                break
+            await asyncio.sleep(0.01)
+        participant.stop_offload_pool()
+
+    run(send())
+
+    # sender_a's next message waited on the offloaded one.
+    assert sender_a.sent == [6]
+    assert participant.service.handled == [(1, [6])]
+
+    assert sender_b.sent == []
+    assert sender_c.sent == []
+
+
+def test_offload_reload():
+    participant = SampleParticipant()
+    participant.load_message_module(DEFINITIONS[0])
+    participant.register_offload_handler('MSG_SAMPLE', double_sample)
+    manager = participant.message_mgr
+    sender = SampleSender(1, manager)
+
+    async def send():
+        participant.start_offload_pool(DEFINITIONS, workers=1)
+        participant.sessions[1] = sender
+        participant.handle_message(sender, create_sample(manager, 3))
+        await asyncio.sleep(0)
+
+        # Messages already handed to the old pool are still handled.
+        offload_pool = participant.offload_pool
+        assert offload_pool.outstanding == 1
+        participant.reload_message_modules()
+        assert participant.offload_pool is not offload_pool
+        participant.handle_message(sender, create_sample(manager, 4))
+
+        for _ in range(500):
+            if len(sender.sent) == 2:
+                break
+            await asyncio.sleep(0.01)
+        assert not offload_pool.running
+        participant.stop_offload_pool()
+
+    run(send())
+
+    assert sender.sent == [6, 8]
+
+
+def test_offload_reload_failure():
+    participant = SampleParticipant()
+    participant.load_message_module(DEFINITIONS[0])
+    participant.register_offload_handler('MSG_SAMPLE', double_sample)
+    message_mgr = participant.message_mgr
+    version = participant.message_mgr_version
+
+    async def reload():
+        participant.start_offload_pool(DEFINITIONS, workers=1)
+        offload_pool = participant.offload_pool
+
+        # A module that fails to load leaves everything as it was.
+        with pytest.raises(ValueError):
+            participant.reload_message_modules(
+                DEFINITIONS + ['tests/samples/MissingMessages.xml'])
+        assert participant.message_mgr is message_mgr
+        assert participant.message_mgr_version == version
+        assert participant.message_definitions == DEFINITIONS
+        assert participant.offload_pool is offload_pool
+        assert offload_pool.running
+        participant.stop_offload_pool()
+
+    run(reload())
+
+
+def test_offload_pool_close(manager):
+    pool = OffloadPool(DEFINITIONS, {'MSG_SAMPLE': double_sample},
+                       workers=2, slot_count=2)
+
+    async def submit():
+        pool.start()
+        futures = [pool.submit(i, 'MSG_SAMPLE', create_sample(manager, i).to_bytes())
+                   for i in range(8)]
+
+        # Closing lets everything submitted so far finish.
+        pool.close()
+        with pytest.raises(OffloadError):
+            pool.submit(0, 'MSG_SAMPLE', create_sample(manager, 0).to_bytes())
+        assert pool.running
+
+        results = await asyncio.wait_for(asyncio.gather(*futures), 5)
+        assert [manager.message_from_bytes(data)['TestInt'].value
+                for data in results] == [i * 2 for i in range(8)]
+        assert not pool.running
+
+        with pytest.raises(OffloadError):
+            pool.start()
+
+    run(submit())
+
+
+def test_offload_pool_stop(manager):
+    pool = OffloadPool(DEFINITIONS, {'MSG_SAMPLE': double_sample},
+                       workers=1, slot_count=1)
+
+    async def submit():
+        pool.start()
+        futures = [pool.submit(1, 'MSG_SAMPLE', create_sample(manager, i).to_bytes())
+                   for i in range(4)]
+
+        # Stopping fails whatever was still waiting, without blocking.
+        pool.stop()
+        assert not pool.running
+        for future in futures:
+            with pytest.raises(OffloadError):
+                await future
+
+    run(submit())
+
+
+def test_offload_worker_death(manager):
+    pool = OffloadPool(DEFINITIONS, {'MSG_SAMPLE': crash_on_zero},
+                       workers=1, slot_count=2)
+
+    async def submit():
+        pool.start()
+        futures = [pool.submit(1, 'MSG_SAMPLE', create_sample(manager, i).to_bytes())
+                   for i in range(3)]
+
+        # Everything the worker was given fails with it, and the message
+        # that was still waiting on a slot goes to its replacement.
+        for future in futures[:2]:
+            with pytest.raises(OffloadError):
+                await asyncio.wait_for(future, 5)
+        data = await asyncio.wait_for(futures[2], 5)
+        assert manager.message_from_bytes(data)['TestInt'].value == 4
+        assert pool.running
+        assert pool.outstanding == 0
+
+        data = await asyncio.wait_for(
+            pool.submit(1, 'MSG_SAMPLE', create_sample(manager, 3).to_bytes()), 5)
+        assert manager.message_from_bytes(data)['TestInt'].value == 6
+        pool.stop()
+
+    run(submit())
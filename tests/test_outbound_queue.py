@@ -0,0 +1,54 @@
+import threading
+
+from ki.protocol.net import OutboundQueue
+
+
+def test_capacity():
+    queue = OutboundQueue(2)
+    assert queue.push(1, 1, b'A') == OutboundQueue.PushResult.SCHEDULE_DRAIN
+    assert queue.push(2, 1, b'B') == OutboundQueue.PushResult.QUEUED
+    assert queue.push(3, 1, b'C') == OutboundQueue.PushResult.FULL
+    assert queue.size == 2
+
+    assert queue.drain() == [(1, 1, b'A'), (2, 1, b'B')]
+    assert not queue.finish_drain()
+
+    # Draining frees up room, and the next push schedules a new drain.
+    assert queue.push(3, 1, b'C') == OutboundQueue.PushResult.SCHEDULE_DRAIN
+    assert queue.drain() == [(3, 1, b'C')]
+
+
+def test_concurrent_push():
+    queue = OutboundQueue(0x10000)
+    producers, count = 4, 2000
+    scheduled = []
+
+    def push(session_id):
+        for i in range(count):
+            result = queue.push(session_id, i, b'%d' % i)
+            assert result != OutboundQueue.PushResult.FULL
+            if result == OutboundQueue.PushResult.SCHEDULE_DRAIN:
+                scheduled.append(session_id)
+
+    threads = [threading.Thread(target=push, args=(session_id,))
+               for session_id in range(producers)]
+    for thread in threads:
+        thread.start()
+
+    # Drain alongside the producers; every frame arrives, and each
+    # producer's frames arrive in order.
+    received = {session_id: [] for session_id in range(producers)}
+    total = 0
+    while total < producers * count:
+        frames = queue.drain(64)
+        for session_id, generation, frame in frames:
+            assert frame == b'%d' % generation
+            received[session_id].append(generation)
+        total += len(frames)
+        queue.finish_drain()
+    for thread in threads:
+        thread.join()
+
+    assert all(generations == list(range(count)) for generations in received.values())
+    assert queue.size == 0
+    assert scheduled
@@ -0,0 +1,65 @@
+import pytest
+
+from ki.protocol.net import RttEstimator
+
+
+def test_empty():
+    rtt = RttEstimator()
+    assert rtt.sample_count == 0
+    assert rtt.percentile(0.5) == 0
+
+
+def test_smoothing():
+    rtt = RttEstimator()
+    rtt.add_sample(8)
+    assert (rtt.srtt, rtt.rttvar) == (8.0, 4.0)
+
+    rtt.add_sample(16)
+    assert rtt.srtt == pytest.approx(9.0)
+    assert rtt.rttvar == pytest.approx(5.0)
+    assert (rtt.last, rtt.min, rtt.max, rtt.sample_count) == (16.0, 8.0, 16.0, 2)
+
+    rtt.reset()
+    assert rtt.sample_count == 0
+
+
+def test_bucket_bounds():
+    # Each bucket reports its upper bound, clamped to the samples seen.
+    rtt = RttEstimator()
+    rtt.add_sample(1)
+    rtt.add_sample(100)
+    assert rtt.percentile(0.0) == rtt.percentile(0.5) == 1.023
+    assert rtt.percentile(1.0) == 100.0
+
+    # Percentiles never underestimate, and overestimate by less than
+    # half.
+    for milliseconds in range(1, 5000, 7):
+        rtt = RttEstimator()
+        rtt.add_sample(0)
+        rtt.add_sample(milliseconds)
+        rtt.add_sample(10000)
+        assert milliseconds <= rtt.percentile(0.6) < milliseconds * 1.5
+
+
+def test_percentile():
+    rtt = RttEstimator()
+    for milliseconds in range(1, 101):
+        rtt.add_sample(milliseconds)
+    assert 50 <= rtt.percentile(0.5) < 75
+    assert 90 <= rtt.percentile(0.9) <= 100
+    assert rtt.percentile(1.0) == 100.0
+
+    # Quantiles are clamped to [0, 1].
+    assert rtt.percentile(-1.0) == rtt.percentile(0.0)
+    assert rtt.percentile(2.0) == rtt.percentile(1.0)
+
+
+def test_decay():
+    # Old samples age out, so percentiles follow a change in latency.
+    rtt = RttEstimator()
+    for _ in range(1000):
+        rtt.add_sample(10)
+    for _ in range(200):
+        rtt.add_sample(100)
+    assert rtt.sample_count == 1200
+    assert rtt.percentile(0.5) == 100.0
@@ -0,0 +1,87 @@
+import asyncio
+
+import pytest
+from ki.services import Service, ServiceParticipant, msghandler
+
+from .conftest import SampleSender, run
+
+
+class SampleMessage(object):
+    def __init__(self, handler):
+        self.handler = handler
+
+    def to_bytes(self):
+        return self.handler.encode()
+
+
+class SampleMessageManager(object):
+    def message_from_bytes(self, data):
+        return SampleMessage(data.decode())
+
+
+class SampleService(Service):
+    def __init__(self, message_mgr):
+        super().__init__(message_mgr)
+        self.handled = []
+
+    @msghandler('MSG_SLOW')
+    async def handle_slow(self, sender, message):
+        await asyncio.sleep(0.01)
+        self.handled.append((sender.id, message.handler))
+
+    @msghandler('MSG_FAST')
+    def handle_fast(self, sender, message):
+        self.handled.append((sender.id, message.handler))
+
+
+@pytest.fixture
+def participant():
+    participant = ServiceParticipant()
+    participant.message_mgr = SampleMessageManager()
+    participant.MAX_PENDING_MESSAGES = 4
+    participant.service = SampleService(participant.message_mgr)
+    participant.register_service(participant.service)
+    return participant
+
+
+def test_coroutine_handler_ordering(participant):
+    sender_a = SampleSender('a', participant.message_mgr)
+    sender_b = SampleSender('b', participant.message_mgr)
+
+    async def send():
+        for handler in ('MSG_SLOW', 'MSG_FAST', 'MSG_SLOW', 'MSG_FAST'):
+            participant.handle_message(sender_a, SampleMessage(handler))
+        participant.handle_message(sender_b, SampleMessage('MSG_FAST'))
+
+        # sender_a has hit its in-flight limit.
+        assert not sender_a.transport.reading
+        await asyncio.sleep(0.1)
+
+    run(send())
+
+    # sender_b was not held up by sender_a's slow handlers, and
+    # sender_a's messages were handled in order.
+    assert participant.service.handled == [
+        ('b', 'MSG_FAST'),
+        ('a', 'MSG_SLOW'), ('a', 'MSG_FAST'),
+        ('a', 'MSG_SLOW'), ('a', 'MSG_FAST')
+    ]
+    assert sender_a.transport.reading
+    assert sender_a.close_handlers == []
+
+
+def test_coroutine_handler_cancellation(participant):
+    sender = SampleSender('a', participant.message_mgr)
+
+    async def send():
+        participant.handle_message(sender, SampleMessage('MSG_SLOW'))
+        participant.handle_message(sender, SampleMessage('MSG_FAST'))
+
+        # Closing the sender drops its pending messages.
+        for close_handler in list(sender.close_handlers):
+            close_handler()
+        await asyncio.sleep(0.1)
+
+    run(send())
+
+    assert participant.service.handled == []
@@ -0,0 +1,193 @@
+import pytest
+
+from ki.extensions import build_frame
+from ki.net import Server
+from ki.protocol import ProtocolValueError
+from ki.protocol.net import ServerSession, SessionRegistry, SessionGroup, \
+    SessionCloseErrorCode, tracer
+from ki.trace import TraceEventType, decode_trace
+
+from .conftest import create_sample
+
+
+class RecordingSession(ServerSession):
+    def __init__(self, id):
+        ServerSession.__init__(self, id)
+        self.frames = []
+
+        self.errors = []
+
+    def send_packet_data(self, data, size):
+        self.frames.append(data)
+
+    def close(self, error):
+        self.errors.append(error)
+
+
+class FailingTransport(object):
+    def write(self, data):
+        raise ConnectionError('Transport is gone.')
+
+
+class SampleTransport(object):
+    def __init__(self):
+        self.frames = []
+        self.session = None
+        self.closed = False
+
+    def write(self, data):
+        self.frames.append(data)
+
+    def get_protocol(self):
+        return self
+
+    def close(self):
+        self.closed = True
+
+
+@pytest.fixture
+def registry():
+    return SessionRegistry()
+
+
+def test_set_operations(registry):
+    a = SessionGroup(registry)
+    a.update([1, 2, 3, 0xFFFF])
+    b = SessionGroup(registry)
+    b.update([3, 4])
+
+    assert len(a) == 4
+    assert 0xFFFF in a
+    assert 5 not in a
+    assert list(a) == [1, 2, 3, 0xFFFF]
+
+    assert list(a | b) == [1, 2, 3, 4, 0xFFFF]
+    assert list(a & b) == [3]
+    assert list(a - b) == [1, 2, 0xFFFF]
+    assert list(a ^ b) == [1, 2, 4, 0xFFFF]
+
+    c = a.copy()
+    c -= b
+    assert c == a - b
+    assert len(a) == 4
+
+    # Adding and removing report whether or not anything changed.
+    assert a.add(5) is True
+    assert a.add(5) is False
+    assert a.remove(5) is True
+    assert a.remove(5) is False
+
+
+def test_send(registry):
+    sessions = [RecordingSession(id) for id in (1, 2, 3)]
+    for session in sessions:
+        registry.add(session)
+
+    group = SessionGroup(registry)
+    group.update([1, 3, 4])
+
+    # Members without a registered session are skipped.
+    assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 2
+    assert [len(session.frames) for session in sessions] == [1, 0, 1]
+
+    # Removed sessions leave every group.
+    registry.remove(3)
+    assert 3 not in group
+    assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 1
+
+    # Sessions with a writer are all handed the same frame, without
+    # going through send_packet_data().
+    transports = [SampleTransport(), SampleTransport()]
+    registry.add(sessions[0], transports[0].write)
+    registry.add(sessions[1], transports[1].write)
+    group.update([2])
+    assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 2
+    assert [len(session.frames) for session in sessions] == [2, 0, 1]
+    assert transports[0].frames == [b'\x0D\xF0\x04\x00\x00\x00\x00\x00']
+    assert transports[0].frames[0] is transports[1].frames[0]
+
+
+def test_failed_send(registry):
+    sessions = [RecordingSession(id) for id in (1, 2, 3)]
+    transports = [SampleTransport(), FailingTransport(), SampleTransport()]
+    for session, transport in zip(sessions, transports):
+        registry.add(session, transport.write)
+    group = SessionGroup(registry)
+    group.update([1, 2, 3])
+
+    # A member that fails to send is closed, and the rest still get the
+    # frame.
+    assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 2
+    assert len(transports[0].frames) == len(transports[2].frames) == 1
+    assert sessions[1].errors == [SessionCloseErrorCode.APPLICATION_ERROR]
+    assert sessions[0].errors == sessions[2].errors == []
+
+
+def test_traced_send(registry):
+    session = RecordingSession(1)
+    transport = SampleTransport()
+    registry.add(session, transport.write)
+    group = SessionGroup(registry)
+    group.add(1)
+
+    recorded = tracer.events_recorded
+    tracer.trace_session(1)
+    try:
+        assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 1
+    finally:
+        tracer.trace_session(1, False)
+
+    # Frames written straight to a transport are traced as they would
+    # be by the session.
+    assert tracer.events_recorded - recorded == 1
+    event = decode_trace(tracer.dumps())[-1]
+    assert event.type == TraceEventType.FRAME_SENT
+    assert event.session_id == 1
+    assert event.size == 8
+
+
+def test_send_message(registry, manager):
+    message = create_sample(manager, 7)
+
+    sessions = [RecordingSession(id) for id in (1, 2)]
+    transport = SampleTransport()
+    registry.add(sessions[0], transport.write)
+    registry.add(sessions[1])
+    group = SessionGroup(registry)
+    group.update([1, 2])
+
+    # The message is framed just as a DML session would send it.
+    frame = build_frame(False, 0, message.to_bytes())
+    assert group.send(message) == 2
+    assert transport.frames == [frame]
+    assert sessions[0].frames == []
+    assert sessions[1].frames == [frame]
+
+    # Packets that would need the extended length form are refused.
+    message['TestStr'].value = 'X' * 0x8000
+    with pytest.raises(ProtocolValueError):
+        group.send(message)
+    assert len(transport.frames) == 1
+
+
+def test_server_sessions():
+    server = Server(0)
+    transports = {id: SampleTransport() for id in (1, 2, 3)}
+    for id, transport in transports.items():
+        server.create_session(transport, id)
+    assert server.session_registry.get_writer(1) == transports[1].write
+
+    group = server.create_session_group([1, 2, 3])
+    assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 3
+
+    # Closed and released sessions leave the group, and are no longer
+    # written to.
+    server.sessions[1].close(SessionCloseErrorCode.SESSION_DIED)
+    server.release_session(server.sessions[2])
+    assert list(group) == [3]
+    assert server.session_registry.get(1) is None
+    assert server.session_registry.get_writer(2) is None
+    assert transports[1].closed and transports[2].closed
+
+    assert group.send_frame(b'\x0D\xF0\x04\x00\x00\x00\x00\x00') == 1
+    assert [len(transports[id].frames) for id in (1, 2, 3)] == [1, 1, 2]
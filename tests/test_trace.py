@@ -0,0 +1,123 @@
+import asyncio
+import time
+
+import pytest
+from ki.compression import CompressionPolicy
+from ki.extensions import COMPRESSION_OPCODE, DELTA_MESSAGE_OPCODE, build_frame
+from ki.protocol.net import tracer
+from ki.trace import TRACE_HEADER, TRACE_EVENT, TRACE_MAGIC, TRACE_VERSION, \
+    TraceError, TraceEventType, decode_trace
+
+from .conftest import connect_client, run_until, start_server
+
+
+def build_trace(events, steady_time=5 * 10**9, system_time=1700000000 * 10**9):
+    data = TRACE_HEADER.pack(TRACE_MAGIC, TRACE_VERSION, TRACE_EVENT.size,
+                             len(events), steady_time, system_time)
+    for event in events:
+        data += TRACE_EVENT.pack(*event)
+    return data
+
+
+def test_trace_decoding():
+    data = build_trace([
+        # timestamp, size, detail, session_id, type, control, opcode,
+        # service_id, message_type
+        (4 * 10**9, 60, 0, 7, TraceEventType.FRAME_SENT, 0, 0, 5, 2),
+        (5 * 10**9, 0, 0, 7, TraceEventType.CONTROL_RECEIVED, 1, 4, 0, 0),
+        (5 * 10**9, 0, 3, 8, TraceEventType.CLOSED, 0, 0, 0, 0),
+    ])
+    events = decode_trace(data)
+    assert len(events) == 3
+
+    # Timestamps are placed relative to the clocks in the header.
+    assert events[0].timestamp == pytest.approx(1699999999.0)
+    assert events[1].timestamp == pytest.approx(1700000000.0)
+
+    assert events[0].type == TraceEventType.FRAME_SENT
+    assert events[0].session_id == 7
+    assert events[0].size == 60
+    assert (events[0].service_id, events[0].message_type) == (5, 2)
+    assert events[1].control and events[1].opcode == 4
+    assert events[2].type == TraceEventType.CLOSED
+    assert events[2].detail == 3
+
+
+def test_invalid_trace():
+    with pytest.raises(TraceError):
+        decode_trace(b'')
+    with pytest.raises(TraceError):
+        decode_trace(b'NOTATRACE' + bytes(TRACE_HEADER.size))
+
+    # Declares more events than it has.
+    data = build_trace([(0, 0, 0, 1, TraceEventType.FRAME_SENT, 0, 0, 0, 0)])
+    with pytest.raises(TraceError):
+        decode_trace(data[:-1])
+
+
+def test_native_trace(loop):
+    server = start_server(loop)
+    client = connect_client(loop, server)
+    session = next(iter(server.sessions.values()))
+    message_type = server.message_mgr[1]['MSG_SAMPLE'].type
+
+    assert tracer.sample_rate == 0
+    recorded = tracer.events_recorded
+    tracer.trace_session(session.id)
+    try:
+        assert tracer.is_session_traced(session.id)
+        session.send_message(server.message_mgr.create_message(1, 'MSG_SAMPLE'))
+        client.session.send_message(client.message_mgr.create_message(1, 'MSG_SAMPLE'))
+        run_until(loop, lambda: tracer.events_recorded - recorded >= 3)
+        server.close()
+        loop.run_until_complete(asyncio.sleep(0.05))
+    finally:
+        tracer.trace_session(session.id, False)
+    assert not tracer.is_session_traced(session.id)
+
+    # Only the traced session's events were recorded.
+    count = tracer.events_recorded - recorded
+    events = decode_trace(tracer.dumps())[-count:]
+    assert len(events) == count
+    assert all(event.session_id == session.id for event in events)
+    assert all(abs(event.timestamp - time.time()) < 60 for event in events)
+
+    event_types = [event.type for event in events]
+    sent = events[event_types.index(TraceEventType.FRAME_SENT)]
+    assert not sent.control and sent.opcode == 0
+    assert (sent.service_id, sent.message_type) == (1, message_type)
+    assert sent.size > 0
+
+    received = events[event_types.index(TraceEventType.MESSAGE_RECEIVED)]
+    assert (received.service_id, received.message_type) == (1, message_type)
+    assert TraceEventType.APPLICATION_RECEIVED in event_types
+    assert event_types[-1] == TraceEventType.CLOSED
+
+
+def test_python_frames_traced(loop):
+    server = start_server(loop, delta_encoding=True,
+                          compression_policy=CompressionPolicy(threshold=0))
+    client = connect_client(loop, server, delta_encoding=True)
+    session = next(iter(server.sessions.values()))
+    run_until(loop, lambda: session.delta.peer_supported)
+
+    # Frames built in Python skip the session's native send path, but
+    # are traced all the same.
+    recorded = tracer.events_recorded
+    tracer.trace_session(session.id)
+    try:
+        message = server.message_mgr.create_message(1, 'MSG_SAMPLE')
+        session.compression.offer()
+        session.delta.send_message(message)
+        session.send_frames([build_frame(False, 0, message.to_bytes())] * 2)
+    finally:
+        tracer.trace_session(session.id, False)
+        server.close()
+        loop.run_until_complete(asyncio.sleep(0.05))
+
+    count = tracer.events_recorded - recorded
+    events = decode_trace(tracer.dumps())[-count:]
+    sent = [(event.control, event.opcode) for event in events
+            if event.type == TraceEventType.FRAME_SENT]
+    assert sent == [(True, COMPRESSION_OPCODE), (False, DELTA_MESSAGE_OPCODE),
+                    (False, 0), (False, 0)]
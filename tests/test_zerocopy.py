@@ -0,0 +1,148 @@
+import gc
+import socket
+import time
+
+import pytest
+
+from ki.extensions import build_frame
+from ki.protocol.net import BufferPool, ZeroCopySender
+
+from .conftest import create_sample
+
+
+@pytest.fixture
+def tcp_pair():
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.bind(('127.0.0.1', 0))
+    listener.listen(1)
+    client = socket.create_connection(listener.getsockname())
+    server, _ = listener.accept()
+    listener.close()
+    yield client, server
+    client.close()
+    server.close()
+
+
+def receive_exactly(sock, size):
+    data = b''
+    while len(data) < size:
+        data += sock.recv(size - len(data))
+    return data
+
+
+def test_disabled_sender(manager):
+    pool = BufferPool(0x100, 4)
+    left, right = socket.socketpair(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        # Unix sockets do not support zero-copy sends, so messages go
+        # through the regular send path without touching the pool.
+        sender = ZeroCopySender(left.fileno(), pool)
+        assert not sender.enabled
+        assert sender.send_message(create_sample(manager, 7)) is None
+        assert pool.available == 4
+        assert sender.bytes_sent == 0
+    finally:
+        left.close()
+        right.close()
+
+
+def test_copied_sends(manager, tcp_pair):
+    client, server = tcp_pair
+    pool = BufferPool(0x100, 4)
+    sender = ZeroCopySender(client.fileno(), pool, threshold=0x10000)
+    if not sender.enabled:
+        pytest.skip('Zero-copy sends are not supported here.')
+
+    # Frames below the threshold are copied, and their buffer is
+    # recycled straight away.
+    message = create_sample(manager, 7)
+    frame = build_frame(False, 0, message.to_bytes())
+    for _ in range(8):
+        assert sender.send_message(message) == b''
+    assert pool.available == 4
+    assert sender.zerocopy_sends == 0
+    assert sender.pending == 0
+    assert sender.bytes_sent == len(frame) * 8
+    assert receive_exactly(server, len(frame) * 8) == frame * 8
+
+    # Complete frames are sent the same way.
+    assert sender.send_frame(frame) == b''
+    assert receive_exactly(server, len(frame)) == frame
+    assert pool.available == 4
+
+    # Messages that do not fit in a buffer are left to the caller.
+    assert sender.send_message(create_sample(manager, 7, 'X' * 0x100)) is None
+    assert pool.available == 4
+
+    del sender
+    gc.collect()
+    assert pool.deferred == 0
+
+
+def fill_socket(manager, sender):
+    """Sends until the socket stops taking more, as nothing is read on
+    the other end; the sends stay in flight until then.
+    """
+    message = create_sample(manager, 7, 'X' * 30000)
+    for _ in range(64):
+        remainder = sender.send_message(message)
+        assert remainder is not None
+        if remainder:
+            break
+    assert sender.pending > 0
+
+
+def test_deferred_buffers(manager, tcp_pair):
+    client, server = tcp_pair
+    pool = BufferPool(buffer_count=64)
+    sender = ZeroCopySender(client.fileno(), pool, threshold=0)
+    if not sender.enabled:
+        pytest.skip('Zero-copy sends are not supported here.')
+
+    fill_socket(manager, sender)
+    assert pool.available == 64 - sender.pending
+
+    # The pool keeps hold of whatever is still in flight once the
+    # sender and its socket are gone.
+    del sender
+    gc.collect()
+    client.close()
+    assert pool.deferred + pool.available == 64
+
+    # The peer still sees the connection end once it has read
+    # everything.
+    server.settimeout(5.0)
+    while server.recv(0x100000):
+        pool.reclaim()
+    deadline = time.monotonic() + 5.0
+    while pool.reclaim() or pool.deferred and time.monotonic() < deadline:
+        time.sleep(0.01)
+    assert pool.deferred == 0
+    assert pool.available == 64
+
+
+def test_deferred_timeout(manager, tcp_pair):
+    client, server = tcp_pair
+    pool = BufferPool(buffer_count=64, deferred_timeout=0.1)
+    sender = ZeroCopySender(client.fileno(), pool, threshold=0)
+    if not sender.enabled:
+        pytest.skip('Zero-copy sends are not supported here.')
+
+    fill_socket(manager, sender)
+    del sender
+    gc.collect()
+    client.close()
+
+    # A peer that stops reading only holds on to the buffers until the
+    # deadline, after which its connection is reset.
+    pool.reclaim()
+    assert pool.deferred > 0
+    time.sleep(0.2)
+    pool.reclaim()
+    assert pool.deferred == 0
+    assert pool.available == 64
+
+    server.settimeout(5.0)
+    with pytest.raises(ConnectionResetError):
+        while server.recv(0x100000):
+            pass